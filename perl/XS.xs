@@ -250,6 +250,21 @@ bool lpIterate(LiquidRenderer renderer, void* variable, bool (*callback)(void* v
     return false;
 }
 
+long long lpGetArrayVariables(LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) {
+    dTHX;
+    // Objects are iterated through their `next` method, by lpIterate.
+    if (sv_isobject((SV*)variable) || !SvROK((SV*)variable) || SvTYPE(SvRV((SV*)variable)) != SVt_PVAV)
+        return -1;
+    AV* av = (AV*)SvRV((SV*)variable);
+    long long length = av_top_index(av)+1;
+    long long filled = 0;
+    for (long long i = idx < 0 ? 0 : idx; i < length && filled < count; ++i) {
+        SV** sv = av_fetch(av, i, 0);
+        targets[filled++] = sv ? *sv : &PL_sv_undef;
+    }
+    return filled;
+}
+
 long long lpGetArraySize(LiquidRenderer renderer, void* variable) {
     dTHX;
     if (!SvROK((SV*)variable) || SvTYPE(SvRV((SV*)variable)) != SVt_PVAV)
@@ -708,7 +723,11 @@ createRenderer(context, parent)
             lpCreateNil,
             lpCreateClone,
             lpFreeVariable,
-            lpCompare
+            lpCompare,
+            NULL,
+            NULL,
+            NULL,
+            lpGetArrayVariables
         };
         LiquidRenderer renderer = liquidCreateRenderer(*(LiquidContext*)&context);
         liquidRegisterVariableResolver(renderer, resolver);
@@ -156,6 +156,17 @@ static bool liquidCiterate(LiquidRenderer renderer, void* variable, bool liquidC
     return false;
 }
 
+static long long liquidCgetArrayVariables(LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) {
+    VALUE value = (VALUE)variable;
+    long long length, filled = 0;
+    if (TYPE(value) != T_ARRAY)
+        return -1;
+    length = RARRAY_LEN(value);
+    for (long long i = idx < 0 ? 0 : idx; i < length && filled < count; ++i)
+        targets[filled++] = (void*)rb_ary_entry(value, i);
+    return filled;
+}
+
 static long long liquidCgetArraySize(LiquidRenderer renderer, void* variable) {
     VALUE value = (VALUE)variable;
     if (TYPE(value) != T_ARRAY)
@@ -321,7 +332,11 @@ VALUE liquidCRenderer_m_initialize(VALUE self, VALUE contextValue) {
         liquidCcreateNil,
         liquidCcreateClone,
         liquidCfreeVariable,
-        liquidCcompare
+        liquidCcompare,
+        NULL,
+        NULL,
+        NULL,
+        liquidCgetArrayVariables
     };
     TypedData_Get_Struct(self, LiquidRenderer, &liquidCRenderer_type, renderer);
     TypedData_Get_Struct(contextValue, LiquidCRubyContext, &liquidC_type, context);
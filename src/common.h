@@ -10,6 +10,9 @@
 #include <cassert>
 #include <cstdarg>
 #include <chrono>
+#include <memory_resource>
+#include <atomic>
+#include <cstdint>
 
 #include "interface.h"
 
@@ -91,7 +94,69 @@ namespace Liquid {
             POINTER
         };
 
+        // An array that's shared by every copy of the variant holding it, and only copied when one of them changes it; so that arrays can be passed
+        // around the renderer, and put into other arrays, without copying all their elements. Reads go through the const accessors, which never
+        // copy; anything that changes the array goes through mutate, which copies it first if it's shared. Shared arrays are never changed, so
+        // they can be read from many threads at once, as with arrays in a parsed template.
+        struct Array {
+            struct Block {
+                vector<Variant> elements;
+                std::atomic<size_t> references;
+            };
+            typedef vector<Variant>::const_iterator const_iterator;
+            typedef vector<Variant>::const_reverse_iterator const_reverse_iterator;
+
+            // Null only once moved from; which reads as empty.
+            Block* block;
+
+            Array() : block(new Block { {}, 1 }) { }
+            Array(const vector<Variant>& elements) : block(new Block { elements, 1 }) { }
+            Array(vector<Variant>&& elements) : block(new Block { std::move(elements), 1 }) { }
+            Array(const Array& array) : block(array.block) { if (block) block->references.fetch_add(1, std::memory_order_relaxed); }
+            Array(Array&& array) : block(array.block) { array.block = nullptr; }
+            ~Array() { release(); }
+            Array& operator = (const Array& array) { Array copy(array); std::swap(block, copy.block); return *this; }
+            Array& operator = (Array&& array) { std::swap(block, array.block); return *this; }
+
+            void release() {
+                if (block && block->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    delete block;
+                block = nullptr;
+            }
 
+            const vector<Variant>& elements() const {
+                static const vector<Variant> empty;
+                return block ? block->elements : empty;
+            }
+            // Makes the array this variant's alone, copying it if it's shared, and returns it to be changed.
+            vector<Variant>& mutate() {
+                if (!block)
+                    block = new Block { {}, 1 };
+                else if (block->references.load(std::memory_order_acquire) > 1) {
+                    Block* copy = new Block { block->elements, 1 };
+                    release();
+                    block = copy;
+                }
+                return block->elements;
+            }
+
+            size_t size() const { return elements().size(); }
+            bool empty() const { return elements().empty(); }
+            const Variant& operator[](size_t idx) const { return elements()[idx]; }
+            const_iterator begin() const { return elements().begin(); }
+            const_iterator end() const { return elements().end(); }
+            const_reverse_iterator rbegin() const { return elements().rbegin(); }
+            const_reverse_iterator rend() const { return elements().rend(); }
+            bool operator == (const Array& array) const { return block == array.block || elements() == array.elements(); }
+
+            void push_back(const Variant& variant) { mutate().push_back(variant); }
+            void push_back(Variant&& variant) { mutate().push_back(std::move(variant)); }
+            void reserve(size_t size) { mutate().reserve(size); }
+            void resize(size_t size) { mutate().resize(size); }
+        };
+
+        // Only arrays are shared between copies. Strings stay inline std::strings: nearly all that are copied while rendering fit in the
+        // short string buffer, so copying them never allocates.
         union {
             bool b;
             double f;
@@ -99,7 +164,7 @@ namespace Liquid {
             string s;
             void* p;
             Variable v;
-            vector<Variant> a;
+            Array a;
             struct {
                 const char* view;
                 size_t len;
@@ -115,7 +180,7 @@ namespace Liquid {
                     new(&s) std::string(v.s);
                 break;
                 case Type::ARRAY:
-                    new(&a) std::vector<Variant>(v.a);
+                    new(&a) Array(v.a);
                 break;
                 case Type::STRING_VIEW:
                     view = v.view;
@@ -146,7 +211,7 @@ namespace Liquid {
                     new(&s) std::string(std::move(v.s));
                 break;
                 case Type::ARRAY:
-                    new(&a) vector<Variant>(std::move(v.a));
+                    new(&a) Array(std::move(v.a));
                 break;
                 case Type::STRING_VIEW:
                     view = v.view;
@@ -183,6 +248,7 @@ namespace Liquid {
         Variant(std::nullptr_t) : p(nullptr), type(Type::NIL) { }
         Variant(const std::vector<Variant>& a) : a(a), type(Type::ARRAY) { }
         Variant(vector<Variant>&& a) : a(std::move(a)), type(Type::ARRAY) { }
+        Variant(const Array& a) : a(a), type(Type::ARRAY) { }
 
         ~Variant() {
             switch (type) {
@@ -190,7 +256,7 @@ namespace Liquid {
                     s.~string();
                 break;
                 case Type::ARRAY:
-                    a.~vector<Variant>();
+                    a.~Array();
                 break;
                 default:
                 break;
@@ -217,68 +283,21 @@ namespace Liquid {
             return true;
         }
 
+        // Goes through a temporary, so that a variant can be assigned something it contains.
         Variant& operator = (const Variant& v) {
-            switch (v.type) {
-                case Type::STRING:
-                    if (type != Type::STRING) {
-                        if (v.type == Type::ARRAY)
-                            a.~vector<Variant>();
-                        else
-                            i = 0;
-                        new(&s) string;
-                    }
-                    s = v.s;
-                break;
-                case Type::ARRAY:
-                    if (type != Type::ARRAY) {
-                        if (v.type == Type::STRING)
-                            s.~string();
-                        else
-                            i = 0;
-                        new(&a) vector<Variant>();
-                    }
-                    a = v.a;
-                break;
-                case Type::STRING_VIEW:
-                    view = v.view;
-                    len = v.len;
-                break;
-                default:
-                    f = v.f;
-                break;
+            if (this != &v) {
+                Variant copy(v);
+                this->~Variant();
+                new(this) Variant(std::move(copy));
             }
             return *this;
         }
 
         Variant& operator = (Variant&& v) {
-            switch (v.type) {
-                case Type::STRING:
-                    if (type != Type::STRING) {
-                        if (v.type == Type::ARRAY)
-                            a.~vector<Variant>();
-                        else
-                            i = 0;
-                        new(&s) string;
-                    }
-                    s = move(v.s);
-                break;
-                case Type::ARRAY:
-                    if (type != Type::ARRAY) {
-                        if (v.type == Type::STRING)
-                            s.~string();
-                        else
-                            i = 0;
-                        new(&a) vector<Variant>();
-                    }
-                    a = move(v.a);
-                break;
-                case Type::STRING_VIEW:
-                    view = v.view;
-                    len = v.len;
-                break;
-                default:
-                    f = v.f;
-                break;
+            if (this != &v) {
+                Variant moved(std::move(v));
+                this->~Variant();
+                new(this) Variant(std::move(moved));
             }
             return *this;
         }
@@ -408,7 +427,66 @@ namespace Liquid {
 
     struct NodeType;
 
-    struct Node {
+    // Nodes, and what they hold, are allocated from whichever memory resource is current on this thread when they're created, or the global heap
+    // if there is none. Each remembers where it came from, so that it can be given back to the same place no matter where it's deleted from.
+    // Only blocks from a resource pay for that: they're placed a header past a BLOCK_ALIGNMENT boundary, with the resource in the header, while
+    // blocks from the heap always sit on one; so the pointer alone says which it is, and nodes on the heap are no bigger than they'd otherwise be.
+    struct ResourceAllocated {
+        static inline thread_local std::pmr::memory_resource* resource = nullptr;
+        // Makes a resource current for as long as it's in scope; null means the global heap.
+        struct ResourceScope {
+            std::pmr::memory_resource* previous;
+            ResourceScope(std::pmr::memory_resource* resource) : previous(ResourceAllocated::resource) { ResourceAllocated::resource = resource; }
+            ~ResourceScope() { ResourceAllocated::resource = previous; }
+        };
+        // Anything allocated like this must be aligned to no more than the header.
+        static constexpr size_t RESOURCE_HEADER_SIZE = 8;
+        static constexpr size_t BLOCK_ALIGNMENT = 2 * RESOURCE_HEADER_SIZE;
+        static_assert(sizeof(std::pmr::memory_resource*) <= RESOURCE_HEADER_SIZE);
+
+        static void* operator new(size_t size) {
+            if (std::pmr::memory_resource* current = resource) {
+                void* block = current->allocate(size + RESOURCE_HEADER_SIZE, BLOCK_ALIGNMENT);
+                *static_cast<std::pmr::memory_resource**>(block) = current;
+                return static_cast<char*>(block) + RESOURCE_HEADER_SIZE;
+            }
+            if constexpr (__STDCPP_DEFAULT_NEW_ALIGNMENT__ >= BLOCK_ALIGNMENT)
+                return ::operator new(size);
+            else
+                return ::operator new(size, std::align_val_t(BLOCK_ALIGNMENT));
+        }
+        static void operator delete(void* pointer, size_t size) {
+            if (reinterpret_cast<uintptr_t>(pointer) % BLOCK_ALIGNMENT == RESOURCE_HEADER_SIZE) {
+                void* block = static_cast<char*>(pointer) - RESOURCE_HEADER_SIZE;
+                (*static_cast<std::pmr::memory_resource**>(block))->deallocate(block, size + RESOURCE_HEADER_SIZE, BLOCK_ALIGNMENT);
+            } else if constexpr (__STDCPP_DEFAULT_NEW_ALIGNMENT__ >= BLOCK_ALIGNMENT)
+                ::operator delete(pointer);
+            else
+                ::operator delete(pointer, std::align_val_t(BLOCK_ALIGNMENT));
+        }
+        // The current resource, for containers to allocate from.
+        static std::pmr::memory_resource* currentResource() { return resource ? resource : std::pmr::new_delete_resource(); }
+    };
+
+    // The leading run of a variable's path that's known when it's parsed: its plain keys and indices, up to the first dot filter or segment that
+    // has to be rendered, laid out as the resolver's resolvePath takes them. Keys are copied into the path, and hashed, so neither has to be done
+    // again each time the variable is rendered. Allocated, along with its contents, from the current resource, as its node is.
+    struct CompiledPath : ResourceAllocated {
+        std::pmr::vector<LiquidPathSegment> segments;
+        // Every key, null terminated, back to back; what the segments' keys point into.
+        std::pmr::string keys;
+
+        CompiledPath() : segments(currentResource()), keys(currentResource()) { }
+        CompiledPath(const CompiledPath& path) : segments(path.segments, currentResource()), keys(path.keys, currentResource()) {
+            for (auto& segment : segments) {
+                if (segment.type == LIQUID_PATH_SEGMENT_TYPE_KEY)
+                    segment.key = keys.data() + (segment.key - path.keys.data());
+            }
+        }
+    };
+    static_assert(alignof(CompiledPath) <= ResourceAllocated::RESOURCE_HEADER_SIZE);
+
+    struct Node : ResourceAllocated {
         const NodeType* type;
         size_t line;
         size_t column;
@@ -417,6 +495,8 @@ namespace Liquid {
             Variant variant;
             vector<unique_ptr<Node>> children;
         };
+        // Only ever set on variables; see compilePath.
+        unique_ptr<CompiledPath> path;
 
         Node() : type(nullptr), line(0), column(0), variant() { }
         Node(const NodeType* type) : type(type), line(0), column(0), children() { }
@@ -426,13 +506,15 @@ namespace Liquid {
                 children.reserve(node.children.size());
                 for (auto it = node.children.begin(); it != node.children.end(); ++it)
                     children.push_back(make_unique<Node>(*it->get()));
+                if (node.path)
+                    path = make_unique<CompiledPath>(*node.path);
             } else {
                 new(&variant) Variant(node.variant);
             }
         }
         Node(const Variant& v) : type(nullptr), line(0), column(0), variant(v) { }
         Node(Variant&& v) : type(nullptr), line(0), column(0), variant(std::move(v)) { }
-        Node(Node&& node) :type(node.type), line(node.line), column(node.column) {
+        Node(Node&& node) :type(node.type), line(node.line), column(node.column), path(std::move(node.path)) {
             if (type) {
                 new(&children) vector<unique_ptr<Node>>(std::move(node.children));
             } else {
@@ -462,12 +544,14 @@ namespace Liquid {
             } else {
                 new(&variant) Variant();
             }
+            path = n.path ? make_unique<CompiledPath>(*n.path) : nullptr;
             type = n.type;
             return *this;
         }
 
         // This is more complicated, because of the case where you move one of your children into yourself.
         Node& operator = (Node&& n) {
+            path = std::move(n.path);
             if (type) {
                 if (!n.type) {
                     Variant v = move(n.variant);
@@ -492,6 +576,48 @@ namespace Liquid {
             return *this;
         }
 
+        // Compiles the leading literal segments of a variable's children into its path; or clears the path, if there are none.
+        void compilePath() {
+            assert(type);
+            size_t count = 0, length = 0;
+            for (; count < children.size(); ++count) {
+                if (!children[count])
+                    break;
+                const Node& child = *children[count].get();
+                if (child.type)
+                    break;
+                if (child.variant.type == Variant::Type::STRING)
+                    length += child.variant.s.size() + 1;
+                else if (child.variant.type == Variant::Type::STRING_VIEW)
+                    length += child.variant.len + 1;
+                else if (child.variant.type != Variant::Type::INT)
+                    break;
+            }
+            if (count == 0) {
+                path = nullptr;
+                return;
+            }
+            path = make_unique<CompiledPath>();
+            path->segments.resize(count);
+            // Reserved up front, so the keys never move once they're pointed to.
+            path->keys.reserve(length);
+            for (size_t i = 0; i < count; ++i) {
+                const Variant& variant = children[i]->variant;
+                LiquidPathSegment& segment = path->segments[i];
+                if (variant.type == Variant::Type::INT) {
+                    segment.type = LIQUID_PATH_SEGMENT_TYPE_INDEX;
+                    segment.index = variant.i;
+                } else {
+                    segment.type = LIQUID_PATH_SEGMENT_TYPE_KEY;
+                    segment.keyLength = variant.type == Variant::Type::STRING ? variant.s.size() : variant.len;
+                    segment.key = path->keys.data() + path->keys.size();
+                    path->keys.append(variant.type == Variant::Type::STRING ? variant.s.data() : variant.view, segment.keyLength);
+                    path->keys.push_back(0);
+                    segment.hash = liquidHashKey(segment.key, segment.keyLength);
+                }
+            }
+        }
+
         template <class T>
         void walk(T callback) const {
             callback(*this);
@@ -501,6 +627,7 @@ namespace Liquid {
             }
         }
     };
+    static_assert(alignof(Node) <= ResourceAllocated::RESOURCE_HEADER_SIZE);
 
     struct Renderer;
     struct Parser;
@@ -0,0 +1,501 @@
+#ifndef LIQUIDCOMPACTVARIABLE_H
+#define LIQUIDCOMPACTVARIABLE_H
+
+#include "common.h"
+#include "context.h"
+
+#include <string_view>
+#include <unordered_set>
+#include <algorithm>
+
+namespace Liquid {
+
+    struct CompactArray;
+    struct CompactDictionary;
+
+    // A variable in a CompactStore. Sixteen bytes, and trivially copyable; scalars and strings of up to eight bytes are held inline, longer strings
+    // point into the store's arena, and arrays and dictionaries are handles to objects in the arena, so copying one aliases the same container.
+    struct CompactVariable {
+        static constexpr unsigned int SHORT_STRING_SIZE = 8;
+
+        LiquidVariableType type;
+        // The length of a string.
+        unsigned int length;
+        union {
+            bool b;
+            long long i;
+            double f;
+            void* p;
+            const char* str;
+            char shortString[SHORT_STRING_SIZE];
+            CompactArray* array;
+            CompactDictionary* dictionary;
+        };
+
+        CompactVariable() : type(LIQUID_VARIABLE_TYPE_NIL), length(0), i(0) { }
+        CompactVariable(bool b) : type(LIQUID_VARIABLE_TYPE_BOOL), length(0), b(b) { }
+        CompactVariable(long long i) : type(LIQUID_VARIABLE_TYPE_INT), length(0), i(i) { }
+        CompactVariable(int i) : CompactVariable((long long)i) { }
+        CompactVariable(double f) : type(LIQUID_VARIABLE_TYPE_FLOAT), length(0), f(f) { }
+        // Strings have to be allocated from a store; see CompactStore::string.
+        CompactVariable(const char* str) = delete;
+
+        operator Variable () { return Variable({ this }); }
+
+        const char* getStringData() const { return length <= SHORT_STRING_SIZE ? shortString : str; }
+        std::string_view getStringView() const { return std::string_view(getStringData(), length); }
+
+        bool getTruthy() const {
+            return !(
+                (type == LIQUID_VARIABLE_TYPE_BOOL && !b) ||
+                (type == LIQUID_VARIABLE_TYPE_INT && !i) ||
+                (type == LIQUID_VARIABLE_TYPE_FLOAT && !f) ||
+                (type == LIQUID_VARIABLE_TYPE_OTHER && !p) ||
+                (type == LIQUID_VARIABLE_TYPE_NIL)
+            );
+        }
+
+        bool getString(std::string& s) const {
+            switch (type) {
+                case LIQUID_VARIABLE_TYPE_STRING:
+                    s.assign(getStringData(), length);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_FLOAT:
+                    s = std::to_string(f);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_INT:
+                    s = std::to_string(i);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_BOOL:
+                    s = b ? "true" : "false";
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        bool operator < (const CompactVariable& v) const {
+            if (v.type != type)
+                return false;
+            switch (type) {
+                case LIQUID_VARIABLE_TYPE_INT:
+                    return i < v.i;
+                case LIQUID_VARIABLE_TYPE_FLOAT:
+                    return f < v.f;
+                case LIQUID_VARIABLE_TYPE_STRING:
+                    return getStringView() < v.getStringView();
+                default:
+                    return p < v.p;
+            }
+        }
+
+        inline bool getDictionaryVariable(std::string_view key, CompactVariable*& target) const;
+        inline bool getArrayVariable(long long idx, CompactVariable*& target) const;
+    };
+
+    struct CompactArray {
+        CompactVariable* elements = nullptr;
+        unsigned int size = 0;
+        unsigned int capacity = 0;
+    };
+
+    // Entries up to sorted are ordered by key, and found by binary search; keys added while rendering are appended after them, and scanned. Keys are
+    // ordered by length first, which is cheaper to compare, and is all the order is for. Appending never reorders entries, but can copy them all to
+    // a larger block, as any container's growth does; see CompactStore.
+    struct CompactDictionary {
+        struct Entry {
+            const char* key;
+            unsigned int keyLength;
+            CompactVariable value;
+
+            bool precedes(std::string_view symbol) const {
+                if (keyLength != symbol.size())
+                    return keyLength < symbol.size();
+                return memcmp(key, symbol.data(), keyLength) < 0;
+            }
+            bool matches(std::string_view symbol) const { return keyLength == symbol.size() && memcmp(key, symbol.data(), keyLength) == 0; }
+        };
+        Entry* entries = nullptr;
+        unsigned int size = 0;
+        unsigned int capacity = 0;
+        unsigned int sorted = 0;
+
+        // Returns the index of the key's entry, or the index it would be inserted at amongst the sorted entries if it isn't there, along with whether it was found.
+        pair<unsigned int, bool> find(std::string_view key) const {
+            Entry* end = entries + sorted;
+            Entry* it = std::lower_bound(entries, end, key, [](const Entry& entry, std::string_view key) { return entry.precedes(key); });
+            if (it != end && it->matches(key))
+                return { (unsigned int)(it - entries), true };
+            for (unsigned int i = sorted; i < size; ++i) {
+                if (entries[i].matches(key))
+                    return { i, true };
+            }
+            return { (unsigned int)(it - entries), false };
+        }
+    };
+
+    bool CompactVariable::getDictionaryVariable(std::string_view key, CompactVariable*& target) const {
+        if (type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return false;
+        auto result = dictionary->find(key);
+        if (!result.second)
+            return false;
+        target = &dictionary->entries[result.first].value;
+        return true;
+    }
+
+    bool CompactVariable::getArrayVariable(long long idx, CompactVariable*& target) const {
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return false;
+        if (idx < 0)
+            idx += array->size;
+        if (idx < 0 || idx >= (long long)array->size)
+            return false;
+        target = &array->elements[idx];
+        return true;
+    }
+
+    // A variable store for C++ embedders that's cheap to build, and to walk. Everything in it is allocated from a single arena, which is released
+    // all at once when the store is; nothing in it is ever freed individually. Arrays and dictionaries hold their values inline in contiguous blocks,
+    // and dictionary keys are interned, so a key shared by many dictionaries is only stored once.
+    // When a container grows, its values are copied to a new block, and the old one is left in place; so pointers to its entries or elements
+    // remain safe to read, but go stale: they won't see any further changes, and anything written through them is lost. Containers themselves
+    // never move, so a variable holding an array or dictionary always sees its current contents. Build the store with the methods below, and then render with the CompactVariableResolver, with
+    // the store as the renderer's resolverCustomData; values assigned by the template are allocated from it too.
+    struct CompactStore {
+        std::pmr::monotonic_buffer_resource arena;
+        std::unordered_set<std::string_view> keys;
+        CompactVariable root;
+
+        CompactStore(size_t initialSize = 4096) : arena(initialSize) { root = dictionary(); }
+        CompactStore(const CompactStore&) = delete;
+        CompactStore& operator = (const CompactStore&) = delete;
+
+        operator Variable () { return Variable({ &root }); }
+
+        template <class T>
+        T* allocate(size_t count = 1) {
+            return static_cast<T*>(arena.allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        std::string_view intern(std::string_view key) {
+            auto it = keys.find(key);
+            if (it != keys.end())
+                return *it;
+            char* copy = allocate<char>(key.size() + 1);
+            memcpy(copy, key.data(), key.size());
+            copy[key.size()] = 0;
+            return *keys.emplace(copy, key.size()).first;
+        }
+
+        CompactVariable string(std::string_view value) {
+            CompactVariable variable;
+            variable.type = LIQUID_VARIABLE_TYPE_STRING;
+            variable.length = value.size();
+            if (value.size() <= CompactVariable::SHORT_STRING_SIZE) {
+                memcpy(variable.shortString, value.data(), value.size());
+            } else {
+                char* copy = allocate<char>(value.size());
+                memcpy(copy, value.data(), value.size());
+                variable.str = copy;
+            }
+            return variable;
+        }
+
+        CompactVariable array(unsigned int capacity = 0) {
+            CompactVariable variable;
+            variable.type = LIQUID_VARIABLE_TYPE_ARRAY;
+            variable.array = new (allocate<CompactArray>()) CompactArray();
+            if (capacity > 0) {
+                variable.array->elements = allocate<CompactVariable>(capacity);
+                variable.array->capacity = capacity;
+            }
+            return variable;
+        }
+
+        CompactVariable dictionary(unsigned int capacity = 0) {
+            CompactVariable variable;
+            variable.type = LIQUID_VARIABLE_TYPE_DICTIONARY;
+            variable.dictionary = new (allocate<CompactDictionary>()) CompactDictionary();
+            if (capacity > 0) {
+                variable.dictionary->entries = allocate<CompactDictionary::Entry>(capacity);
+                variable.dictionary->capacity = capacity;
+            }
+            return variable;
+        }
+
+        template <class T>
+        static void grow(CompactStore& store, T*& block, unsigned int size, unsigned int& capacity, unsigned int required) {
+            if (required <= capacity)
+                return;
+            unsigned int newCapacity = std::max(std::max(capacity * 2, 4U), required);
+            T* newBlock = store.allocate<T>(newCapacity);
+            if (size > 0)
+                memcpy((void*)newBlock, block, sizeof(T) * size);
+            block = newBlock;
+            capacity = newCapacity;
+        }
+
+        // Adds, or replaces, a value in a dictionary; keeping it sorted. Shifts entries, so don't use while rendering.
+        void set(CompactVariable container, std::string_view key, CompactVariable value) {
+            assert(container.type == LIQUID_VARIABLE_TYPE_DICTIONARY);
+            CompactDictionary& dictionary = *container.dictionary;
+            auto result = dictionary.find(key);
+            if (result.second) {
+                dictionary.entries[result.first].value = value;
+                return;
+            }
+            if (dictionary.sorted < dictionary.size) {
+                append(container, key, value);
+                return;
+            }
+            grow(*this, dictionary.entries, dictionary.size, dictionary.capacity, dictionary.size + 1);
+            memmove((void*)&dictionary.entries[result.first + 1], &dictionary.entries[result.first], sizeof(CompactDictionary::Entry) * (dictionary.size - result.first));
+            std::string_view interned = intern(key);
+            dictionary.entries[result.first] = { interned.data(), (unsigned int)interned.size(), value };
+            ++dictionary.size;
+            ++dictionary.sorted;
+        }
+
+        // Adds, or replaces, a value in a dictionary, without reordering any existing entries; though they're copied to a new block if the
+        // dictionary has to grow. Returns the stored value.
+        CompactVariable* append(CompactVariable container, std::string_view key, CompactVariable value) {
+            assert(container.type == LIQUID_VARIABLE_TYPE_DICTIONARY);
+            CompactDictionary& dictionary = *container.dictionary;
+            auto result = dictionary.find(key);
+            if (result.second) {
+                dictionary.entries[result.first].value = value;
+                return &dictionary.entries[result.first].value;
+            }
+            grow(*this, dictionary.entries, dictionary.size, dictionary.capacity, dictionary.size + 1);
+            std::string_view interned = intern(key);
+            dictionary.entries[dictionary.size] = { interned.data(), (unsigned int)interned.size(), value };
+            return &dictionary.entries[dictionary.size++].value;
+        }
+
+        void push(CompactVariable container, CompactVariable value) {
+            assert(container.type == LIQUID_VARIABLE_TYPE_ARRAY);
+            CompactArray& array = *container.array;
+            grow(*this, array.elements, array.size, array.capacity, array.size + 1);
+            array.elements[array.size++] = value;
+        }
+
+        // Sets an element, padding the array with nils if it's past the end. Returns the stored value.
+        CompactVariable* set(CompactVariable container, long long idx, CompactVariable value) {
+            assert(container.type == LIQUID_VARIABLE_TYPE_ARRAY);
+            CompactArray& array = *container.array;
+            if (idx < 0)
+                idx += array.size;
+            if (idx < 0)
+                return nullptr;
+            if (idx >= (long long)array.size) {
+                grow(*this, array.elements, array.size, array.capacity, idx + 1);
+                for (unsigned int i = array.size; i < idx; ++i)
+                    array.elements[i] = CompactVariable();
+                array.size = idx + 1;
+            }
+            array.elements[idx] = value;
+            return &array.elements[idx];
+        }
+
+        // Copies containers, so that the copy can be changed independently; strings are immutable, and so are shared.
+        CompactVariable clone(const CompactVariable& variable) {
+            switch (variable.type) {
+                case LIQUID_VARIABLE_TYPE_ARRAY: {
+                    CompactVariable copy = array(variable.array->size);
+                    for (unsigned int i = 0; i < variable.array->size; ++i)
+                        copy.array->elements[i] = clone(variable.array->elements[i]);
+                    copy.array->size = variable.array->size;
+                    return copy;
+                }
+                case LIQUID_VARIABLE_TYPE_DICTIONARY: {
+                    CompactVariable copy = dictionary(variable.dictionary->size);
+                    for (unsigned int i = 0; i < variable.dictionary->size; ++i) {
+                        copy.dictionary->entries[i] = variable.dictionary->entries[i];
+                        copy.dictionary->entries[i].value = clone(variable.dictionary->entries[i].value);
+                    }
+                    copy.dictionary->size = variable.dictionary->size;
+                    copy.dictionary->sorted = variable.dictionary->sorted;
+                    return copy;
+                }
+                default:
+                    return variable;
+            }
+        }
+
+        // Allocates a variable from the arena, for handing to the renderer.
+        CompactVariable* create(CompactVariable value) {
+            return new (allocate<CompactVariable>()) CompactVariable(value);
+        }
+    };
+
+    // The store must be set as the renderer's resolverCustomData.
+    struct CompactVariableResolver : LiquidVariableResolver {
+        static CompactStore& getStore(LiquidRenderer renderer) {
+            assert(static_cast<Renderer*>(renderer.renderer)->resolverCustomData);
+            return *static_cast<CompactStore*>(static_cast<Renderer*>(renderer.renderer)->resolverCustomData);
+        }
+
+        // For StaticRenderer.
+        struct Static {
+            static LiquidVariableType getType(void* variable) { return static_cast<CompactVariable*>(variable)->type; }
+            static bool getBool(void* variable, bool& target) {
+                if (static_cast<CompactVariable*>(variable)->type != LIQUID_VARIABLE_TYPE_BOOL)
+                    return false;
+                target = static_cast<CompactVariable*>(variable)->b;
+                return true;
+            }
+            static bool getInteger(void* variable, long long& target) {
+                if (static_cast<CompactVariable*>(variable)->type != LIQUID_VARIABLE_TYPE_INT)
+                    return false;
+                target = static_cast<CompactVariable*>(variable)->i;
+                return true;
+            }
+            static bool getFloat(void* variable, double& target) {
+                if (static_cast<CompactVariable*>(variable)->type != LIQUID_VARIABLE_TYPE_FLOAT)
+                    return false;
+                target = static_cast<CompactVariable*>(variable)->f;
+                return true;
+            }
+            static bool getStringView(void* variable, const char*& target, size_t& length) {
+                const CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type != LIQUID_VARIABLE_TYPE_STRING)
+                    return false;
+                target = value->getStringData();
+                length = value->length;
+                return true;
+            }
+            static bool getDictionaryVariable(void* variable, const string& key, void*& target) {
+                return static_cast<CompactVariable*>(variable)->getDictionaryVariable(key, *reinterpret_cast<CompactVariable**>(&target));
+            }
+            static bool getArrayVariable(void* variable, long long idx, void*& target) {
+                return static_cast<CompactVariable*>(variable)->getArrayVariable(idx, *reinterpret_cast<CompactVariable**>(&target));
+            }
+        };
+
+        CompactVariableResolver() {
+            getType = +[](LiquidRenderer renderer, void* variable) { return Static::getType(variable); };
+            getBool = +[](LiquidRenderer renderer, void* variable, bool* target) { return Static::getBool(variable, *target); };
+            getTruthy = +[](LiquidRenderer renderer, void* variable) { return static_cast<CompactVariable*>(variable)->getTruthy(); };
+            getString = +[](LiquidRenderer renderer, void* variable, char* target) {
+                const CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type == LIQUID_VARIABLE_TYPE_STRING) {
+                    memcpy(target, value->getStringData(), value->length);
+                    target[value->length] = 0;
+                    return true;
+                }
+                string s;
+                if (!value->getString(s))
+                    return false;
+                strcpy(target, s.data());
+                return true;
+            };
+            getStringLength = +[](LiquidRenderer renderer, void* variable) {
+                const CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type == LIQUID_VARIABLE_TYPE_STRING)
+                    return (long long)value->length;
+                string s;
+                if (!value->getString(s))
+                    return -1LL;
+                return (long long)s.size();
+            };
+            getInteger = +[](LiquidRenderer renderer, void* variable, long long* target) { return Static::getInteger(variable, *target); };
+            getFloat = +[](LiquidRenderer renderer, void* variable, double* target) { return Static::getFloat(variable, *target); };
+            getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
+                return static_cast<CompactVariable*>(variable)->getDictionaryVariable(key, *reinterpret_cast<CompactVariable**>(target));
+            };
+            getArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void** target) { return Static::getArrayVariable(variable, idx, *target); };
+            iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+                const CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type != LIQUID_VARIABLE_TYPE_ARRAY)
+                    return false;
+                // Taken up front, so that the template growing the array while it's iterated over doesn't affect the iteration.
+                CompactVariable* elements = value->array->elements;
+                int size = (int)value->array->size;
+                if (limit < 0)
+                    limit = size + limit + 1;
+                if (start < 0)
+                    start = 0;
+                int endIndex = std::min(start + limit - 1, size - 1);
+                if (reverse) {
+                    for (int i = endIndex; i >= start; --i) {
+                        if (!callback(&elements[i], data))
+                            break;
+                    }
+                } else {
+                    for (int i = start; i <= endIndex; ++i) {
+                        if (!callback(&elements[i], data))
+                            break;
+                    }
+                }
+                return true;
+            };
+            getArraySize = +[](LiquidRenderer renderer, void* variable) {
+                const CompactVariable* value = static_cast<CompactVariable*>(variable);
+                return value->type == LIQUID_VARIABLE_TYPE_ARRAY ? (long long)value->array->size : -1LL;
+            };
+            getArrayVariables = +[](LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) {
+                const CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type != LIQUID_VARIABLE_TYPE_ARRAY)
+                    return -1LL;
+                long long filled = 0;
+                for (long long i = std::max(idx, 0LL); i < (long long)value->array->size && filled < count; ++i)
+                    targets[filled++] = &value->array->elements[i];
+                return filled;
+            };
+            setDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void* target) {
+                CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type == LIQUID_VARIABLE_TYPE_NIL)
+                    *value = getStore(renderer).dictionary();
+                if (value->type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+                    return (void*)nullptr;
+                return (void*)getStore(renderer).append(*value, key, *static_cast<CompactVariable*>(target));
+            };
+            setArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void* target) {
+                CompactVariable* value = static_cast<CompactVariable*>(variable);
+                if (value->type != LIQUID_VARIABLE_TYPE_ARRAY)
+                    return (void*)nullptr;
+                return (void*)getStore(renderer).set(*value, idx, *static_cast<CompactVariable*>(target));
+            };
+
+            createHash = +[](LiquidRenderer renderer) { CompactStore& store = getStore(renderer); return (void*)store.create(store.dictionary()); };
+            createArray = +[](LiquidRenderer renderer) { CompactStore& store = getStore(renderer); return (void*)store.create(store.array()); };
+            createFloat = +[](LiquidRenderer renderer, double value) { return (void*)getStore(renderer).create(CompactVariable(value)); };
+            createBool = +[](LiquidRenderer renderer, bool value) { return (void*)getStore(renderer).create(CompactVariable(value)); };
+            createInteger = +[](LiquidRenderer renderer, long long value) { return (void*)getStore(renderer).create(CompactVariable(value)); };
+            createString = +[](LiquidRenderer renderer, const char* value) { CompactStore& store = getStore(renderer); return (void*)store.create(store.string(value)); };
+            createStringN = +[](LiquidRenderer renderer, const char* value, size_t length, bool owned) {
+                CompactStore& store = getStore(renderer);
+                CompactVariable* variable = store.create(store.string(std::string_view(value, length)));
+                if (owned)
+                    free((void*)value);
+                return (void*)variable;
+            };
+            createPointer = +[](LiquidRenderer renderer, void* value) {
+                CompactVariable variable;
+                variable.type = LIQUID_VARIABLE_TYPE_OTHER;
+                variable.p = value;
+                return (void*)getStore(renderer).create(variable);
+            };
+            createNil = +[](LiquidRenderer renderer) { return (void*)getStore(renderer).create(CompactVariable()); };
+            createClone = +[](LiquidRenderer renderer, void* variable) { CompactStore& store = getStore(renderer); return (void*)store.create(store.clone(*static_cast<CompactVariable*>(variable))); };
+            // Everything belongs to the store's arena.
+            freeVariable = +[](LiquidRenderer renderer, void* variable) { };
+
+            compare = +[](void* a, void* b) { return *static_cast<CompactVariable*>(a) < *static_cast<CompactVariable*>(b) ? -1 : 0; };
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** target, size_t* length) { return Static::getStringView(variable, *target, *length); };
+            resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+                CompactVariable* current = static_cast<CompactVariable*>(variable);
+                for (size_t i = 0; i < count; ++i) {
+                    bool found = segments[i].type == LIQUID_PATH_SEGMENT_TYPE_INDEX ? current->getArrayVariable(segments[i].index, current) : current->getDictionaryVariable(std::string_view(segments[i].key, segments[i].keyLength), current);
+                    if (!found)
+                        return false;
+                }
+                *target = current;
+                return true;
+            };
+        }
+    };
+}
+
+#endif
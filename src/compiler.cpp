@@ -169,6 +169,10 @@ namespace Liquid {
                     add(OP_MOVSTR, freeRegister, add(branch.variant.s.data(), branch.variant.s.size()));
                     ++freeRegister;
                 } break;
+                case Variant::Type::STRING_VIEW: {
+                    add(OP_MOVSTR, freeRegister, add(branch.variant.view, branch.variant.len));
+                    ++freeRegister;
+                } break;
                 case Variant::Type::INT: {
                     add(OP_MOVINT, freeRegister, branch.variant.i);
                     ++freeRegister;
@@ -472,7 +476,7 @@ namespace Liquid {
                 pushRegister(reg, node.variant.s);
             break;
             case Variant::Type::STRING_VIEW:
-                assert(false);
+                pushRegister(reg, string(node.variant.view, node.variant.len));
             break;
             case Variant::Type::BOOL:
                 reg.type = Register::Type::BOOL;
@@ -536,6 +540,8 @@ namespace Liquid {
         long long operand;
         Node node;
         while (true) {
+            if (!step())
+                return false;
             instruction = *instructionPointer++;
             target = instruction >> 8;
             OPCode opCode = (OPCode)(instruction & 0xFF);
@@ -629,12 +635,18 @@ namespace Liquid {
                 case OP_CALL: {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     unsigned int argCount = (unsigned int)registers[target].i;
-                    pushRegister(registers[0], ((NodeType*)operand)->render(*this, node, store));
+                    Node result = ((NodeType*)operand)->render(*this, node, store);
+                    if (maximumMemoryUsage)
+                        accountMemory(getMemoryUsage(result.variant));
+                    if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+                        return false;
+                    pushRegister(registers[0], result);
                     popStack(argCount);
                 } break;
                 case OP_RESOLVE: {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
-                    Variable var = operand == -1 || registers[operand].pointer == nullptr ? (void*)store : registers[operand].pointer;
+                    bool topLevel = operand == -1 || registers[operand].pointer == nullptr;
+                    Variable var = topLevel ? (void*)store : registers[operand].pointer;
                     Register& reg = registers[target];
                     bool success = false;
                     switch (reg.type) {
@@ -643,6 +655,8 @@ namespace Liquid {
                         break;
                         case Register::Type::SHORT_STRING:
                             success = variableResolver.getDictionaryVariable(LiquidRenderer { this }, var, reg.buffer, var);
+                            for (size_t i = 0; !success && topLevel && i < layers.size(); ++i)
+                                success = variableResolver.getDictionaryVariable(LiquidRenderer { this }, layers[i], reg.buffer, var);
                         break;
                         case Register::Type::NIL:
                         case Register::Type::BOOL:
@@ -673,6 +687,15 @@ namespace Liquid {
                             break;
                             case LIQUID_VARIABLE_TYPE_STRING: {
                                 reg.type = Register::Type::SHORT_STRING;
+                                const char* view;
+                                size_t viewLength;
+                                if (variableResolver.getStringView && variableResolver.getStringView(LiquidRenderer { this }, var, &view, &viewLength)) {
+                                    assert(viewLength < SHORT_STRING_SIZE);
+                                    reg.length = (unsigned char)viewLength;
+                                    memcpy(reg.buffer, view, viewLength);
+                                    reg.buffer[viewLength] = 0;
+                                    break;
+                                }
                                 long long length = variableResolver.getStringLength(LiquidRenderer { this }, var);
                                 assert(length < SHORT_STRING_SIZE);
                                 reg.length = (unsigned char)length;
@@ -745,19 +768,23 @@ namespace Liquid {
                     void* pointers[] = { this, const_cast<unsigned char*>(code), store.pointer, (void*)callback, data, const_cast<unsigned int*>(instructionPointer) };
                     instructionPointer += 2;
                     Variable var = reg.pointer == nullptr ? (void*)store : reg.pointer;
-                    variableResolver.iterate(LiquidRenderer { this }, var, +[](void* variable, void* data){
+                    iterate(var, +[](void* variable, void* data){
                         void** pointers = (void**)data;
                         Interpreter* interpreter = (Interpreter*)pointers[0];
                         interpreter->registers[0].type = Register::Type::VARIABLE;
                         interpreter->registers[0].pointer = variable;
                         interpreter->run((const unsigned char*)pointers[1], Variable { pointers[2] }, (void (*)(const char*, size_t, void*))pointers[3], pointers[4], (const unsigned char*)pointers[5]);
-                        return true;
+                        return interpreter->error == LIQUID_RENDERER_ERROR_TYPE_NONE;
                     }, pointers, 0, -1, false);
+                    if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+                        return false;
                     instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
                 } break;
                 case OP_OUTPUTMEM: {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     unsigned int len = *(unsigned int*)&code[operand];
+                    if (!accountMemory(len))
+                        return false;
                     if (buffers.size()) {
                         buffers.top().append((const char*)&code[operand+sizeof(unsigned int)], len);
                     } else
@@ -792,6 +819,7 @@ namespace Liquid {
                 case OP_OUTPUT: {
                     // This could potentially be made *way* more efficient.
                     auto output = [this, data, callback](const char* str, size_t len){
+                        accountMemory(len);
                         if (buffers.size())
                             buffers.top().append(str, len);
                         else
@@ -819,6 +847,12 @@ namespace Liquid {
                         } break;
                         case Register::Type::VARIABLE: {
                             if (registers[target].pointer) {
+                                const char* view;
+                                size_t viewLength;
+                                if (variableResolver.getStringView && variableResolver.getStringView(LiquidRenderer { this }, registers[target].pointer, &view, &viewLength)) {
+                                    output(view, viewLength);
+                                    break;
+                                }
                                 long long len = variableResolver.getStringLength(LiquidRenderer { this }, registers[target].pointer);
                                 if (len > 0) {
                                     if (len < 4096) {
@@ -840,6 +874,8 @@ namespace Liquid {
                             assert(false);
                         break;
                     }
+                    if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+                        return false;
                 } break;
                 case OP_JMPTRUE: {
                 case OP_JMPFALSE:
@@ -894,7 +930,11 @@ namespace Liquid {
         mode = Renderer::ExecutionMode::INTERPRETER;
         instructionPointer = reinterpret_cast<const unsigned int*>(&prog.code[prog.codeOffset]);
         stackPointer = stackBlock;
+        resetLimits();
+        error = LIQUID_RENDERER_ERROR_TYPE_NONE;
         run(prog.code.data(), store, callback, data);
+        if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+            throw Renderer::Exception(Renderer::Error(error, Node()));
     }
 
 
@@ -915,8 +955,8 @@ namespace Liquid {
             if (child->type) {
                 compiler.compileBranch(*child.get());
             } else {
-                assert(child->variant.type == Variant::Type::STRING);
-                int offset = compiler.add(child->variant.s.data(), child->variant.s.size());
+                assert(child->variant.type == Variant::Type::STRING || child->variant.type == Variant::Type::STRING_VIEW);
+                int offset = child->variant.type == Variant::Type::STRING_VIEW ? compiler.add(child->variant.view, child->variant.len) : compiler.add(child->variant.s.data(), child->variant.s.size());
                 compiler.add(OP_OUTPUTMEM, 0x0, offset);
             }
         }
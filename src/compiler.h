@@ -47,6 +47,8 @@ namespace Liquid {
     };
 
     bool hasOperand(OPCode opcode);
+    // The size of the operand that follows the instruction; 0 if there is none.
+    size_t operandSize(OPCode opcode);
     const char* getSymbolicOpcode(OPCode opcode);
 
     // Entrypoint is always codeOffset.
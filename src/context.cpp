@@ -3,6 +3,8 @@
 #include "compiler.h"
 #include "dialect.h"
 
+#include <algorithm>
+
 namespace Liquid {
 
     bool NodeType::optimize(Optimizer& optimizer, Node& node, Variable store) const {
@@ -11,6 +13,8 @@ namespace Liquid {
     }
 
     bool Context::VariableNode::optimize(Optimizer& optimizer, Node& node, Variable store) const {
+        // Segments may have been optimized into literals.
+        node.compilePath();
         auto storePointer = optimizer.renderer.getVariable(node, store);
         if (!storePointer.first)
             return false;
@@ -57,6 +61,89 @@ namespace Liquid {
         }
     }
 
+    Node StringFilterNodeType::render(Renderer& renderer, const Node& node, Variable store) const {
+        // Compiled filters are called one at a time, with their operands already on the stack.
+        if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
+            string str = renderer.getString(getOperand(renderer, node, store));
+            transform(renderer, node, store, str);
+            return Variant(move(str));
+        }
+        const Node* chain[MAXIMUM_FUSED_FILTERS];
+        size_t count = 0;
+        const Node* operand = &node;
+        while (count < MAXIMUM_FUSED_FILTERS && operand->type && operand->type->type == NodeType::Type::FILTER && static_cast<const FilterNodeType*>(operand->type)->fusion == Fusion::STRING) {
+            chain[count++] = operand;
+            operand = operand->children[0].get();
+        }
+        Node rendered = renderer.retrieveRenderedNode(*operand, store);
+        string str = !rendered.type && rendered.variant.type == Variant::Type::STRING ? move(rendered.variant.s) : renderer.getString(rendered);
+        while (count > 0) {
+            const Node& filter = *chain[--count];
+            static_cast<const StringFilterNodeType*>(filter.type)->transform(renderer, filter, store, str);
+        }
+        return Variant(move(str));
+    }
+
+    Node SequenceFilterNodeType::render(Renderer& renderer, const Node& node, Variable store) const {
+        Variant accumulator { vector<Variant>() };
+        bool isArray = run(renderer, node, store, +[](const Variant& element, void* data) {
+            static_cast<Variant*>(data)->a.push_back(element);
+            return true;
+        }, &accumulator);
+        return isArray ? Node(move(accumulator)) : Node();
+    }
+
+    bool SequenceFilterNodeType::run(Renderer& renderer, const Node& node, Variable store, Sink sink, void* data) const {
+        struct Pipeline {
+            Renderer& renderer;
+            // Innermost first.
+            vector<Stage> stages;
+            Sink sink;
+            void* data;
+
+            bool push(Variant element) {
+                for (auto& stage : stages) {
+                    if (!stage.type->filter(renderer, stage, element))
+                        return true;
+                }
+                return sink(element, data);
+            }
+        } pipeline = { renderer, { }, sink, data };
+
+        const Node* operand = &node;
+        Node rendered;
+        // Compiled filters are called one at a time, with their operands already on the stack.
+        if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
+            pipeline.stages.emplace_back(this, &node);
+            rendered = getOperand(renderer, node, store);
+        } else {
+            while (isSequence(*operand)) {
+                pipeline.stages.emplace_back(static_cast<const SequenceFilterNodeType*>(operand->type), operand);
+                operand = operand->children[0].get();
+            }
+            std::reverse(pipeline.stages.begin(), pipeline.stages.end());
+            rendered = renderer.retrieveRenderedNode(*operand, store);
+        }
+        if (rendered.type || (rendered.variant.type != Variant::Type::ARRAY && rendered.variant.type != Variant::Type::VARIABLE))
+            return false;
+        for (auto& stage : pipeline.stages) {
+            for (int i = 0; i < stage.type->maxArguments; ++i)
+                stage.arguments.push_back(stage.type->getArgument(renderer, *stage.node, store, i).variant);
+            stage.type->prepare(renderer, stage);
+        }
+        if (rendered.variant.type == Variant::Type::VARIABLE) {
+            renderer.iterate(rendered.variant.v, +[](void* variable, void* data) {
+                return static_cast<Pipeline*>(data)->push(Variable({ variable }));
+            }, &pipeline, 0, -1, false);
+        } else {
+            for (auto& element : rendered.variant.a) {
+                if (!pipeline.push(element))
+                    break;
+            }
+        }
+        return true;
+    }
+
     Node DotFilterNodeType::getOperand(Renderer& renderer, const Node& node, Variable store) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER)
             return static_cast<Interpreter&>(renderer).getStack(-1);
@@ -106,7 +193,18 @@ namespace Liquid {
         }
         string s;
         for (auto& child : node.children) {
-            s.append(renderer.retrieveRenderedNode(*child.get(), store).getString());
+            if (!renderer.step()) {
+                --renderer.currentRenderingDepth;
+                return Node();
+            }
+            Node value = renderer.retrieveRenderedNode(*child.get(), store);
+            // Strings, and views especially, are appended directly, rather than through a copy.
+            if (value.variant.type == Variant::Type::STRING)
+                s.append(value.variant.s);
+            else if (value.variant.type == Variant::Type::STRING_VIEW)
+                s.append(value.variant.view, value.variant.len);
+            else
+                s.append(value.getString());
             if (renderer.error != LIQUID_RENDERER_ERROR_TYPE_NONE)
                 return Node();
             if (renderer.control != Renderer::Control::NONE) {
@@ -118,6 +216,19 @@ namespace Liquid {
         return Node(move(s));
     }
 
+    Node Context::OutputNode::render(Renderer& renderer, const Node& node, Variable store) const {
+        assert(node.children.size() == 1);
+        auto& argumentNode = node.children.front();
+        assert(argumentNode->children.size() == 1);
+        const Node& expression = *argumentNode->children[0].get();
+        // Output is only ever appended to something else, so a bare variable can be viewed in the store, rather than copied out of it.
+        // When optimizing, a variable that could be resolved has already been replaced with a copy by the time this is rendered.
+        Node value = expression.type == renderer.context.getVariableNodeType() ? renderer.context.getVariableNodeType()->resolve(renderer, expression, store, true) : renderer.retrieveRenderedNode(expression, store);
+        if (!value.type && (value.variant.type == Variant::Type::STRING || value.variant.type == Variant::Type::STRING_VIEW))
+            return value;
+        return Variant(renderer.getString(value));
+    }
+
     bool Context::ConcatenationNode::optimize(Optimizer& optimizer, Node& node, Variable store) const {
         if (++optimizer.renderer.currentRenderingDepth > optimizer.renderer.maximumRenderingDepth) {
             --optimizer.renderer.currentRenderingDepth;
@@ -143,6 +254,89 @@ namespace Liquid {
         return true;
     }
 
+    void SymbolTable::build(const unordered_map<string, unique_ptr<NodeType>>& types) {
+        built = true;
+        displacements.clear();
+        slots.clear();
+        if (types.empty())
+            return;
+        // Hash and displace; symbols are put into buckets by their hash, and then, largest buckets first, each bucket searches for a displacement that
+        // puts all of its symbols into slots that are still free. With the table at most half full, this takes very few tries.
+        size_t size = 2;
+        while (size < types.size() * 2)
+            size <<= 1;
+        vector<vector<pair<std::string_view, NodeType*>>> buckets(types.size());
+        for (auto& it : types)
+            buckets[hash(it.first) % buckets.size()].emplace_back(it.first, it.second.get());
+        vector<size_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+        while (true) {
+            displacements.assign(buckets.size(), 0);
+            slots.assign(size, Slot());
+            bool success = true;
+            vector<size_t> candidates;
+            for (size_t i = 0; i < order.size() && success; ++i) {
+                auto& bucket = buckets[order[i]];
+                if (bucket.empty())
+                    break;
+                success = false;
+                for (unsigned int displacement = 0; displacement < 4096 && !success; ++displacement) {
+                    candidates.clear();
+                    success = true;
+                    for (auto& entry : bucket) {
+                        size_t slot = getSlot(hash(entry.first), displacement, size - 1);
+                        if (slots[slot].type || std::find(candidates.begin(), candidates.end(), slot) != candidates.end()) {
+                            success = false;
+                            break;
+                        }
+                        candidates.push_back(slot);
+                    }
+                    if (success) {
+                        displacements[order[i]] = displacement;
+                        for (size_t j = 0; j < bucket.size(); ++j) {
+                            slots[candidates[j]].symbol = bucket[j].first;
+                            slots[candidates[j]].type = bucket[j].second;
+                        }
+                    }
+                }
+            }
+            if (success)
+                return;
+            size <<= 1;
+        }
+    }
+
+    static void freezeContextualType(ContextualNodeType* type) {
+        type->frozenOperators.build(type->operators);
+        type->frozenFilters.build(type->filters);
+        if (type->type == NodeType::Type::TAG) {
+            TagNodeType* tagType = static_cast<TagNodeType*>(type);
+            tagType->frozenQualifiers.build(tagType->qualifiers);
+            tagType->frozenIntermediates.build(tagType->intermediates);
+            for (auto& it : tagType->intermediates) {
+                if (it.second->type == NodeType::Type::TAG)
+                    freezeContextualType(static_cast<ContextualNodeType*>(it.second.get()));
+            }
+        }
+    }
+
+    void Context::freeze() {
+        if (frozen)
+            return;
+        frozenTagTypes.build(tagTypes);
+        frozenUnaryOperatorTypes.build(unaryOperatorTypes);
+        frozenBinaryOperatorTypes.build(binaryOperatorTypes);
+        frozenFilterTypes.build(filterTypes);
+        frozenDotFilterTypes.build(dotFilterTypes);
+        frozenLiteralTypes.build(literalTypes);
+        for (auto& it : tagTypes)
+            freezeContextualType(static_cast<ContextualNodeType*>(it.second.get()));
+        freezeContextualType(&outputNodeType);
+        frozen = true;
+    }
+
     Context::Context(int dialects) {
         if (dialects & STRICT_STANDARD_DIALECT)
             StandardDialect::implementStrict(*this);
@@ -2,6 +2,7 @@
 #define LIQUIDCONTEXT_H
 
 #include <limits.h>
+#include <string_view>
 #include "common.h"
 #include "parser.h"
 #include "renderer.h"
@@ -22,6 +23,53 @@ namespace Liquid {
 
     };
 
+    // An immutable perfect hash over a set of symbols, built when a context is frozen. Every symbol has exactly one slot it can be in, so a lookup
+    // is one hash, and at most one comparison; and as it's keyed by string_view, nothing needs to be allocated to do one.
+    struct SymbolTable {
+        struct Slot {
+            std::string_view symbol;
+            NodeType* type = nullptr;
+        };
+        // Indexed by the hash of the symbol; picks the seed that puts the symbol in its slot.
+        vector<unsigned int> displacements;
+        vector<Slot> slots;
+        bool built = false;
+
+        static unsigned long long hash(std::string_view symbol) {
+            unsigned long long h = 14695981039346656037ULL;
+            for (char c : symbol) {
+                h ^= (unsigned char)c;
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+        static size_t getSlot(unsigned long long h, unsigned int displacement, size_t mask) {
+            h ^= displacement * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 31;
+            h *= 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 29;
+            return h & mask;
+        }
+
+        void build(const unordered_map<string, unique_ptr<NodeType>>& types);
+
+        NodeType* find(std::string_view symbol) const {
+            if (slots.empty())
+                return nullptr;
+            unsigned long long h = hash(symbol);
+            const Slot& slot = slots[getSlot(h, displacements[h % displacements.size()], slots.size() - 1)];
+            return slot.type && slot.symbol == symbol ? slot.type : nullptr;
+        }
+
+        // Looks in the table if the context has been frozen; otherwise falls back to the map it would have been built from.
+        static NodeType* find(const unordered_map<string, unique_ptr<NodeType>>& types, const SymbolTable& table, std::string_view symbol) {
+            if (table.built)
+                return table.find(symbol);
+            auto it = types.find(string(symbol));
+            return it != types.end() ? it->second.get() : nullptr;
+        }
+    };
+
     struct ContextualNodeType : NodeType {
         ContextualNodeType(NodeType::Type type, const std::string& symbol = "", int maxChildren = -1, LiquidOptimizationScheme scheme = LIQUID_OPTIMIZATION_SCHEME_NONE) : NodeType(type, symbol, maxChildren, scheme) { }
 
@@ -29,11 +77,18 @@ namespace Liquid {
         unordered_map<string, unique_ptr<NodeType>> operators;
         // For filters specific to this tag.
         unordered_map<string, unique_ptr<NodeType>> filters;
+        SymbolTable frozenOperators;
+        SymbolTable frozenFilters;
+
+        const NodeType* getOperator(std::string_view symbol) const { return SymbolTable::find(operators, frozenOperators, symbol); }
+        const NodeType* getFilter(std::string_view symbol) const { return SymbolTable::find(filters, frozenFilters, symbol); }
 
         // Used for registering intermedaites and qualiifers.
         template <class T>
         void registerType() {
             auto nodeType = make_unique<T>();
+            if (frozenOperators.built)
+                throw Liquid::Exception("Unable to register type %s; context is frozen.", nodeType->symbol.c_str());
             switch (nodeType->type) {
                 case NodeType::Type::FILTER:
                     filters[nodeType->symbol] = std::move(nodeType);
@@ -72,6 +127,11 @@ namespace Liquid {
         unordered_map<string, unique_ptr<NodeType>> intermediates;
         // For things for the forloop; like reversed, limit, etc... Super stupid, but Shopify threw them in, and there you are.
         unordered_map<string, unique_ptr<NodeType>> qualifiers;
+        SymbolTable frozenIntermediates;
+        SymbolTable frozenQualifiers;
+
+        const NodeType* getIntermediate(std::string_view symbol) const { return SymbolTable::find(intermediates, frozenIntermediates, symbol); }
+        const NodeType* getQualifier(std::string_view symbol) const { return SymbolTable::find(qualifiers, frozenQualifiers, symbol); }
 
         Composition composition;
         int minArguments;
@@ -83,6 +143,8 @@ namespace Liquid {
         template <class T>
         T* registerType() {
             auto nodeType = make_unique<T>();
+            if (frozenOperators.built)
+                throw Liquid::Exception("Unable to register type %s; context is frozen.", nodeType->symbol.c_str());
             T* pointer = nodeType.get();
             switch (nodeType->type) {
                 case NodeType::Type::TAG:
@@ -153,6 +215,13 @@ namespace Liquid {
         int maxArguments;
         bool allowsWildcardQualifiers;
         int priority;
+        // Which kind of chain the filter can be fused into; see StringFilterNodeType and SequenceFilterNodeType.
+        enum class Fusion {
+            NONE,
+            STRING,
+            SEQUENCE
+        };
+        Fusion fusion;
 
         // Wildcard Qualifier.
         struct QualifierNodeType : NodeType {
@@ -164,7 +233,7 @@ namespace Liquid {
             Node render(Renderer& renderer, const Node& node, Variable store) const override { return Node(); }
         };
 
-        FilterNodeType(string symbol, int minArguments = -1, int maxArguments = -1, bool allowsWildcardQualifiers = false, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : NodeType(NodeType::Type::FILTER, symbol, -1, optimization), minArguments(minArguments), maxArguments(maxArguments), allowsWildcardQualifiers(allowsWildcardQualifiers), priority(0) { }
+        FilterNodeType(string symbol, int minArguments = -1, int maxArguments = -1, bool allowsWildcardQualifiers = false, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : NodeType(NodeType::Type::FILTER, symbol, -1, optimization), minArguments(minArguments), maxArguments(maxArguments), allowsWildcardQualifiers(allowsWildcardQualifiers), priority(0), fusion(Fusion::NONE) { }
 
         Node getOperand(Renderer& renderer, const Node& node, Variable store) const;
         Node getArgument(Renderer& renderer, const Node& node, Variable store, int idx) const;
@@ -172,6 +241,52 @@ namespace Liquid {
         void compile(Compiler& compiler, const Node& node) const override;
     };
 
+    // A filter that only ever turns one string into another, by changing it in place. When filters like this are chained, as with
+    // title | downcase | strip | truncate: 40, the chain is fused: the operand at the bottom is rendered to a string once, and each filter
+    // changes that same string in turn, rather than every filter making a new one. Dialects declare their own by implementing transform.
+    struct StringFilterNodeType : FilterNodeType {
+        // Chains longer than this are fused a piece at a time.
+        static constexpr size_t MAXIMUM_FUSED_FILTERS = 32;
+
+        StringFilterNodeType(string symbol, int minArguments = -1, int maxArguments = -1, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : FilterNodeType(symbol, minArguments, maxArguments, false, optimization) { fusion = Fusion::STRING; }
+
+        // Arguments are read with getArgument, as usual.
+        virtual void transform(Renderer& renderer, const Node& node, Variable store, string& str) const = 0;
+        Node render(Renderer& renderer, const Node& node, Variable store) const override;
+    };
+
+    // A filter that works through an array an element at a time, like map or where. When filters like this are chained, as with
+    // products | where: "available" | map: "title" | first, the chain is run as a pipeline: the array at the bottom is iterated once,
+    // each element is passed up through every filter in turn, and only what comes out of the top is kept; so no array is made in between,
+    // and a filter like first, that only wants part of the result, can stop the iteration as soon as it has it.
+    struct SequenceFilterNodeType : FilterNodeType {
+        struct Stage {
+            const SequenceFilterNodeType* type;
+            const Node* node;
+            // Rendered once, for the whole run.
+            vector<Variant> arguments;
+            // For filters that remember what they've passed on, like uniq; bucketed by hash, as different values can share one.
+            std::unordered_map<size_t, vector<Variant>> seen;
+
+            Stage(const SequenceFilterNodeType* type, const Node* node) : type(type), node(node) { }
+        };
+        typedef bool (*Sink)(const Variant& element, void* data);
+
+        SequenceFilterNodeType(string symbol, int minArguments = -1, int maxArguments = -1, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : FilterNodeType(symbol, minArguments, maxArguments, false, optimization) { fusion = Fusion::SEQUENCE; }
+
+        // Called once the stage's arguments are rendered, before any elements are passed through it.
+        virtual void prepare(Renderer& renderer, Stage& stage) const { }
+        // Returns whether the element should be passed on; it may be changed first, as map does.
+        virtual bool filter(Renderer& renderer, Stage& stage, Variant& element) const = 0;
+        // Makes an array of whatever comes out of the top of the chain.
+        Node render(Renderer& renderer, const Node& node, Variable store) const override;
+
+        static bool isSequence(const Node& node) { return node.type && node.type->type == NodeType::Type::FILTER && static_cast<const FilterNodeType*>(node.type)->fusion == Fusion::SEQUENCE; }
+        // Runs the chain that ends at node, handing each element that comes out of the top of it to sink, until sink returns false.
+        // Returns false, without calling sink, if what's at the bottom of the chain isn't an array.
+        bool run(Renderer& renderer, const Node& node, Variable store, Sink sink, void* data) const;
+    };
+
 
     struct DotFilterNodeType : NodeType {
         DotFilterNodeType(string symbol, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : NodeType(NodeType::Type::DOT_FILTER, symbol, -1, optimization) { }
@@ -200,12 +315,7 @@ namespace Liquid {
         struct OutputNode : ContextualNodeType {
             OutputNode() : ContextualNodeType(Type::OUTPUT, "echo", -1, LIQUID_OPTIMIZATION_SCHEME_FULL) { }
 
-            Node render(Renderer& renderer, const Node& node, Variable store) const override {
-                assert(node.children.size() == 1);
-                auto& argumentNode = node.children.front();
-                assert(argumentNode->children.size() == 1);
-                return Variant(renderer.getString(renderer.retrieveRenderedNode(*argumentNode->children[0].get(), store)));
-            }
+            Node render(Renderer& renderer, const Node& node, Variable store) const override;
 
             void compile(Compiler& compiler, const Node& node) const override;
         };
@@ -238,11 +348,11 @@ namespace Liquid {
         struct ArrayLiteralNode : NodeType {
             ArrayLiteralNode() : NodeType(Type::ARRAY_LITERAL) { }
             Node render(Renderer& renderer, const Node& node, Variable store) const override {
-                Variant var { std::vector<Variant>() };
-                var.a.reserve(node.children.size());
+                vector<Variant> elements;
+                elements.reserve(node.children.size());
                 for (size_t i = 0; i < node.children.size(); ++i)
-                    var.a.push_back(move(renderer.retrieveRenderedNode(*node.children[i].get(), store).variant));
-                return Node(move(var));
+                    elements.push_back(move(renderer.retrieveRenderedNode(*node.children[i].get(), store).variant));
+                return Node(Variant(move(elements)));
             }
         };
 
@@ -260,22 +370,28 @@ namespace Liquid {
         EFalsiness falsiness = FALSY_FALSE;
         bool disallowArrayLiterals = false;
         bool disallowGroupingOutsideAssign = false;
+        // The memory resource parsers and renderers created with this context allocate nodes from by default. Null means the global heap.
+        std::pmr::memory_resource* memoryResource = nullptr;
 
         struct VariableNode : NodeType {
             VariableNode() : NodeType(Type::VARIABLE) { }
 
-            Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            Node render(Renderer& renderer, const Node& node, Variable store) const override { return resolve(renderer, node, store, false); }
+            // As render; but if views is true, strings may come back as views into the store. See Renderer::parseVariant.
+            Node resolve(Renderer& renderer, const Node& node, Variable store, bool views) const {
                 pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop(node, store);
                 if (drop.second) {
                     Node result = drop.second(renderer, node, store, drop.first);
                     if (result.type || result.variant.type != Variant::Type::VARIABLE)
                         return result;
-                    return Node(renderer.parseVariant(result.variant.v));
+                    return Node(renderer.parseVariant(result.variant.v, views));
                 } else {
+                    if (const Variant* scoped = renderer.getScopedVariable(node, store))
+                        return renderer.resolveVariant(node, store, *scoped, 1, views);
                     auto variableInfo = renderer.getVariable(node, store);
                     if (!variableInfo.first)
                         return Node();
-                    return Node(renderer.parseVariant(variableInfo.second));
+                    return Node(renderer.parseVariant(variableInfo.second, views));
                 }
             }
 
@@ -289,6 +405,13 @@ namespace Liquid {
         unordered_map<string, unique_ptr<NodeType>> filterTypes;
         unordered_map<string, unique_ptr<NodeType>> dotFilterTypes;
         unordered_map<string, unique_ptr<NodeType>> literalTypes;
+        SymbolTable frozenTagTypes;
+        SymbolTable frozenUnaryOperatorTypes;
+        SymbolTable frozenBinaryOperatorTypes;
+        SymbolTable frozenFilterTypes;
+        SymbolTable frozenDotFilterTypes;
+        SymbolTable frozenLiteralTypes;
+        bool frozen = false;
 
         ConcatenationNode concatenationNodeType;
         OutputNode outputNodeType;
@@ -313,6 +436,8 @@ namespace Liquid {
         const NodeType* getFilterWildcardQualifierNodeType() const { return &filterWildcardQualifierNodeType; }
 
         NodeType* registerType(unique_ptr<NodeType> type) {
+            if (frozen)
+                throw Liquid::Exception("Unable to register type %s; context is frozen.", type->symbol.c_str());
             NodeType* value = type.get();
             switch (type->type) {
                 case NodeType::Type::TAG:
@@ -350,48 +475,36 @@ namespace Liquid {
         }
         template <class T> T* registerType() { return static_cast<T*>(registerType(make_unique<T>())); }
 
-        const TagNodeType* getTagType(string symbol) const {
-            auto it = tagTypes.find(symbol);
-            if (it == tagTypes.end())
-                return nullptr;
-            return static_cast<TagNodeType*>(it->second.get());
+        const TagNodeType* getTagType(std::string_view symbol) const {
+            return static_cast<TagNodeType*>(SymbolTable::find(tagTypes, frozenTagTypes, symbol));
         }
-        const OperatorNodeType* getBinaryOperatorType(string symbol) const {
-            auto it = binaryOperatorTypes.find(symbol);
-            if (it == binaryOperatorTypes.end())
-                return nullptr;
-            return static_cast<OperatorNodeType*>(it->second.get());
+        const OperatorNodeType* getBinaryOperatorType(std::string_view symbol) const {
+            return static_cast<OperatorNodeType*>(SymbolTable::find(binaryOperatorTypes, frozenBinaryOperatorTypes, symbol));
         }
 
-        const OperatorNodeType* getUnaryOperatorType(string symbol) const {
-            auto it = unaryOperatorTypes.find(symbol);
-            if (it == unaryOperatorTypes.end())
-                return nullptr;
-            return static_cast<OperatorNodeType*>(it->second.get());
+        const OperatorNodeType* getUnaryOperatorType(std::string_view symbol) const {
+            return static_cast<OperatorNodeType*>(SymbolTable::find(unaryOperatorTypes, frozenUnaryOperatorTypes, symbol));
         }
 
-        const FilterNodeType* getFilterType(string symbol) const {
-            auto it = filterTypes.find(symbol);
-            if (it == filterTypes.end())
-                return nullptr;
-            return static_cast<FilterNodeType*>(it->second.get());
+        const FilterNodeType* getFilterType(std::string_view symbol) const {
+            return static_cast<FilterNodeType*>(SymbolTable::find(filterTypes, frozenFilterTypes, symbol));
         }
-        const DotFilterNodeType* getDotFilterType(string symbol) const {
-            auto it = dotFilterTypes.find(symbol);
-            if (it == dotFilterTypes.end())
-                return nullptr;
-            return static_cast<DotFilterNodeType*>(it->second.get());
+        const DotFilterNodeType* getDotFilterType(std::string_view symbol) const {
+            return static_cast<DotFilterNodeType*>(SymbolTable::find(dotFilterTypes, frozenDotFilterTypes, symbol));
         }
 
-        const LiteralNodeType* getLiteralType(string symbol) const {
-            auto it = literalTypes.find(symbol);
-            if (it == literalTypes.end())
-                return nullptr;
-            return static_cast<LiteralNodeType*>(it->second.get());
+        const LiteralNodeType* getLiteralType(std::string_view symbol) const {
+            return static_cast<LiteralNodeType*>(SymbolTable::find(literalTypes, frozenLiteralTypes, symbol));
         }
 
         void optimize(Node& ast, Variable store);
 
+        // Builds perfect hashes over every symbol in the context, including those internal to tags, and disallows registering anything further.
+        // Call once all dialects have been implemented. A frozen context is never written to by anything that uses it, and so can be shared between
+        // any number of threads without locking; so long as its public settings aren't changed either.
+        void freeze();
+        bool isFrozen() const { return frozen; }
+
         enum EDialects {
             NO_DIALECT                      = 0,
             STRICT_STANDARD_DIALECT         = 1,
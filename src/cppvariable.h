@@ -307,6 +307,15 @@ namespace Liquid {
             return a.size();
         }
 
+        long long getArrayVariables(long long idx, long long count, void** targets) const {
+            if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+                return -1;
+            long long filled = 0;
+            for (long long i = std::max(idx, 0LL); i < (long long)a.size() && filled < count; ++i)
+                targets[filled++] = a[i].get();
+            return filled;
+        }
+
         bool iterate(bool (*callback)(void* variable, void* data), void* data, int start = 0, int limit = -1, bool reverse = false) const {
             if (type != LIQUID_VARIABLE_TYPE_ARRAY)
                 return false;
@@ -314,7 +323,7 @@ namespace Liquid {
                 limit = (int)a.size() + limit + 1;
             if (start < 0)
                 start = 0;
-            int endIndex = std::min(start+limit-1, (int)a.size());
+            int endIndex = std::min(start+limit-1, (int)a.size()-1);
             if (reverse) {
                 for (int i = endIndex; i >= start; --i) {
                     if (!callback(a[i].get(), data))
@@ -353,8 +362,38 @@ namespace Liquid {
 
 
     struct CPPVariableResolver : LiquidVariableResolver {
+        // For StaticRenderer.
+        struct Static {
+            static LiquidVariableType getType(void* variable) { return static_cast<CPPVariable*>(variable)->type; }
+            static bool getBool(void* variable, bool& target) { return static_cast<CPPVariable*>(variable)->getBool(target); }
+            static bool getInteger(void* variable, long long& target) { return static_cast<CPPVariable*>(variable)->getInteger(target); }
+            static bool getFloat(void* variable, double& target) { return static_cast<CPPVariable*>(variable)->getFloat(target); }
+            static bool getStringView(void* variable, const char*& target, size_t& length) {
+                const CPPVariable* value = static_cast<CPPVariable*>(variable);
+                if (value->type != LIQUID_VARIABLE_TYPE_STRING)
+                    return false;
+                target = value->s.data();
+                length = value->s.size();
+                return true;
+            }
+            static bool getDictionaryVariable(void* variable, const string& key, void*& target) {
+                const CPPVariable* value;
+                if (!static_cast<CPPVariable*>(variable)->getDictionaryVariable(&value, key))
+                    return false;
+                target = const_cast<CPPVariable*>(value);
+                return true;
+            }
+            static bool getArrayVariable(void* variable, long long idx, void*& target) {
+                const CPPVariable* value;
+                if (!static_cast<CPPVariable*>(variable)->getArrayVariable(&value, idx))
+                    return false;
+                target = const_cast<CPPVariable*>(value);
+                return true;
+            }
+        };
+
         CPPVariableResolver() {
-            getType = +[](LiquidRenderer renderer, void* variable) { return static_cast<CPPVariable*>(variable)->type; };
+            getType = +[](LiquidRenderer renderer, void* variable) { return Static::getType(variable); };
             getBool = +[](LiquidRenderer renderer, void* variable, bool* target) { return static_cast<CPPVariable*>(variable)->getBool(*target); };
             getTruthy = +[](LiquidRenderer renderer, void* variable) { return static_cast<CPPVariable*>(variable)->getTruthy(); };
             getString = +[](LiquidRenderer renderer, void* variable, char* target) {
@@ -378,6 +417,7 @@ namespace Liquid {
             setDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void* target) { return (void*)static_cast<CPPVariable*>(variable)->setDictionaryVariable(key, static_cast<CPPVariable*>(target)); };
             iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) { return static_cast<CPPVariable*>(variable)->iterate(callback, data, start, limit, reverse); };
             getArraySize = +[](LiquidRenderer renderer, void* variable) { return static_cast<CPPVariable*>(variable)->getArraySize(); };
+            getArrayVariables = +[](LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) { return static_cast<CPPVariable*>(variable)->getArrayVariables(idx, count, targets); };
 
             createHash = +[](LiquidRenderer renderer) { return (void*)new CPPVariable(unordered_map<string, unique_ptr<CPPVariable>>()); };
             createArray = +[](LiquidRenderer renderer) { return (void*)new CPPVariable({ }); };
@@ -391,6 +431,23 @@ namespace Liquid {
             freeVariable = +[](LiquidRenderer renderer, void* variable) { delete (CPPVariable*)variable;  };
 
             compare = +[](void* a, void* b) { return *static_cast<CPPVariable*>(a) < *static_cast<CPPVariable*>(b) ? -1 : 0; };
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** target, size_t* length) { return Static::getStringView(variable, *target, *length); };
+            createStringN = +[](LiquidRenderer renderer, const char* value, size_t length, bool owned) {
+                CPPVariable* variable = new CPPVariable(string(value, length));
+                if (owned)
+                    free((void*)value);
+                return (void*)variable;
+            };
+            resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+                const CPPVariable* current = static_cast<CPPVariable*>(variable);
+                for (size_t i = 0; i < count; ++i) {
+                    bool found = segments[i].type == LIQUID_PATH_SEGMENT_TYPE_INDEX ? current->getArrayVariable(&current, segments[i].index) : current->getDictionaryVariable(&current, string(segments[i].key, segments[i].keyLength));
+                    if (!found)
+                        return false;
+                }
+                *target = const_cast<CPPVariable*>(current);
+                return true;
+            };
         }
     };
 
@@ -8,6 +8,8 @@
 #include <algorithm>
 #include <unordered_set>
 #include <functional>
+#include <thread>
+#include <system_error>
 
 namespace Liquid {
 
@@ -34,12 +36,10 @@ namespace Liquid {
             auto& assignmentNode = argumentNode->children.front();
             auto& variableNode = assignmentNode->children.front();
             if (variableNode->type->type == NodeType::VARIABLE) {
-                Variable targetVariable;
                 auto& operandNode = assignmentNode->children.back();
                 Node node = renderer.retrieveRenderedNode(*operandNode.get(), store);
                 assert(!node.type);
-                renderer.inject(targetVariable, node.variant);
-                renderer.setVariable(*variableNode.get(), store, targetVariable);
+                renderer.assignVariable(*variableNode.get(), store, move(node.variant));
             }
             return Node();
         }
@@ -85,8 +85,8 @@ namespace Liquid {
             auto& argumentNode = node.children.front();
             auto& variableNode = argumentNode->children.front();
             if (variableNode->type->type == NodeType::VARIABLE) {
-                Variable targetVariable = renderer.variableResolver.createString(renderer, renderer.retrieveRenderedNode(*node.children[1].get(), store).getString().data());
-                renderer.setVariable(*variableNode.get(), store, targetVariable);
+                string contents = renderer.retrieveRenderedNode(*node.children[1].get(), store).getString();
+                renderer.assignVariable(*variableNode.get(), store, Variant(move(contents)));
             }
             return Node();
         }
@@ -111,12 +111,9 @@ namespace Liquid {
             auto& argumentNode = node.children.front();
             auto& variableNode = argumentNode->children.front();
             if (variableNode->type->type == NodeType::VARIABLE) {
-                auto targetVariable = renderer.getVariable(*variableNode.get(), store);
-                if (targetVariable.first) {
-                    long long i = -1;
-                    if (renderer.variableResolver.getInteger(renderer, targetVariable.second,&i))
-                        renderer.setVariable(*variableNode.get(), targetVariable.second, renderer.variableResolver.createInteger(renderer, i+1));
-                }
+                Node current = renderer.retrieveRenderedNode(*variableNode.get(), store);
+                if (current.variant.type == Variant::Type::INT)
+                    renderer.assignVariable(*variableNode.get(), store, Variant(current.variant.i + 1));
             }
             return Node();
         }
@@ -129,12 +126,9 @@ namespace Liquid {
             auto& argumentNode = node.children.front();
             auto& variableNode = argumentNode->children.front();
             if (variableNode->type->type == NodeType::VARIABLE) {
-                auto targetVariable = renderer.getVariable(*variableNode.get(), store);
-                if (targetVariable.first) {
-                    long long i = -1;
-                    if (renderer.variableResolver.getInteger(renderer, targetVariable.second,&i))
-                        renderer.setVariable(*variableNode.get(), targetVariable.second, renderer.variableResolver.createInteger(renderer, i-1));
-                }
+                Node current = renderer.retrieveRenderedNode(*variableNode.get(), store);
+                if (current.variant.type == Variant::Type::INT)
+                    renderer.assignVariable(*variableNode.get(), store, Variant(current.variant.i - 1));
             }
             return Node();
         }
@@ -152,7 +146,8 @@ namespace Liquid {
             return renderer.retrieveRenderedNode(*node.children[1].get(), store);
         }
         void compile(Compiler& compiler, const Node& node) const override {
-            int offset = compiler.add(node.children[1]->variant.s.data(), node.children[1]->variant.s.size());
+            const Variant& variant = node.children[1]->variant;
+            int offset = variant.type == Variant::Type::STRING_VIEW ? compiler.add(variant.view, variant.len) : compiler.add(variant.s.data(), variant.s.size());
             compiler.add(OP_OUTPUTMEM, 0x0, offset);
         }
     };
@@ -427,6 +422,45 @@ namespace Liquid {
             long long idx;
         };
 
+        enum class ForLoopProperty {
+            NONE,
+            INDEX0,
+            INDEX,
+            RINDEX,
+            RINDEX0,
+            FIRST,
+            LAST,
+            LENGTH
+        };
+
+        // Picked out by length first, so that most names are ruled out without comparing them.
+        static ForLoopProperty getForLoopProperty(std::string_view property) {
+            switch (property.size()) {
+                case 4:
+                    return property == "last" ? ForLoopProperty::LAST : ForLoopProperty::NONE;
+                case 5:
+                    return property == "index" ? ForLoopProperty::INDEX : (property == "first" ? ForLoopProperty::FIRST : ForLoopProperty::NONE);
+                case 6:
+                    if (property == "index0")
+                        return ForLoopProperty::INDEX0;
+                    if (property == "rindex")
+                        return ForLoopProperty::RINDEX;
+                    return property == "length" ? ForLoopProperty::LENGTH : ForLoopProperty::NONE;
+                case 7:
+                    return property == "rindex0" ? ForLoopProperty::RINDEX0 : ForLoopProperty::NONE;
+                default:
+                    return ForLoopProperty::NONE;
+            }
+        }
+
+        // Whether the node is a bare reference to forloop; the only drop that can be asked for a property by name.
+        static bool isForLoopVariable(const Node& node) {
+            if (!node.type || node.type->type != NodeType::Type::VARIABLE || node.children.size() != 1)
+                return false;
+            const Node& link = *node.children[0].get();
+            return !link.type && link.variant.type == Variant::Type::STRING && link.variant.s == "forloop";
+        }
+
         struct CycleNode : TagNodeType {
             CycleNode() : TagNodeType(Composition::FREE, "cycle", 1, -1, LIQUID_OPTIMIZATION_SCHEME_NONE) { }
 
@@ -509,8 +543,12 @@ namespace Liquid {
 
 
             auto iterator = +[](ForLoopContext& forLoopContext) {
+                if (!forLoopContext.renderer.step())
+                    return false;
                 forLoopContext.result.append(forLoopContext.renderer.retrieveRenderedNode(*forLoopContext.node.children[1].get(), forLoopContext.store).getString());
                 ++forLoopContext.idx;
+                if (forLoopContext.renderer.error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+                    return false;
                 if (forLoopContext.renderer.control != Renderer::Control::NONE)  {
                     if (forLoopContext.renderer.control == Renderer::Control::BREAK) {
                         forLoopContext.renderer.control = Renderer::Control::NONE;
@@ -536,46 +574,55 @@ namespace Liquid {
 
             renderer.pushInternalDrop("forloop", { &forLoopContext, +[](Renderer& renderer, const Node& node, Variable store, void* data)->Node {
                 ForLoopContext* forLoopContext = (ForLoopContext*)data;
-                string property;
+                ForLoopProperty property = ForLoopProperty::NONE;
                 if (node.type) {
-                    if (node.children.size() == 2)
-                        property = renderer.retrieveRenderedNode(*node.children[1].get(), store).getString();
+                    if (node.children.size() == 2) {
+                        const Node& link = *node.children[1].get();
+                        if (!link.type && link.variant.type == Variant::Type::STRING)
+                            property = getForLoopProperty(link.variant.s);
+                        else
+                            property = getForLoopProperty(renderer.retrieveRenderedNode(link, store).getString());
+                    }
+                } else if (node.variant.type == Variant::Type::STRING) {
+                    property = getForLoopProperty(node.variant.s);
                 } else {
-                    property = node.getString();
+                    property = getForLoopProperty(node.getString());
                 }
-                if (!property.empty()) {
-                    if (property == "index0")
+                switch (property) {
+                    case ForLoopProperty::INDEX0:
                         return Variant(forLoopContext->idx);
-                    if (property == "index")
+                    case ForLoopProperty::INDEX:
                         return Variant(forLoopContext->idx+1);
-                    if (property == "rindex")
-                        return Variant(forLoopContext->length - (forLoopContext->idx+1));
-                    if (property == "rindex0")
+                    case ForLoopProperty::RINDEX:
                         return Variant(forLoopContext->length - forLoopContext->idx);
-                    if (property == "first")
+                    case ForLoopProperty::RINDEX0:
+                        return Variant(forLoopContext->length - (forLoopContext->idx+1));
+                    case ForLoopProperty::FIRST:
                         return Variant(forLoopContext->idx == 0);
-                    if (property == "last")
+                    case ForLoopProperty::LAST:
                         return Variant(forLoopContext->idx == forLoopContext->length-1);
-                    if (property == "length")
+                    case ForLoopProperty::LENGTH:
                         return Variant(forLoopContext->length);
+                    case ForLoopProperty::NONE:
+                    break;
                 }
                 return Node();
             } });
             if (result.variant.type == Variant::Type::ARRAY) {
                 renderer.pushInternalDrop(variableName, { &forLoopContext, +[](Renderer& renderer, const Node& node, Variable store, void* data)->Node {
                     ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
-                    return Variant(*(Variant*)forLoopContext.variable);
+                    return renderer.resolveVariant(node, store, *(Variant*)forLoopContext.variable, 1);
                 } });
                 int endIndex = std::min(limit+start-1, (int)forLoopContext.length-1);
                 if (reversed) {
                     for (int i = endIndex; i >= start; --i) {
-                        forLoopContext.variable = &result.variant.a[i];
+                        forLoopContext.variable = const_cast<Variant*>(&result.variant.a[i]);
                         if (!forLoopContext.iterator(forLoopContext))
                             break;
                     }
                 } else {
                     for (int i = start; i <= endIndex; ++i) {
-                        forLoopContext.variable = &result.variant.a[i];
+                        forLoopContext.variable = const_cast<Variant*>(&result.variant.a[i]);
                         if (!forLoopContext.iterator(forLoopContext))
                             break;
                     }
@@ -585,7 +632,7 @@ namespace Liquid {
                     ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
                     return Variant(renderer.getVariable(node, Variable(forLoopContext.variable), 1).second);
                 } });
-                resolver.iterate(renderer, result.variant.v, +[](void* variable, void* data) {
+                renderer.iterate(result.variant.v, +[](void* variable, void* data) {
                     ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
                     forLoopContext.variable = variable;
                     return forLoopContext.iterator(forLoopContext);
@@ -1030,13 +1077,20 @@ namespace Liquid {
             if (op1.variant.type != Variant::Type::INT || op2.variant.type != Variant::Type::INT)
                 return Node();
             auto result = Node(Variant(vector<Variant>()));
-            // TODO: This can allocate a lot of memory. Short-circuit that; but should be plugge dinto the allocator.
-            long long size = op2.variant.i - op1.variant.i + 1;
-            if (size > 10000)
+            if (op2.variant.i < op1.variant.i)
+                return result;
+            // Done unsigned, as the difference between two long longs needn't fit in one.
+            unsigned long long span = (unsigned long long)op2.variant.i - (unsigned long long)op1.variant.i;
+            // Saturates; a range that large is over any limit anyway.
+            size_t size = span < SIZE_MAX ? span + 1 : SIZE_MAX;
+            // Without a memory limit to stop them, large ranges are refused outright.
+            if (!renderer.maximumMemoryUsage && size > 10000)
+                return Node();
+            if (!renderer.checkMemory(size, sizeof(Variant)))
                 return Node();
             result.variant.a.reserve(size);
-            for (long long i = op1.variant.i; i <= op2.variant.i; ++i)
-                result.variant.a.push_back(Variant(i));
+            for (size_t i = 0; i < size; ++i)
+                result.variant.a.push_back(Variant((long long)((unsigned long long)op1.variant.i + i)));
             return result;
         }
     };
@@ -1243,13 +1297,10 @@ namespace Liquid {
         }
     };
 
-    struct AppendFilterNode : FilterNodeType {
-        AppendFilterNode() : FilterNodeType("append", 1, 1) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            string result = renderer.getString(operand) + renderer.getString(argument);
-            return Variant(result);
+    struct AppendFilterNode : StringFilterNodeType {
+        AppendFilterNode() : StringFilterNodeType("append", 1, 1) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            str += renderer.getString(getArgument(renderer, node, store, 0));
         }
     };
 
@@ -1261,45 +1312,34 @@ namespace Liquid {
         }
     };
 
-    struct CapitalizeFilterNode : FilterNodeType {
-        CapitalizeFilterNode() : FilterNodeType("capitalize", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
-            str[0] = toupper(str[0]);
-            return Node(str);
+    struct CapitalizeFilterNode : StringFilterNodeType {
+        CapitalizeFilterNode() : StringFilterNodeType("capitalize", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            if (!str.empty())
+                str[0] = toupper(str[0]);
         }
     };
-    struct DowncaseFilterNode : FilterNodeType {
-        DowncaseFilterNode() : FilterNodeType("downcase", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
+    struct DowncaseFilterNode : StringFilterNodeType {
+        DowncaseFilterNode() : StringFilterNodeType("downcase", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
             std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c){ return std::tolower(c); });
-            return Variant(str);
         }
     };
-    struct HandleGenericFilterNode : FilterNodeType {
-        HandleGenericFilterNode(const string& symbol) : FilterNodeType(symbol, 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
-            string accumulator;
-            accumulator.reserve(str.size());
+    struct HandleGenericFilterNode : StringFilterNodeType {
+        HandleGenericFilterNode(const string& symbol) : StringFilterNodeType(symbol, 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            // Never longer than what it's made from, so it can be written over the string as it's read.
+            size_t length = 0;
             bool lastHyphen = true;
             for (auto it = str.begin(); it != str.end(); ++it) {
                 if (isalnum(*it)) {
-                    if (isupper(*it)) {
-                        accumulator.push_back(tolower(*it));
-                    } else {
-                        accumulator.push_back(*it);
-                    }
+                    str[length++] = isupper(*it) ? tolower(*it) : *it;
                     lastHyphen = false;
                 } else if (!lastHyphen) {
-                    accumulator.push_back('-');
+                    str[length++] = '-';
                 }
             }
-            return Variant(accumulator);
+            str.resize(length);
         }
     };
     struct HandleFilterNode : HandleGenericFilterNode { HandleFilterNode() : HandleGenericFilterNode("handle") { } };
@@ -1315,92 +1355,58 @@ namespace Liquid {
         }
     };
 
-    struct PrependFilterNode : FilterNodeType {
-        PrependFilterNode() : FilterNodeType("prepend", 1, 1) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            return Variant(renderer.getString(argument) + renderer.getString(operand));
+    struct PrependFilterNode : StringFilterNodeType {
+        PrependFilterNode() : StringFilterNodeType("prepend", 1, 1) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            str.insert(0, renderer.getString(getArgument(renderer, node, store, 0)));
         }
     };
-    struct RemoveFilterNode : FilterNodeType {
-        RemoveFilterNode() : FilterNodeType("remove", 1, 1) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            string accumulator;
-            string str = renderer.getString(operand);
-            string rm = renderer.getString(argument);
-            size_t start = 0, idx;
-            while ((idx = str.find(rm, start)) != string::npos) {
-                if (idx > start)
-                    accumulator.append(str, start, idx - start);
-                start = idx + rm.size();
-            }
-            accumulator.append(str, start, str.size() - start);
-            return Variant(accumulator);
+
+    // Replaces every occurrence of pattern in str, or just the first. Leaves str alone, without allocating, if there's nothing to replace.
+    static void replaceOccurrences(string& str, const string& pattern, const string& replacement, bool first) {
+        if (pattern.empty())
+            return;
+        size_t idx = str.find(pattern);
+        if (idx == string::npos)
+            return;
+        if (first) {
+            str.replace(idx, pattern.size(), replacement);
+            return;
+        }
+        string accumulator;
+        accumulator.reserve(str.size());
+        size_t start = 0;
+        do {
+            accumulator.append(str, start, idx - start);
+            accumulator.append(replacement);
+            start = idx + pattern.size();
+        } while ((idx = str.find(pattern, start)) != string::npos);
+        accumulator.append(str, start, str.size() - start);
+        str.swap(accumulator);
+    }
+
+    struct RemoveFilterNode : StringFilterNodeType {
+        RemoveFilterNode() : StringFilterNodeType("remove", 1, 1) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            replaceOccurrences(str, renderer.getString(getArgument(renderer, node, store, 0)), string(), false);
         }
     };
-    struct RemoveFirstFilterNode : FilterNodeType {
-        RemoveFirstFilterNode() : FilterNodeType("removefirst", 1, 1) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            string accumulator;
-            string str = renderer.getString(operand);
-            string rm = renderer.getString(argument);
-            size_t start = 0, idx;
-            while ((idx = str.find(rm, start)) != string::npos) {
-                if (idx > start)
-                    accumulator.append(str, start, idx - start);
-                start = idx + rm.size();
-                break;
-            }
-            accumulator.append(str, start, str.size() - start);
-            return Variant(accumulator);
+    struct RemoveFirstFilterNode : StringFilterNodeType {
+        RemoveFirstFilterNode() : StringFilterNodeType("removefirst", 1, 1) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            replaceOccurrences(str, renderer.getString(getArgument(renderer, node, store, 0)), string(), true);
         }
     };
-    struct ReplaceFilterNode : FilterNodeType {
-        ReplaceFilterNode() : FilterNodeType("replace", 2, 2) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argumentPattern = getArgument(renderer, node, store, 0);
-            auto argumentReplacement = getArgument(renderer, node, store, 1);
-            string accumulator;
-            string str = renderer.getString(operand);
-            string pattern = renderer.getString(argumentPattern);
-            string replacement = renderer.getString(argumentReplacement);
-            size_t start = 0, idx;
-            while ((idx = str.find(pattern, start)) != string::npos) {
-                if (idx > start)
-                    accumulator.append(str, start, idx - start);
-                accumulator.append(replacement);
-                start = idx + pattern.size();
-            }
-            accumulator.append(str, start, str.size() - start);
-            return Variant(accumulator);
+    struct ReplaceFilterNode : StringFilterNodeType {
+        ReplaceFilterNode() : StringFilterNodeType("replace", 2, 2) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            replaceOccurrences(str, renderer.getString(getArgument(renderer, node, store, 0)), renderer.getString(getArgument(renderer, node, store, 1)), false);
         }
     };
-    struct ReplaceFirstFilterNode : FilterNodeType {
-        ReplaceFirstFilterNode() : FilterNodeType("replacefirst", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argumentPattern = getArgument(renderer, node, store, 0);
-            auto argumentReplacement = getArgument(renderer, node, store, 1);
-            string accumulator;
-            string str = renderer.getString(operand);
-            string pattern = renderer.getString(argumentPattern);
-            string replacement = renderer.getString(argumentReplacement);
-            size_t start = 0, idx;
-            while ((idx = str.find(pattern, start)) != string::npos) {
-                if (idx > start)
-                    accumulator.append(str, start, idx - start);
-                accumulator.append(replacement);
-                start = idx + pattern.size();
-                break;
-            }
-            accumulator.append(str, start, str.size() - start);
-            return Variant(accumulator);
+    struct ReplaceFirstFilterNode : StringFilterNodeType {
+        ReplaceFirstFilterNode() : StringFilterNodeType("replacefirst", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            replaceOccurrences(str, renderer.getString(getArgument(renderer, node, store, 0)), renderer.getString(getArgument(renderer, node, store, 1)), true);
         }
     };
     struct SliceFilterNode : FilterNodeType {
@@ -1467,65 +1473,55 @@ namespace Liquid {
                 result.a.push_back(str);
                 return Variant(std::move(result));
             }
-            size_t start = 0, idx;
+            size_t start = 0, idx, size = 0;
             while ((idx = str.find(splitter, start)) != string::npos) {
-                if (idx > start)
+                if (idx > start) {
+                    size += idx - start + sizeof(Variant);
+                    if (!renderer.checkMemory(size))
+                        return Node();
                     result.a.push_back(Variant(str.substr(start, idx - start)));
+                }
                 start = idx + splitter.size();
             }
             result.a.push_back(str.substr(start, str.size() - start));
             return Variant(std::move(result));
         }
     };
-    struct StripFilterNode : FilterNodeType {
-        StripFilterNode() : FilterNodeType("strip", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
+    struct StripFilterNode : StringFilterNodeType {
+        StripFilterNode() : StringFilterNodeType("strip", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
             size_t start, end;
-            for (start = 0; start < str.size() && isblank(str[start]); ++start);
-            for (end = str.size()-1; end > 0 && isblank(str[end]); --end);
-            return Node(str.substr(start, end - start + 1));
+            for (end = str.size(); end > 0 && isblank(str[end-1]); --end);
+            for (start = 0; start < end && isblank(str[start]); ++start);
+            str.erase(end);
+            str.erase(0, start);
         }
     };
-    struct LStripFilterNode : FilterNodeType {
-        LStripFilterNode() : FilterNodeType("lstrip", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
+    struct LStripFilterNode : StringFilterNodeType {
+        LStripFilterNode() : StringFilterNodeType("lstrip", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
             size_t start;
             for (start = 0; start < str.size() && isblank(str[start]); ++start);
-            return Node(str.substr(start, str.size() - start));
+            str.erase(0, start);
         }
     };
-    struct RStripFilterNode : FilterNodeType {
-        RStripFilterNode() : FilterNodeType("rstrip", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
+    struct RStripFilterNode : StringFilterNodeType {
+        RStripFilterNode() : StringFilterNodeType("rstrip", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
             size_t end;
-            for (end = str.size()-1; end > 0 && isblank(str[end]); --end);
-            return Node(str.substr(0, end + 1));
+            for (end = str.size(); end > 0 && isblank(str[end-1]); --end);
+            str.erase(end);
         }
     };
-    struct StripNewlinesFilterNode : FilterNodeType {
-        StripNewlinesFilterNode() : FilterNodeType("strip_newlines", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
-            string accumulator;
-            accumulator.reserve(str.size());
-            for (auto it = str.begin(); it != str.end(); ++it) {
-                if (*it != '\n' && *it != '\r')
-                    accumulator.push_back(*it);
-            }
-            return Node(accumulator);
+    struct StripNewlinesFilterNode : StringFilterNodeType {
+        StripNewlinesFilterNode() : StringFilterNodeType("strip_newlines", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
+            str.erase(std::remove_if(str.begin(), str.end(), [](char c) { return c == '\n' || c == '\r'; }), str.end());
         }
     };
-    struct TruncateFilterNode : FilterNodeType {
-        TruncateFilterNode() : FilterNodeType("truncate", 1, 2) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
+    struct TruncateFilterNode : StringFilterNodeType {
+        TruncateFilterNode() : StringFilterNodeType("truncate", 1, 2) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
             auto characterCount = getArgument(renderer, node, store, 0);
             auto customEllipsis = getArgument(renderer, node, store, 1);
             string ellipsis = "...";
@@ -1533,10 +1529,10 @@ namespace Liquid {
                 ellipsis = renderer.getString(customEllipsis);
             long long count = characterCount.variant.getInt();
             if (count > (long long)ellipsis.size()) {
-                string str = renderer.getString(operand);
-                return Variant(str.substr(0, std::min((long long)(count - ellipsis.size()), (long long)str.size())) + ellipsis);
-            }
-            return Variant(ellipsis.substr(0, std::min(count, (long long)ellipsis.size())));
+                str.resize(std::min((long long)(count - ellipsis.size()), (long long)str.size()));
+                str += ellipsis;
+            } else
+                str.assign(ellipsis, 0, std::min(count, (long long)ellipsis.size()));
         }
     };
     struct TruncateWordsFilterNode : FilterNodeType {
@@ -1565,14 +1561,10 @@ namespace Liquid {
             return Variant(str.substr(0, i-1));
         }
     };
-    struct UpcaseFilterNode : FilterNodeType {
-        UpcaseFilterNode() : FilterNodeType("upcase", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            string str = renderer.getString(operand);
+    struct UpcaseFilterNode : StringFilterNodeType {
+        UpcaseFilterNode() : StringFilterNodeType("upcase", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, string& str) const override {
             std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c){ return std::toupper(c); });
-            return Variant(str);
         }
     };
 
@@ -1609,7 +1601,7 @@ namespace Liquid {
                 joinStruct.joiner = renderer.getString(argument);
 
 
-            renderer.variableResolver.iterate(renderer, operand, +[](void* variable, void* data) {
+            renderer.iterate(operand, +[](void* variable, void* data) {
                 JoinStruct& joinStruct = *(JoinStruct*)data;
                 string part;
                 if (joinStruct.idx++ > 0)
@@ -1642,7 +1634,7 @@ namespace Liquid {
         ConcatFilterNode() : ArrayFilterNodeType("concat", 1, 1) { }
 
         void accumulate(Renderer& renderer, Variant& accumulator, Variable v) const {
-            renderer.variableResolver.iterate(renderer, v, +[](void* variable, void* data) {
+            renderer.iterate(v, +[](void* variable, void* data) {
                 static_cast<Variant*>(data)->a.push_back(Variant(static_cast<Variable*>(variable)));
                 return true;
             }, &accumulator, 0, -1, false);
@@ -1654,7 +1646,7 @@ namespace Liquid {
         }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            Variant accumulator;
+            Variant accumulator { vector<Variant>() };
             auto operand = getOperand(renderer, node, store);
             auto argument = getArgument(renderer, node, store, 0);
             switch (operand.variant.type) {
@@ -1683,56 +1675,20 @@ namespace Liquid {
         }
     };
 
-    struct MapFilterNode : ArrayFilterNodeType {
-        MapFilterNode() : ArrayFilterNodeType("map", 1, 1) { }
+    struct MapFilterNode : SequenceFilterNodeType {
+        MapFilterNode() : SequenceFilterNodeType("map", 1, 1) { }
 
-        struct MapStruct {
-            Renderer& renderer;
-            string property;
-            Variant accumulator;
-        };
-
-        void accumulate(Renderer& renderer, MapStruct& mapStruct, Variable v) const {
-            renderer.variableResolver.iterate(renderer, v, +[](void* variable, void* data) {
-                MapStruct& mapStruct = *static_cast<MapStruct*>(data);
-                Variable target;
-                if (mapStruct.renderer.variableResolver.getDictionaryVariable(mapStruct.renderer, variable, mapStruct.property.data(), target))
-                    mapStruct.accumulator.a.push_back(target);
-                else
-                    mapStruct.accumulator.a.push_back(Variant());
-                return true;
-            }, &mapStruct, 0, -1, false);
+        void prepare(Renderer& renderer, Stage& stage) const override {
+            stage.arguments[0] = Variant(renderer.getString(Node(stage.arguments[0])));
         }
 
-        void accumulate(Renderer& renderer, MapStruct& mapStruct, const Variant& v) const {
-            for (auto it = v.a.begin(); it != v.a.end(); ++it) {
-                if (it->type == Variant::Type::VARIABLE) {
-                    Variable target;
-                    if (mapStruct.renderer.variableResolver.getDictionaryVariable(mapStruct.renderer, const_cast<Variable&>(it->v), mapStruct.property.data(), target))
-                        mapStruct.accumulator.a.push_back(target);
-                    else
-                        mapStruct.accumulator.a.push_back(Variant());
-                } else {
-                    mapStruct.accumulator.a.push_back(Variant());
-                }
-            }
-        }
-
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            MapStruct mapStruct = { renderer, renderer.getString(argument), nullptr };
-            switch (operand.variant.type) {
-                case Variant::Type::VARIABLE:
-                    accumulate(renderer, mapStruct, operand.variant.v);
-                break;
-                case Variant::Type::ARRAY:
-                    accumulate(renderer, mapStruct, operand.variant.a);
-                break;
-                default:
-                    return Node();
-            }
-            return mapStruct.accumulator;
+        bool filter(Renderer& renderer, Stage& stage, Variant& element) const override {
+            Variable target;
+            if (element.type == Variant::Type::VARIABLE && renderer.variableResolver.getDictionaryVariable(renderer, element.v, stage.arguments[0].s.data(), target))
+                element = Variant(target);
+            else
+                element = Variant();
+            return true;
         }
     };
 
@@ -1740,12 +1696,12 @@ namespace Liquid {
         ReverseFilterNode() : ArrayFilterNodeType("reverse", 0, 0) { }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            Variant accumulator;
+            Variant accumulator { vector<Variant>() };
             auto operand = getOperand(renderer, node, store);
             auto& v = operand.variant;
             switch (operand.variant.type) {
                 case Variant::Type::VARIABLE:
-                    renderer.variableResolver.iterate(renderer, v.v, +[](void* variable, void* data) {
+                    renderer.iterate(v.v, +[](void* variable, void* data) {
                         static_cast<Variant*>(data)->a.push_back(Variable({variable}));
                         return true;
                     }, &accumulator, 0, -1, true);
@@ -1757,168 +1713,245 @@ namespace Liquid {
                 default:
                     return Node();
             }
-            std::reverse(accumulator.a.begin(), accumulator.a.end());
             return accumulator;
         }
     };
 
-    struct SortFilterNode : ArrayFilterNodeType {
-        SortFilterNode() : ArrayFilterNodeType("sort", 0, 1) { }
-
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            Variant accumulator;
-            string property;
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            switch (operand.variant.type) {
-                case Variant::Type::VARIABLE: {
-                    renderer.variableResolver.iterate(renderer, operand.variant.v, +[](void* variable, void* data) {
-                        static_cast<Variant*>(data)->a.push_back(Variable({variable}));
-                        return true;
-                    }, &accumulator, 0, -1, false);
-                } break;
-                case Variant::Type::ARRAY: {
-                    auto& v = operand.variant;
-                    for (auto it = v.a.begin(); it != v.a.end(); ++it)
-                        accumulator.a.push_back(*it);
-                } break;
-                default:
-                    return Node();
-            }
-
-            if (!argument.type && argument.variant.type == Variant::Type::STRING) {
-                property = renderer.getString(argument);
-                std::sort(accumulator.a.begin(), accumulator.a.end(), [&property, &renderer](Variant& a, Variant& b) -> bool {
-                    if (a.type != Variant::Type::VARIABLE || b.type != Variant::Type::VARIABLE)
-                        return false;
-                    Variable targetA, targetB;
-                    if (!renderer.variableResolver.getDictionaryVariable(renderer, a.v, property.data(), targetA))
-                        return false;
-                    if (!renderer.variableResolver.getDictionaryVariable(renderer, b.v, property.data(), targetB))
-                        return false;
-                    return renderer.variableResolver.compare(targetA, targetB) < 0;
-                });
-            } else {
-                std::sort(accumulator.a.begin(), accumulator.a.end(), [](Variant& a, Variant& b) -> bool { return a < b; });
+    // Sorts by decorating: each element's key is resolved and parsed once, up front, and the keys sorted on their own, as plain numbers or
+    // bytes; the elements are then laid out in the keys' order. Numbers sort before strings, and anything else goes last, in its original
+    // order. Ties are broken by position, so the order never depends on how the sort was done.
+    struct SortGenericFilterNode : ArrayFilterNodeType {
+        // Arrays at least this long are sorted in pieces, one per thread the renderer allows, that are then merged. The resolver is only ever
+        // called while decorating, on this thread.
+        static constexpr size_t PARALLEL_THRESHOLD = 1 << 16;
+
+        struct Key {
+            enum class Kind { NUMBER, STRING, OTHER } kind;
+            bool integral;
+            long long i;
+            double f;
+            std::string_view s;
+            size_t index;
+
+            // Compares an integer with a float exactly, rather than through a cast that can round; negative if i is the lesser.
+            static int compare(long long i, double f) {
+                if (f >= 9223372036854775808.0)
+                    return -1;
+                if (f < -9223372036854775808.0)
+                    return 1;
+                double whole = std::trunc(f);
+                long long truncated = (long long)whole;
+                if (i != truncated)
+                    return i < truncated ? -1 : 1;
+                return f > whole ? -1 : (f < whole ? 1 : 0);
+            }
+
+            bool operator < (const Key& key) const {
+                if (kind != key.kind)
+                    return kind < key.kind;
+                switch (kind) {
+                    case Kind::NUMBER: {
+                        int difference;
+                        if (integral && key.integral)
+                            difference = i < key.i ? -1 : (i > key.i ? 1 : 0);
+                        else if (integral)
+                            difference = compare(i, key.f);
+                        else if (key.integral)
+                            difference = -compare(key.i, f);
+                        else
+                            difference = f < key.f ? -1 : (f > key.f ? 1 : 0);
+                        if (difference)
+                            return difference < 0;
+                    } break;
+                    case Kind::STRING: {
+                        int difference = s.compare(key.s);
+                        if (difference)
+                            return difference < 0;
+                    } break;
+                    case Kind::OTHER:
+                    break;
+                }
+                return index < key.index;
             }
-            return accumulator;
-        }
-    };
-
-
-    struct WhereFilterNode : ArrayFilterNodeType {
-        WhereFilterNode() : ArrayFilterNodeType("where", 1, 2) { }
-
-        struct WhereStruct {
-            Renderer& renderer;
-            string property;
-            Variant value;
-            Variant accumulator;
         };
 
-        void accumulate(WhereStruct& whereStruct, Variable v) const {
-            whereStruct.renderer.variableResolver.iterate(whereStruct.renderer, v, +[](void* variable, void* data) {
-                WhereStruct& whereStruct = *static_cast<WhereStruct*>(data);
-                Variable target;
-                if (whereStruct.renderer.variableResolver.getDictionaryVariable(whereStruct.renderer, variable, whereStruct.property.data(), target)) {
-                    if (whereStruct.property.empty()) {
-                        if (whereStruct.renderer.variableResolver.getTruthy(whereStruct.renderer, target))
-                            whereStruct.accumulator.a.push_back(variable);
-                    } else {
-                        // std::string str;
-                        //if (whereStruct.resolver.getString(str)) {
-                            // TODO.
-                            // if (str == whereStruct.value)
-                            //    whereStruct.accumulator.a.push_back(variable);
-                        //}
+        bool natural;
+
+        SortGenericFilterNode(const string& symbol, bool natural) : ArrayFilterNodeType(symbol, 0, 1), natural(natural) { }
+
+        static void sort(vector<Key>& keys, unsigned int threads) {
+            size_t pieces = keys.size() >= PARALLEL_THRESHOLD ? std::min(std::max(threads, 1U), std::max(std::thread::hardware_concurrency(), 1U)) : 1;
+            if (pieces == 1) {
+                std::sort(keys.begin(), keys.end());
+                return;
+            }
+            vector<size_t> bounds;
+            for (size_t i = 0; i <= pieces; ++i)
+                bounds.push_back(keys.size() * i / pieces);
+            vector<std::thread> pool;
+            pool.reserve(pieces - 1);
+            // However this is left, no thread may still be joinable when the pool's destroyed.
+            struct Joiner {
+                vector<std::thread>& pool;
+                ~Joiner() {
+                    for (auto& thread : pool) {
+                        if (thread.joinable())
+                            thread.join();
                     }
                 }
-                return true;
-            }, &whereStruct, 0, -1, false);
-        }
-
-        void accumulate(WhereStruct& whereStruct, const Variant& v) const {
-            for (auto it = v.a.begin(); it != v.a.end(); ++it) {
-                if (it->type == Variant::Type::VARIABLE) {
-                    Variable target;
-                    if (whereStruct.renderer.variableResolver.getDictionaryVariable(whereStruct.renderer, const_cast<Variable&>(it->v), whereStruct.property.data(), target)) {
-                        if (whereStruct.property.empty()) {
-                            if (whereStruct.renderer.variableResolver.getTruthy(whereStruct.renderer, target))
-                                whereStruct.accumulator.a.push_back(*it);
-                        } else {
-                            //std::string str;
-                            //if (target->getString(str)) {
-                                // TODO
-                                //if (str == whereStruct.value)
-                                //    whereStruct.accumulator.a.push_back(*it);
-                            //}
-                        }
-                    }
+            } joiner { pool };
+            for (size_t i = 1; i < pieces; ++i) {
+                auto piece = [&keys, &bounds, i]() { std::sort(keys.begin() + bounds[i], keys.begin() + bounds[i+1]); };
+                try {
+                    pool.emplace_back(piece);
+                } catch (std::system_error&) {
+                    // Out of threads; this one does the piece instead.
+                    piece();
                 }
             }
+            std::sort(keys.begin() + bounds[0], keys.begin() + bounds[1]);
+            for (auto& thread : pool)
+                thread.join();
+            for (size_t width = 1; width < pieces; width *= 2) {
+                for (size_t i = 0; i + width < pieces; i += width * 2)
+                    std::inplace_merge(keys.begin() + bounds[i], keys.begin() + bounds[i + width], keys.begin() + bounds[std::min(i + width * 2, pieces)]);
+            }
         }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
             auto operand = getOperand(renderer, node, store);
-            auto arg1 = getArgument(renderer, node, store, 0);
-            auto arg2 = getArgument(renderer, node, store, 1);
-            WhereStruct whereStruct = { renderer, renderer.getString(arg1), arg2.variant, nullptr };
+            auto argument = getArgument(renderer, node, store, 0);
+            Variant::Array elements;
             switch (operand.variant.type) {
-                case Variant::Type::VARIABLE:
-                    accumulate(whereStruct, operand.variant.v);
-                break;
+                case Variant::Type::VARIABLE: {
+                    renderer.iterate(operand.variant.v, +[](void* variable, void* data) {
+                        static_cast<Variant::Array*>(data)->push_back(Variable({variable}));
+                        return true;
+                    }, &elements, 0, -1, false);
+                } break;
                 case Variant::Type::ARRAY:
-                    accumulate(whereStruct, operand.variant.a);
+                    elements = operand.variant.a;
                 break;
                 default:
                     return Node();
             }
-            return whereStruct.accumulator;
+
+            string property;
+            bool hasProperty = !argument.type && argument.variant.type == Variant::Type::STRING;
+            if (hasProperty)
+                property = renderer.getString(argument);
+            // The keys and their values only last as long as the sort, so are checked against the memory limit, rather than counted.
+            if (!renderer.checkMemory(elements.size(), sizeof(Key) + sizeof(Variant)))
+                return Node();
+            // Holds the keys' values, for the views into them; reserved, so they never move.
+            vector<Variant> values;
+            values.reserve(elements.size());
+            vector<Key> keys;
+            keys.reserve(elements.size());
+            for (size_t i = 0; i < elements.size(); ++i) {
+                if (!renderer.step())
+                    return Node();
+                const Variant& element = elements[i];
+                Variable target = element.type == Variant::Type::VARIABLE ? element.v : Variable();
+                if (hasProperty && (element.type != Variant::Type::VARIABLE || !renderer.variableResolver.getDictionaryVariable(renderer, element.v.pointer, property.data(), target)))
+                    values.emplace_back();
+                else if (target.pointer)
+                    values.push_back(renderer.parseVariant(target, true));
+                else
+                    values.push_back(element);
+                Variant& value = values.back();
+                Key key = { Key::Kind::OTHER, false, 0, 0.0, std::string_view(), i };
+                switch (value.type) {
+                    case Variant::Type::INT:
+                        key.kind = Key::Kind::NUMBER;
+                        key.integral = true;
+                        key.i = value.i;
+                    break;
+                    case Variant::Type::FLOAT:
+                        // NaN is neither less nor greater than anything, so can't be ordered among the numbers.
+                        if (!std::isnan(value.f)) {
+                            key.kind = Key::Kind::NUMBER;
+                            key.f = value.f;
+                        }
+                    break;
+                    case Variant::Type::STRING:
+                    case Variant::Type::STRING_VIEW:
+                        if (natural) {
+                            string lowered = value.getString();
+                            std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return (char)tolower(c); });
+                            value = Variant(move(lowered));
+                        }
+                        key.kind = Key::Kind::STRING;
+                        key.s = value.type == Variant::Type::STRING ? std::string_view(value.s) : std::string_view(value.view, value.len);
+                    break;
+                    default:
+                    break;
+                }
+                keys.push_back(key);
+            }
+            // A step for each comparison the sort could make.
+            unsigned long long comparisons = keys.size();
+            for (size_t size = keys.size(); size > 1; size >>= 1)
+                comparisons += keys.size();
+            if (!renderer.step(comparisons))
+                return Node();
+            sort(keys, renderer.maximumSortThreads);
+
+            Variant accumulator { vector<Variant>() };
+            vector<Variant>& sorted = accumulator.a.mutate();
+            sorted.reserve(keys.size());
+            for (auto& key : keys)
+                sorted.push_back(elements[key.index]);
+            return accumulator;
         }
     };
 
-    struct UniqFilterNode : ArrayFilterNodeType {
-        UniqFilterNode() : ArrayFilterNodeType("uniq", 0, 0) { }
+    struct SortFilterNode : SortGenericFilterNode { SortFilterNode() : SortGenericFilterNode("sort", false) { } };
+    // As sort, but strings are compared without regard to case.
+    struct SortNaturalFilterNode : SortGenericFilterNode { SortNaturalFilterNode() : SortGenericFilterNode("sort_natural", true) { } };
 
-        struct UniqStruct {
-            Renderer& renderer;
-            std::unordered_set<size_t> hashes;
-            Variant accumulator;
-        };
 
-        void accumulate(UniqStruct& uniqStruct, Variable v) const {
-            uniqStruct.renderer.variableResolver.iterate(uniqStruct.renderer, v, +[](void* variable, void* data) {
-                UniqStruct& uniqStruct = *static_cast<UniqStruct*>(data);
-                Variant v = uniqStruct.renderer.parseVariant(Variable({variable}));
-                if (!uniqStruct.hashes.emplace(v.hash()).second)
-                    uniqStruct.accumulator.a.push_back(variable);
-                return true;
-            }, &uniqStruct, 0, -1, false);
-        }
+    struct WhereFilterNode : SequenceFilterNodeType {
+        WhereFilterNode() : SequenceFilterNodeType("where", 1, 2) { }
 
-        void accumulate(UniqStruct& uniqStruct, const Variant& v) const {
-            for (auto it = v.a.begin(); it != v.a.end(); ++it) {
-                if (!uniqStruct.hashes.emplace(it->hash()).second)
-                    uniqStruct.accumulator.a.push_back(v);
-            }
+        static bool isString(const Variant& variant) { return variant.type == Variant::Type::STRING || variant.type == Variant::Type::STRING_VIEW; }
+
+        void prepare(Renderer& renderer, Stage& stage) const override {
+            stage.arguments[0] = Variant(renderer.getString(Node(stage.arguments[0])));
+            if (stage.arguments[1].type == Variant::Type::VARIABLE)
+                stage.arguments[1] = renderer.parseVariant(stage.arguments[1].v);
         }
 
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto arg1 = getArgument(renderer, node, store, 0);
-            auto arg2 = getArgument(renderer, node, store, 1);
-            UniqStruct uniqStruct = { renderer, {}, nullptr };
-            switch (operand.variant.type) {
-                case Variant::Type::VARIABLE:
-                    accumulate(uniqStruct, operand.variant.v);
-                break;
-                case Variant::Type::ARRAY:
-                    accumulate(uniqStruct, operand.variant.a);
-                break;
-                default:
-                    return Node();
-            }
-            return uniqStruct.accumulator;
+        // With just a property, keeps elements where it's truthy; with a value too, where it's equal to that.
+        bool filter(Renderer& renderer, Stage& stage, Variant& element) const override {
+            Variable target;
+            if (element.type != Variant::Type::VARIABLE || !renderer.variableResolver.getDictionaryVariable(renderer, element.v, stage.arguments[0].s.data(), target))
+                return false;
+            const Variant& value = stage.arguments[1];
+            if (value.type == Variant::Type::NIL)
+                return renderer.variableResolver.getTruthy(renderer, target);
+            Variant property = renderer.parseVariant(target);
+            if (isString(property) && isString(value))
+                return property.getString() == value.getString();
+            return property == value;
+        }
+    };
+
+    struct UniqFilterNode : SequenceFilterNodeType {
+        UniqFilterNode() : SequenceFilterNodeType("uniq", 0, 0) { }
+
+        bool filter(Renderer& renderer, Stage& stage, Variant& element) const override {
+            Variant value = element.type == Variant::Type::VARIABLE ? renderer.parseVariant(element.v) : element;
+            // Views compare by pointer, so they're kept as strings.
+            if (value.type == Variant::Type::STRING_VIEW)
+                value = Variant(value.getString());
+            auto& bucket = stage.seen[value.hash()];
+            for (auto& seen : bucket) {
+                if (seen == value)
+                    return false;
+            }
+            bucket.push_back(std::move(value));
+            return true;
         }
     };
 
@@ -1927,6 +1960,18 @@ namespace Liquid {
     struct FirstFilterNode : ArrayFilterNodeType {
         FirstFilterNode() : ArrayFilterNodeType("first", 0, 0) { }
 
+        Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            if (renderer.mode == Renderer::ExecutionMode::INTERPRETER || !SequenceFilterNodeType::isSequence(*node.children[0].get()))
+                return ArrayFilterNodeType::render(renderer, node, store);
+            // Stops the chain at the first element through it.
+            Node first;
+            static_cast<const SequenceFilterNodeType*>(node.children[0]->type)->run(renderer, *node.children[0].get(), store, +[](const Variant& element, void* data) {
+                *static_cast<Node*>(data) = Node(element);
+                return false;
+            }, &first);
+            return first;
+        }
+
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const override {
             Variable v;
             if (!renderer.variableResolver.getArrayVariable(renderer, operand, 0, v))
@@ -1946,8 +1991,8 @@ namespace Liquid {
         FirstDotFilterNode() : DotFilterNodeType("first") { }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            if (node.type && node.children.size() == 1 && node.children[0]->type && node.children[0]->type->type == NodeType::Type::VARIABLE && node.children[0]->children.size() == 1) {
-                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop(*node.children[0].get(), store);
+            if (node.type && node.children.size() == 1 && ForNode::isForLoopVariable(*node.children[0].get())) {
+                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop("forloop");
                 if (drop.second)
                     return drop.second(renderer, Variant("first"), store, drop.first);
             }
@@ -1998,6 +2043,17 @@ namespace Liquid {
     struct LastFilterNode : ArrayFilterNodeType {
         LastFilterNode() : ArrayFilterNodeType("last", 0, 0) { }
 
+        Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            if (renderer.mode == Renderer::ExecutionMode::INTERPRETER || !SequenceFilterNodeType::isSequence(*node.children[0].get()))
+                return ArrayFilterNodeType::render(renderer, node, store);
+            Node last;
+            static_cast<const SequenceFilterNodeType*>(node.children[0]->type)->run(renderer, *node.children[0].get(), store, +[](const Variant& element, void* data) {
+                *static_cast<Node*>(data) = Node(element);
+                return true;
+            }, &last);
+            return last;
+        }
+
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const override {
             Variable v;
             long long size = renderer.variableResolver.getArraySize(renderer, operand);
@@ -2018,10 +2074,10 @@ namespace Liquid {
         LastDotFilterNode() : DotFilterNodeType("last") { }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            if (node.type && node.type->type == NodeType::Type::VARIABLE && node.children.size() == 1) {
-                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop(*node.children[0].get(), store);
+            if (node.type && node.children.size() == 1 && ForNode::isForLoopVariable(*node.children[0].get())) {
+                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop("forloop");
                 if (drop.second)
-                    return drop.second(renderer, Variant("first"), store, drop.first);
+                    return drop.second(renderer, Variant("last"), store, drop.first);
             }
             auto operand = getOperand(renderer, node, store);
             switch (operand.variant.type) {
@@ -2081,6 +2137,15 @@ namespace Liquid {
         SizeFilterNode() : FilterNodeType("size", 0, 0) { }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            if (renderer.mode != Renderer::ExecutionMode::INTERPRETER && SequenceFilterNodeType::isSequence(*node.children[0].get())) {
+                long long size = 0;
+                if (!static_cast<const SequenceFilterNodeType*>(node.children[0]->type)->run(renderer, *node.children[0].get(), store, +[](const Variant& element, void* data) {
+                    ++*static_cast<long long*>(data);
+                    return true;
+                }, &size))
+                    return Node();
+                return Node(size);
+            }
             auto operand = getOperand(renderer, node, store);
             switch (operand.variant.type) {
                 case Variant::Type::ARRAY:
@@ -2277,6 +2342,7 @@ namespace Liquid {
         context.template registerType<ReverseFilterNode>();
         context.template registerType<SizeFilterNode>();
         context.template registerType<SortFilterNode>();
+        context.template registerType<SortNaturalFilterNode>();
         context.template registerType<WhereFilterNode>();
         context.template registerType<UniqFilterNode>();
 
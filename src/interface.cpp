@@ -3,6 +3,9 @@
 #include "context.h"
 #include "optimizer.h"
 #include "compiler.h"
+#include "loader.h"
+#include "serializer.h"
+#include "jsonstore.h"
 #include <memory>
 
 using namespace Liquid;
@@ -15,6 +18,10 @@ void liquidFreeContext(LiquidContext context) {
     delete (Context*)context.context;
 }
 
+void liquidFreezeContext(LiquidContext context) {
+    static_cast<Context*>(context.context)->freeze();
+}
+
 void liquidImplementStrictStandardDialect(LiquidContext context) {
     StandardDialect::implementStrict(*static_cast<Context*>(context.context));
 }
@@ -54,7 +61,11 @@ LiquidRenderer liquidCreateRenderer(LiquidContext context) {
         /* .createNil = */+[](LiquidRenderer renderer) { return (void*)NULL; },
         /* .createClone = */+[](LiquidRenderer renderer, void* value) { return (void*)NULL; },
         /* .freeVariable = */+[](LiquidRenderer renderer, void* value) { },
-        /* .compare = */+[](void* a, void* b) { return 0; }
+        /* .compare = */+[](void* a, void* b) { return 0; },
+        /* .resolvePath = */NULL,
+        /* .getStringView = */NULL,
+        /* .createStringN = */NULL,
+        /* .getArrayVariables = */NULL
     });
     // So that we pre-allocate things.
     interpreter->buffers.push(string());
@@ -77,7 +88,11 @@ LiquidOptimizer liquidCreateOptimizer(LiquidRenderer renderer) {
 }
 
 void liquidOptimizeTemplate(LiquidOptimizer optimizer, LiquidTemplate tmpl, void* variableStore) {
-    static_cast<Optimizer*>(optimizer.optimizer)->optimize(*static_cast<Node*>(tmpl.ast), Variable({ variableStore }));
+    static_cast<Optimizer*>(optimizer.optimizer)->optimize(static_cast<Template*>(tmpl.ast)->ast, Variable({ variableStore }));
+}
+
+size_t liquidOptimizeTemplateDeadStores(LiquidOptimizer optimizer, LiquidTemplate tmpl) {
+    return static_cast<Optimizer*>(optimizer.optimizer)->removeDeadStores(static_cast<Template*>(tmpl.ast)->ast);
 }
 
 void liquidFreeOptimizer(LiquidOptimizer optimizer) {
@@ -93,7 +108,7 @@ void liquidFreeCompiler(LiquidCompiler compiler) {
 }
 
 LiquidProgram liquidCompilerCompileTemplate(LiquidCompiler compiler, LiquidTemplate tmpl) {
-    return LiquidProgram({ new Program(move(static_cast<Compiler*>(compiler.compiler)->compile(*static_cast<Node*>(tmpl.ast)))) });
+    return LiquidProgram({ new Program(move(static_cast<Compiler*>(compiler.compiler)->compile(static_cast<Template*>(tmpl.ast)->ast))) });
 }
 
 int liquidCompilerDisassembleProgram(LiquidCompiler compiler, LiquidProgram program, char* buffer, size_t maxSize) {
@@ -105,7 +120,7 @@ int liquidCompilerDisassembleProgram(LiquidCompiler compiler, LiquidProgram prog
 }
 
 int liquidParserUnparseTemplate(LiquidParser parser, LiquidTemplate tmpl, char* buffer, size_t maxSize) {
-    string unparse = static_cast<Parser*>(parser.parser)->unparse(*static_cast<Node*>(tmpl.ast));
+    string unparse = static_cast<Parser*>(parser.parser)->unparse(static_cast<Template*>(tmpl.ast)->ast);
     size_t copied = std::min(maxSize, unparse.size());
     strncpy(buffer, unparse.data(), copied);
     unparse[copied-1] = 0;
@@ -116,6 +131,170 @@ void liquidFreeProgram(LiquidProgram program) {
     delete static_cast<Program*>(program.program);
 }
 
+LiquidThemeLoader liquidCreateThemeLoader(LiquidContext context, unsigned int threads) {
+    ThemeLoader* loader = new ThemeLoader(*static_cast<Context*>(context.context));
+    loader->threads = threads;
+    return LiquidThemeLoader({ loader });
+}
+
+void liquidThemeLoaderSetOptimize(LiquidThemeLoader loader, LiquidVariableResolver resolver, void* variableStore) {
+    static_cast<ThemeLoader*>(loader.loader)->optimize = true;
+    static_cast<ThemeLoader*>(loader.loader)->resolver = resolver;
+    static_cast<ThemeLoader*>(loader.loader)->store = Variable({ variableStore });
+}
+
+void liquidThemeLoaderSetCompile(LiquidThemeLoader loader, bool compile) {
+    static_cast<ThemeLoader*>(loader.loader)->compile = compile;
+}
+
+void liquidFreeThemeLoader(LiquidThemeLoader loader) {
+    delete static_cast<ThemeLoader*>(loader.loader);
+}
+
+LiquidTheme liquidThemeLoaderLoadDirectory(LiquidThemeLoader loader, const char* directory, const char* extension) {
+    try {
+        return LiquidTheme({ new Theme(static_cast<ThemeLoader*>(loader.loader)->loadDirectory(directory, extension ? extension : ".liquid")) });
+    } catch (Liquid::Exception& exp) {
+        return LiquidTheme({ NULL });
+    }
+}
+
+LiquidTheme liquidThemeLoaderLoadFiles(LiquidThemeLoader loader, const char** paths, size_t count) {
+    return LiquidTheme({ new Theme(static_cast<ThemeLoader*>(loader.loader)->loadFiles(vector<string>(paths, paths + count))) });
+}
+
+size_t liquidGetThemeTemplateCount(LiquidTheme theme) {
+    return static_cast<Theme*>(theme.theme)->templates.size();
+}
+
+LiquidTemplate liquidGetThemeTemplate(LiquidTheme theme, const char* name) {
+    return LiquidTemplate({ const_cast<Template*>(static_cast<Theme*>(theme.theme)->getTemplate(name)) });
+}
+
+LiquidProgram liquidGetThemeProgram(LiquidTheme theme, const char* name) {
+    return LiquidProgram({ const_cast<Program*>(static_cast<Theme*>(theme.theme)->getProgram(name)) });
+}
+
+size_t liquidGetThemeErrorCount(LiquidTheme theme) {
+    return static_cast<Theme*>(theme.theme)->errors.size();
+}
+
+const char* liquidGetThemeErrorFile(LiquidTheme theme, size_t index) {
+    return static_cast<Theme*>(theme.theme)->errors[index].file.c_str();
+}
+
+void liquidGetThemeErrorMessage(LiquidTheme theme, size_t index, char* buffer, size_t maxSize) {
+    string s = static_cast<Theme*>(theme.theme)->errors[index].english();
+    strncpy(buffer, s.c_str(), maxSize - 1);
+    buffer[maxSize - 1] = 0;
+}
+
+void liquidFreeTheme(LiquidTheme theme) {
+    delete static_cast<Theme*>(theme.theme);
+}
+
+LiquidSerializer liquidCreateSerializer(LiquidContext context) {
+    return LiquidSerializer({ new Serializer(*static_cast<Context*>(context.context)) });
+}
+
+void liquidFreeSerializer(LiquidSerializer serializer) {
+    delete static_cast<Serializer*>(serializer.serializer);
+}
+
+static size_t copySerialized(const string& data, char* buffer, size_t maxSize) {
+    if (buffer)
+        memcpy(buffer, data.data(), std::min(maxSize, data.size()));
+    return data.size();
+}
+
+size_t liquidSerializerSerializeTemplate(LiquidSerializer serializer, LiquidTemplate tmpl, char* buffer, size_t maxSize) {
+    try {
+        return copySerialized(static_cast<Serializer*>(serializer.serializer)->serialize(*static_cast<Template*>(tmpl.ast)), buffer, maxSize);
+    } catch (Liquid::Exception& exp) {
+        return 0;
+    }
+}
+
+size_t liquidSerializerSerializeProgram(LiquidSerializer serializer, LiquidProgram program, char* buffer, size_t maxSize) {
+    try {
+        return copySerialized(static_cast<Serializer*>(serializer.serializer)->serialize(*static_cast<Program*>(program.program)), buffer, maxSize);
+    } catch (Liquid::Exception& exp) {
+        return 0;
+    }
+}
+
+LiquidTemplate liquidSerializerDeserializeTemplate(LiquidSerializer serializer, const char* buffer, size_t size) {
+    try {
+        return LiquidTemplate({ new Template(static_cast<Serializer*>(serializer.serializer)->deserializeTemplate(buffer, size)) });
+    } catch (Liquid::Exception& exp) {
+        return LiquidTemplate({ NULL });
+    }
+}
+
+LiquidProgram liquidSerializerDeserializeProgram(LiquidSerializer serializer, const char* buffer, size_t size) {
+    try {
+        return LiquidProgram({ new Program(static_cast<Serializer*>(serializer.serializer)->deserializeProgram(buffer, size)) });
+    } catch (Liquid::Exception& exp) {
+        return LiquidProgram({ NULL });
+    }
+}
+
+bool liquidSerializerSaveTemplate(LiquidSerializer serializer, LiquidTemplate tmpl, const char* path) {
+    try {
+        static_cast<Serializer*>(serializer.serializer)->saveTemplate(path, *static_cast<Template*>(tmpl.ast));
+    } catch (Liquid::Exception& exp) {
+        return false;
+    }
+    return true;
+}
+
+bool liquidSerializerSaveProgram(LiquidSerializer serializer, LiquidProgram program, const char* path) {
+    try {
+        static_cast<Serializer*>(serializer.serializer)->saveProgram(path, *static_cast<Program*>(program.program));
+    } catch (Liquid::Exception& exp) {
+        return false;
+    }
+    return true;
+}
+
+LiquidTemplate liquidSerializerLoadTemplate(LiquidSerializer serializer, const char* path) {
+    try {
+        return LiquidTemplate({ new Template(static_cast<Serializer*>(serializer.serializer)->loadTemplate(path)) });
+    } catch (Liquid::Exception& exp) {
+        return LiquidTemplate({ NULL });
+    }
+}
+
+LiquidProgram liquidSerializerLoadProgram(LiquidSerializer serializer, const char* path) {
+    try {
+        return LiquidProgram({ new Program(static_cast<Serializer*>(serializer.serializer)->loadProgram(path)) });
+    } catch (Liquid::Exception& exp) {
+        return LiquidProgram({ NULL });
+    }
+}
+
+LiquidJSONStore liquidCreateJSONStore(const char* buffer, size_t size) {
+    try {
+        return LiquidJSONStore({ new JSONStore(buffer, size) });
+    } catch (Liquid::Exception& exp) {
+        return LiquidJSONStore({ NULL });
+    }
+}
+
+void liquidFreeJSONStore(LiquidJSONStore store) {
+    delete static_cast<JSONStore*>(store.store);
+}
+
+void* liquidJSONStoreGetRoot(LiquidJSONStore store) {
+    return &static_cast<JSONStore*>(store.store)->root();
+}
+
+void liquidRendererSetJSONStore(LiquidRenderer renderer, LiquidJSONStore store) {
+    Renderer* rdr = static_cast<Renderer*>(renderer.renderer);
+    rdr->variableResolver = JSONStoreResolver();
+    rdr->resolverCustomData = store.store;
+}
+
 LiquidProgramRender liquidRendererRunProgram(LiquidRenderer renderer, void* variableStore, LiquidProgram program, LiquidRendererError* error) {
     if (error)
         error->type = LIQUID_RENDERER_ERROR_TYPE_NONE;
@@ -135,13 +314,13 @@ LiquidProgramRender liquidRendererRunProgram(LiquidRenderer renderer, void* vari
 
 
 LiquidTemplate liquidParserParseTemplate(LiquidParser parser, const char* buffer, size_t size, const char* file, LiquidLexerError* lexerError, LiquidParserError* parserError) {
-    Node tmpl;
+    Template tmpl;
     if (lexerError)
         lexerError->type = LiquidLexerErrorType::LIQUID_LEXER_ERROR_TYPE_NONE;
     if (parserError)
         parserError->type = LiquidParserErrorType::LIQUID_PARSER_ERROR_TYPE_NONE;
     try {
-        tmpl = static_cast<Parser*>(parser.parser)->parse(buffer, size, file ? file : "");
+        tmpl = static_cast<Parser*>(parser.parser)->parseTemplate(buffer, size, file ? file : "");
     } catch (Parser::Exception& exp) {
         if (lexerError)
             *lexerError = exp.lexerError;
@@ -149,7 +328,44 @@ LiquidTemplate liquidParserParseTemplate(LiquidParser parser, const char* buffer
             *parserError = exp.parserErrors[0];
         return LiquidTemplate({ NULL });
     }
-    return LiquidTemplate({ new Node(std::move(tmpl)) });
+    return LiquidTemplate({ new Template(std::move(tmpl)) });
+}
+
+LiquidTemplate liquidParserParseFile(LiquidParser parser, const char* path, LiquidLexerError* lexerError, LiquidParserError* parserError) {
+    Template tmpl;
+    if (lexerError)
+        lexerError->type = LiquidLexerErrorType::LIQUID_LEXER_ERROR_TYPE_NONE;
+    if (parserError)
+        parserError->type = LiquidParserErrorType::LIQUID_PARSER_ERROR_TYPE_NONE;
+    try {
+        tmpl = static_cast<Parser*>(parser.parser)->parseFile(path);
+    } catch (Parser::Exception& exp) {
+        if (lexerError)
+            *lexerError = exp.lexerError;
+        if (parserError && exp.parserErrors.size() > 0)
+            *parserError = exp.parserErrors[0];
+        return LiquidTemplate({ NULL });
+    } catch (Liquid::Exception& exp) {
+        return LiquidTemplate({ NULL });
+    }
+    return LiquidTemplate({ new Template(std::move(tmpl)) });
+}
+
+bool liquidParserReparseTemplate(LiquidParser parser, LiquidTemplate tmpl, size_t offset, size_t length, const char* replacement, size_t replacementLength, LiquidLexerError* lexerError, LiquidParserError* parserError) {
+    if (lexerError)
+        lexerError->type = LiquidLexerErrorType::LIQUID_LEXER_ERROR_TYPE_NONE;
+    if (parserError)
+        parserError->type = LiquidParserErrorType::LIQUID_PARSER_ERROR_TYPE_NONE;
+    try {
+        static_cast<Parser*>(parser.parser)->reparse(*static_cast<Template*>(tmpl.ast), offset, length, replacement, replacementLength);
+    } catch (Parser::Exception& exp) {
+        if (lexerError)
+            *lexerError = exp.lexerError;
+        if (parserError && exp.parserErrors.size() > 0)
+            *parserError = exp.parserErrors[0];
+        return false;
+    }
+    return true;
 }
 
 
@@ -166,7 +382,9 @@ LiquidTemplate liquidParserParseArgument(LiquidParser parser, const char* buffer
             *parserError = exp.parserErrors[0];
         return LiquidTemplate({ NULL });
     }
-    return LiquidTemplate({ new Node(std::move(tmpl)) });
+    Template* result = new Template();
+    result->ast = std::move(tmpl);
+    return LiquidTemplate({ result });
 }
 
 LiquidTemplate liquidParserParseAppropriate(LiquidParser parser, const char* buffer, size_t size, const char* file, LiquidLexerError* lexerError, LiquidParserError* parserError) {
@@ -182,7 +400,9 @@ LiquidTemplate liquidParserParseAppropriate(LiquidParser parser, const char* buf
             *parserError = exp.parserErrors[0];
         return LiquidTemplate({ NULL });
     }
-    return LiquidTemplate({ new Node(std::move(tmpl)) });
+    Template* result = new Template();
+    result->ast = std::move(tmpl);
+    return LiquidTemplate({ result });
 }
 
 size_t liquidGetParserWarningCount(LiquidParser parser) {
@@ -194,7 +414,7 @@ LiquidParserWarning liquidGetParserWarning(LiquidParser parser, size_t index) {
 }
 
 void liquidFreeTemplate(LiquidTemplate tmpl) {
-    delete (Node*)tmpl.ast;
+    delete (Template*)tmpl.ast;
 }
 
 LiquidTemplateRender liquidRendererRenderTemplate(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRendererError* error) {
@@ -202,7 +422,7 @@ LiquidTemplateRender liquidRendererRenderTemplate(LiquidRenderer renderer, void*
         error->type = LIQUID_RENDERER_ERROR_TYPE_NONE;
     std::string* str;
     try {
-        str = new std::string(std::move(static_cast<Renderer*>(renderer.renderer)->render(*static_cast<Node*>(tmpl.ast), Variable({ variableStore }))));
+        str = new std::string(std::move(static_cast<Renderer*>(renderer.renderer)->render(static_cast<Template*>(tmpl.ast)->ast, Variable({ variableStore }))));
     } catch (Renderer::Exception& exp) {
         if (error)
             *error = exp.rendererError;
@@ -217,7 +437,7 @@ void* liquidRendererRenderArgument(LiquidRenderer renderer, void* variableStore,
         error->type = LIQUID_RENDERER_ERROR_TYPE_NONE;
     Variable variable;
     try {
-        Variant variant = static_cast<Renderer*>(renderer.renderer)->renderArgument(*static_cast<Node*>(tmpl.ast), Variable({ variableStore }));
+        Variant variant = static_cast<Renderer*>(renderer.renderer)->renderArgument(static_cast<Template*>(tmpl.ast)->ast, Variable({ variableStore }));
         static_cast<Renderer*>(renderer.renderer)->inject(variable, variant);
 
     } catch (Renderer::Exception& exp) {
@@ -237,7 +457,7 @@ LiquidRendererWarning liquidGetRendererWarning(LiquidRenderer renderer, size_t i
 }
 
 void liquidWalkTemplate(LiquidTemplate tmpl, LiquidWalkTemplateFunction callback, void* data) {
-    static_cast<Node*>(tmpl.ast)->walk([tmpl, callback, data](const Node& node) {
+    static_cast<Template*>(tmpl.ast)->ast.walk([tmpl, callback, data](const Node& node) {
         callback(tmpl, LiquidNode { const_cast<Node*>(&node) }, data);
     });
 }
@@ -340,6 +560,27 @@ void liquidRendererSetStrictVariables(LiquidRenderer renderer, bool strict) {
 void liquidRendererSetStrictFilters(LiquidRenderer renderer, bool strict) {
     static_cast<Renderer*>(renderer.renderer)->logUnknownFilters = strict;
 }
+void liquidRendererSetScopedAssigns(LiquidRenderer renderer, bool scoped) {
+    static_cast<Renderer*>(renderer.renderer)->scopedAssigns = scoped;
+}
+void liquidRendererWriteBackScope(LiquidRenderer renderer, void* variableStore) {
+    static_cast<Renderer*>(renderer.renderer)->writeBackScope(Variable({ variableStore }));
+}
+void liquidRendererAddLayer(LiquidRenderer renderer, void* variableStore) {
+    static_cast<Renderer*>(renderer.renderer)->layers.push_back(Variable({ variableStore }));
+}
+void liquidRendererClearLayers(LiquidRenderer renderer) {
+    static_cast<Renderer*>(renderer.renderer)->layers.clear();
+}
+void liquidRendererSetMaximumMemoryUsage(LiquidRenderer renderer, unsigned int bytes) {
+    static_cast<Renderer*>(renderer.renderer)->maximumMemoryUsage = bytes;
+}
+void liquidRendererSetMaximumRenderingTime(LiquidRenderer renderer, unsigned int milliseconds) {
+    static_cast<Renderer*>(renderer.renderer)->maximumRenderingTime = milliseconds;
+}
+void liquidRendererSetMaximumRenderingSteps(LiquidRenderer renderer, unsigned long long steps) {
+    static_cast<Renderer*>(renderer.renderer)->maximumRenderingSteps = steps;
+}
 
 void liquidRendererSetReturnValueString(LiquidRenderer renderer, const char* s, int length) {
     static_cast<Renderer*>(renderer.renderer)->returnValue = move(Variant(string(s, length)));
@@ -397,3 +638,13 @@ void liquidGetRendererErrorMessage(LiquidRendererError error, char* buffer, size
     strncpy(buffer, s.c_str(), maxSize);
     buffer[maxSize] = 0;
 }
+
+// FNV-1a.
+size_t liquidHashKey(const char* key, size_t length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
@@ -32,7 +32,9 @@ extern "C" {
         LIQUID_PARSER_ERROR_TYPE_INVALID_SYMBOL,
         // Was expecting somthing else, i.e. {{ i + }}; was expecting a number there.
         LIQUID_PARSER_ERROR_TYPE_UNBALANCED_GROUP,
-        LIQUID_PARSER_ERROR_TYPE_PARSE_DEPTH_EXCEEDED
+        LIQUID_PARSER_ERROR_TYPE_PARSE_DEPTH_EXCEEDED,
+        // An edit passed to reparse that's outside the template's source, or a template that has no source to edit.
+        LIQUID_PARSER_ERROR_TYPE_INVALID_EDIT
     } LiquidParserErrorType;
 
 
@@ -59,7 +61,8 @@ extern "C" {
         LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME,
         LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_DEPTH,
         LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_VARIABLE,
-        LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER
+        LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER,
+        LIQUID_RENDERER_ERROR_TYPE_INVALID_ASSIGNMENT
     } LiquidRendererErrorType;
 
     typedef struct SLiquidRendererError {
@@ -103,6 +106,10 @@ extern "C" {
     typedef struct SLiquidNode { void* node; } LiquidNode;
     typedef struct SLiquidTemplateRender { void* internal; } LiquidTemplateRender;
     typedef struct SLiquidProgramRender { char* str; size_t len; } LiquidProgramRender;
+    typedef struct SLiquidThemeLoader { void* loader; } LiquidThemeLoader;
+    typedef struct SLiquidTheme { void* theme; } LiquidTheme;
+    typedef struct SLiquidSerializer { void* serializer; } LiquidSerializer;
+    typedef struct SLiquidJSONStore { void* store; } LiquidJSONStore;
 
     typedef enum ELiquidVariableType {
         LIQUID_VARIABLE_TYPE_NIL,
@@ -115,6 +122,23 @@ extern "C" {
         LIQUID_VARIABLE_TYPE_OTHER
     } LiquidVariableType;
 
+    // One step in a variable path, like the "variants" or [0] in product.variants[0].price.
+    typedef enum ELiquidPathSegmentType {
+        LIQUID_PATH_SEGMENT_TYPE_KEY,
+        LIQUID_PATH_SEGMENT_TYPE_INDEX
+    } LiquidPathSegmentType;
+
+    typedef struct SLiquidPathSegment {
+        LiquidPathSegmentType type;
+        // Null terminated; only set for keys.
+        const char* key;
+        size_t keyLength;
+        // Only set for keys; the key's liquidHashKey, for resolvers that keep their own hash tables.
+        size_t hash;
+        // Only set for indices.
+        long long index;
+    } LiquidPathSegment;
+
     // Convenience function to register a custom variable type.
     // Ownership model looks thusly:
     // Calling create creates a newly allocated pointer. In all cases, one of the two things must happen:
@@ -147,11 +171,31 @@ extern "C" {
         void* (*createClone)(LiquidRenderer renderer, void* value);
         void (*freeVariable)(LiquidRenderer renderer, void* value);
         int (*compare)(void* a, void* b);
+        // Optional; may be NULL. Resolves a whole path from the variable at once, rather than one getDictionaryVariable or getArrayVariable per segment.
+        // Should behave exactly as though each segment were resolved in turn, returning false if any of them fail.
+        bool (*resolvePath)(LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target);
+        // Optional; may be NULL. Points target at the contents of a string variable, without copying it. The string needn't be null terminated, and
+        // must remain valid, and unchanged, until the render finishes. Returns false if the variable isn't a string, or can't be viewed; in which case
+        // getStringLength and getString are used instead.
+        bool (*getStringView)(LiquidRenderer renderer, void* variable, const char** target, size_t* length);
+        // Optional; may be NULL. As createString, but takes a length, so that the string needn't be null terminated, and can contain nulls.
+        // If owned is true, the string was allocated with malloc, and the resolver is responsible for freeing it.
+        void* (*createStringN)(LiquidRenderer renderer, const char* str, size_t length, bool owned);
+        // Optional; may be NULL. Points targets at up to count consecutive elements of an array variable, starting at idx, as iterate would hand them
+        // to its callback; so that looping over an array takes one call per block of elements, rather than one callback per element. Returns the
+        // number of targets filled, which is only less than count at the end of the array; or -1 if the variable can't be read this way, in which
+        // case iterate is used instead.
+        long long (*getArrayVariables)(LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets);
     } LiquidVariableResolver;
 
+    // The hash given with keys in path segments; computed once, when the template's parsed, rather than on every lookup.
+    size_t liquidHashKey(const char* key, size_t length);
+
     LiquidContext liquidCreateContext();
     const char* liquidGetContextError(LiquidContext context);
     void liquidFreeContext(LiquidContext context);
+    // Makes the context immutable, and speeds up symbol lookups. Call after all dialects and types are registered; the context can then be shared across threads.
+    void liquidFreezeContext(LiquidContext context);
     void liquidImplementStrictStandardDialect(LiquidContext context);
     void liquidImplementPermissiveStandardDialect(LiquidContext context);
     #ifdef LIQUID_INCLUDE_WEB_DIALECT
@@ -164,6 +208,18 @@ extern "C" {
     LiquidRenderer liquidCreateRenderer(LiquidContext context);
     void liquidRendererSetStrictVariables(LiquidRenderer renderer, bool strict);
     void liquidRendererSetStrictFilters(LiquidRenderer renderer, bool strict);
+    // Keeps variables assigned by templates in the renderer, rather than writing them into the store; see Renderer::scopedAssigns.
+    void liquidRendererSetScopedAssigns(LiquidRenderer renderer, bool scoped);
+    // Writes the variables assigned by the last render into the top level of the store.
+    void liquidRendererWriteBackScope(LiquidRenderer renderer, void* variableStore);
+    // Adds a store beneath the one being rendered, to be consulted for any top-level variable it doesn't have; see Renderer::layers.
+    void liquidRendererAddLayer(LiquidRenderer renderer, void* variableStore);
+    void liquidRendererClearLayers(LiquidRenderer renderer);
+    // Stops a render with LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY once it's allocated more than this many bytes; 0 for no limit.
+    void liquidRendererSetMaximumMemoryUsage(LiquidRenderer renderer, unsigned int bytes);
+    // Stops a render with LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME once it's taken longer than this, or more steps than this; 0 for no limit.
+    void liquidRendererSetMaximumRenderingTime(LiquidRenderer renderer, unsigned int milliseconds);
+    void liquidRendererSetMaximumRenderingSteps(LiquidRenderer renderer, unsigned long long steps);
     void liquidRendererSetCustomData(LiquidRenderer renderer, void* data);
     void* liquidRendererGetCustomData(LiquidRenderer renderer);
     void liquidRendererSetReturnValueNil(LiquidRenderer renderer);
@@ -182,6 +238,10 @@ extern "C" {
     void liquidFreeParser(LiquidParser parser);
 
     LiquidTemplate liquidParserParseTemplate(LiquidParser parser, const char* buffer, size_t size, const char* file, LiquidLexerError* lexer, LiquidParserError* error);
+    // Parses a file; memory mapping it where possible. Returns a NULL template if the file can't be read, without setting either error.
+    LiquidTemplate liquidParserParseFile(LiquidParser parser, const char* path, LiquidLexerError* lexer, LiquidParserError* error);
+    // Replaces length bytes at offset in a template's source, and reparses only as much as it needs to. Returns false, and leaves the template untouched, on error.
+    bool liquidParserReparseTemplate(LiquidParser parser, LiquidTemplate tmpl, size_t offset, size_t length, const char* replacement, size_t replacementLength, LiquidLexerError* lexer, LiquidParserError* error);
     LiquidTemplate liquidParserParseArgument(LiquidParser parser, const char* buffer, size_t size, LiquidLexerError* lexer, LiquidParserError* error);
     LiquidTemplate liquidParserParseAppropriate(LiquidParser parser, const char* buffer, size_t size, const char* file, LiquidLexerError* lexer, LiquidParserError* error);
 
@@ -189,6 +249,8 @@ extern "C" {
 
     LiquidOptimizer liquidCreateOptimizer(LiquidRenderer renderer);
     void liquidOptimizeTemplate(LiquidOptimizer optimizer, LiquidTemplate tmpl, void* variableStore);
+    // Removes assigns and captures whose values are never read by the template. Returns the number removed.
+    size_t liquidOptimizeTemplateDeadStores(LiquidOptimizer optimizer, LiquidTemplate tmpl);
     void liquidFreeOptimizer(LiquidOptimizer optimizer);
 
     LiquidCompiler liquidCreateCompiler(LiquidContext context);
@@ -198,6 +260,51 @@ extern "C" {
     int liquidCompilerDisassembleProgram(LiquidCompiler compiler, LiquidProgram program, char* buffer, size_t maxSize);
     int liquidParserUnparseTemplate(LiquidParser parser, LiquidTemplate tmpl, char* buffer, size_t maxSize);
 
+    // Loads whole directories of templates across many threads. 0 threads uses one per hardware thread.
+    LiquidThemeLoader liquidCreateThemeLoader(LiquidContext context, unsigned int threads);
+    // Optimizes every template loaded against the store. The resolver must be safe to call from many threads at once.
+    void liquidThemeLoaderSetOptimize(LiquidThemeLoader loader, LiquidVariableResolver resolver, void* variableStore);
+    void liquidThemeLoaderSetCompile(LiquidThemeLoader loader, bool compile);
+    void liquidFreeThemeLoader(LiquidThemeLoader loader);
+    // Returns a NULL theme if the directory can't be read. Templates are named by their relative path, without the extension.
+    LiquidTheme liquidThemeLoaderLoadDirectory(LiquidThemeLoader loader, const char* directory, const char* extension);
+    // Templates are named by the paths as given.
+    LiquidTheme liquidThemeLoaderLoadFiles(LiquidThemeLoader loader, const char** paths, size_t count);
+    size_t liquidGetThemeTemplateCount(LiquidTheme theme);
+    // Templates and programs belong to the theme, and must not be freed. NULL if there's nothing by that name.
+    LiquidTemplate liquidGetThemeTemplate(LiquidTheme theme, const char* name);
+    LiquidProgram liquidGetThemeProgram(LiquidTheme theme, const char* name);
+    size_t liquidGetThemeErrorCount(LiquidTheme theme);
+    const char* liquidGetThemeErrorFile(LiquidTheme theme, size_t index);
+    void liquidGetThemeErrorMessage(LiquidTheme theme, size_t index, char* buffer, size_t maxSize);
+    void liquidFreeTheme(LiquidTheme theme);
+
+    // Saves templates and programs in a binary form that can be loaded without parsing. The context must not be modified after this is created.
+    LiquidSerializer liquidCreateSerializer(LiquidContext context);
+    void liquidFreeSerializer(LiquidSerializer serializer);
+    // Copies at most maxSize bytes into the buffer, and returns the full size; so calling with a NULL buffer and 0 size returns the size needed.
+    // Returns 0 if the template or program can't be serialized.
+    size_t liquidSerializerSerializeTemplate(LiquidSerializer serializer, LiquidTemplate tmpl, char* buffer, size_t maxSize);
+    size_t liquidSerializerSerializeProgram(LiquidSerializer serializer, LiquidProgram program, char* buffer, size_t maxSize);
+    // Return NULL if the data is malformed, fails its checksum, or was saved with a different version, or against a different dialect.
+    LiquidTemplate liquidSerializerDeserializeTemplate(LiquidSerializer serializer, const char* buffer, size_t size);
+    LiquidProgram liquidSerializerDeserializeProgram(LiquidSerializer serializer, const char* buffer, size_t size);
+    // Return false if the file can't be written.
+    bool liquidSerializerSaveTemplate(LiquidSerializer serializer, LiquidTemplate tmpl, const char* path);
+    bool liquidSerializerSaveProgram(LiquidSerializer serializer, LiquidProgram program, const char* path);
+    // As deserialization, but memory maps the file where possible. Also return NULL if the file can't be read.
+    LiquidTemplate liquidSerializerLoadTemplate(LiquidSerializer serializer, const char* path);
+    LiquidProgram liquidSerializerLoadProgram(LiquidSerializer serializer, const char* path);
+
+    // Indexes a JSON document to render against, without decoding it; values are decoded as they're read. The buffer isn't copied, and must outlive the store.
+    // Returns a NULL store if the document is malformed.
+    LiquidJSONStore liquidCreateJSONStore(const char* buffer, size_t size);
+    void liquidFreeJSONStore(LiquidJSONStore store);
+    // The document's top-level value; pass as the variable store when rendering.
+    void* liquidJSONStoreGetRoot(LiquidJSONStore store);
+    // Registers the store's resolver with the renderer. Values assigned while rendering are kept in the store, until it's freed.
+    void liquidRendererSetJSONStore(LiquidRenderer renderer, LiquidJSONStore store);
+
     LiquidProgramRender liquidRendererRunProgram(LiquidRenderer renderer, void* variableStore, LiquidProgram program, LiquidRendererError* error);
     LiquidTemplateRender liquidRendererRenderTemplate(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRendererError* error);
     void* liquidRendererRenderArgument(LiquidRenderer renderer, void* variableStore, LiquidTemplate argument, LiquidRendererError* error);
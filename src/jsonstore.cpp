@@ -0,0 +1,726 @@
+#include "jsonstore.h"
+#include "renderer.h"
+
+#include <charconv>
+#include <algorithm>
+
+namespace Liquid {
+
+    // Walks the document once, checking that it's well formed, and lays out the tape.
+    struct JSONIndexer {
+        vector<JSONStore::Value>& tape;
+        const char* start;
+        const char* p;
+        const char* end;
+
+        [[noreturn]] void fail(const char* message) {
+            throw Liquid::Exception("Unable to parse JSON; %s at offset %lu.", message, (unsigned long)(p - start));
+        }
+
+        void skipWhitespace() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+                ++p;
+        }
+
+        void expect(const char* literal, size_t length) {
+            if ((size_t)(end - p) < length || memcmp(p, literal, length) != 0)
+                fail("unexpected character");
+            p += length;
+        }
+
+        static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+        static bool isHexDigit(char c) { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
+        // Escapes are checked here, but only decoded when the string's read.
+        void escape() {
+            ++p;
+            if (p >= end)
+                fail("unterminated string");
+            switch (*p) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    ++p;
+                break;
+                case 'u':
+                    ++p;
+                    for (int i = 0; i < 4; ++i, ++p) {
+                        if (p >= end || !isHexDigit(*p))
+                            fail("invalid unicode escape");
+                    }
+                break;
+                default:
+                    fail("invalid escape");
+            }
+        }
+
+        void string(JSONStore::Value& value) {
+            value.type = LIQUID_VARIABLE_TYPE_STRING;
+            value.data = ++p;
+            while (p < end && *p != '"') {
+                if (*p == '\\') {
+                    value.pending = true;
+                    escape();
+                } else {
+                    if ((unsigned char)*p < 0x20)
+                        fail("control character in string");
+                    ++p;
+                }
+            }
+            if (p >= end)
+                fail("unterminated string");
+            value.length = p - value.data;
+            ++p;
+        }
+
+        void number(JSONStore::Value& value) {
+            value.type = LIQUID_VARIABLE_TYPE_INT;
+            value.pending = true;
+            value.data = p;
+            // As RFC 8259: an optional minus, an integer part without leading zeros, then an optional fraction and exponent, each with at least one digit.
+            if (*p == '-')
+                ++p;
+            if (p >= end || !isDigit(*p))
+                fail("invalid number");
+            if (*p++ != '0') {
+                while (p < end && isDigit(*p))
+                    ++p;
+            }
+            if (p < end && *p == '.') {
+                value.type = LIQUID_VARIABLE_TYPE_FLOAT;
+                if (++p >= end || !isDigit(*p))
+                    fail("invalid number");
+                while (p < end && isDigit(*p))
+                    ++p;
+            }
+            if (p < end && (*p == 'e' || *p == 'E')) {
+                value.type = LIQUID_VARIABLE_TYPE_FLOAT;
+                if (++p < end && (*p == '+' || *p == '-'))
+                    ++p;
+                if (p >= end || !isDigit(*p))
+                    fail("invalid number");
+                while (p < end && isDigit(*p))
+                    ++p;
+            }
+            value.length = p - value.data;
+        }
+
+        void value(unsigned int depth) {
+            if (depth > JSONStore::MAXIMUM_DEPTH)
+                fail("nested too deeply");
+            skipWhitespace();
+            if (p >= end)
+                fail("unexpected end");
+            size_t idx = tape.size();
+            tape.emplace_back();
+            switch (*p) {
+                case '{': {
+                    tape[idx].type = LIQUID_VARIABLE_TYPE_DICTIONARY;
+                    ++p;
+                    skipWhitespace();
+                    if (p < end && *p == '}') {
+                        ++p;
+                        break;
+                    }
+                    while (true) {
+                        skipWhitespace();
+                        if (p >= end || *p != '"')
+                            fail("expected a key");
+                        tape.emplace_back();
+                        string(tape.back());
+                        skipWhitespace();
+                        if (p >= end || *p != ':')
+                            fail("expected a colon");
+                        ++p;
+                        value(depth + 1);
+                        ++tape[idx].length;
+                        skipWhitespace();
+                        if (p < end && *p == ',') {
+                            ++p;
+                            continue;
+                        }
+                        if (p < end && *p == '}') {
+                            ++p;
+                            break;
+                        }
+                        fail("expected a comma, or the end of a dictionary");
+                    }
+                } break;
+                case '[': {
+                    tape[idx].type = LIQUID_VARIABLE_TYPE_ARRAY;
+                    ++p;
+                    skipWhitespace();
+                    if (p < end && *p == ']') {
+                        ++p;
+                        break;
+                    }
+                    while (true) {
+                        value(depth + 1);
+                        ++tape[idx].length;
+                        skipWhitespace();
+                        if (p < end && *p == ',') {
+                            ++p;
+                            continue;
+                        }
+                        if (p < end && *p == ']') {
+                            ++p;
+                            break;
+                        }
+                        fail("expected a comma, or the end of an array");
+                    }
+                } break;
+                case '"':
+                    string(tape[idx]);
+                break;
+                case 't':
+                    expect("true", 4);
+                    tape[idx].type = LIQUID_VARIABLE_TYPE_BOOL;
+                    tape[idx].b = true;
+                break;
+                case 'f':
+                    expect("false", 5);
+                    tape[idx].type = LIQUID_VARIABLE_TYPE_BOOL;
+                    tape[idx].b = false;
+                break;
+                case 'n':
+                    expect("null", 4);
+                break;
+                default:
+                    number(tape[idx]);
+                break;
+            }
+            tape[idx].span = tape.size() - idx;
+        }
+    };
+
+    JSONStore::JSONStore(const char* buffer, size_t size) : buffer(buffer), size(size) {
+        if (size > 0xFFFFFFFF)
+            throw Liquid::Exception("Unable to parse JSON; documents are limited to 4GB.");
+        // A modest guess at the number of values, as each entry is several times the size of the text it's usually indexed from; the tape grows
+        // as it needs to while indexing, and is trimmed once it's done.
+        tape.reserve(size / 32 + 1);
+        JSONIndexer indexer = { tape, buffer, buffer, buffer + size };
+        indexer.value(0);
+        indexer.skipWhitespace();
+        if (indexer.p != indexer.end)
+            indexer.fail("trailing characters");
+        tape.shrink_to_fit();
+    }
+
+    static int hexDigit(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    static bool parseCodepoint(const char* data, const char* end, unsigned int& codepoint) {
+        if (end - data < 4)
+            return false;
+        codepoint = 0;
+        for (int i = 0; i < 4; ++i) {
+            int digit = hexDigit(data[i]);
+            if (digit == -1)
+                return false;
+            codepoint = (codepoint << 4) | digit;
+        }
+        return true;
+    }
+
+    static size_t encodeUTF8(char* target, unsigned int codepoint) {
+        if (codepoint < 0x80) {
+            target[0] = codepoint;
+            return 1;
+        }
+        if (codepoint < 0x800) {
+            target[0] = 0xC0 | (codepoint >> 6);
+            target[1] = 0x80 | (codepoint & 0x3F);
+            return 2;
+        }
+        if (codepoint < 0x10000) {
+            target[0] = 0xE0 | (codepoint >> 12);
+            target[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+            target[2] = 0x80 | (codepoint & 0x3F);
+            return 3;
+        }
+        target[0] = 0xF0 | (codepoint >> 18);
+        target[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+        target[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+        target[3] = 0x80 | (codepoint & 0x3F);
+        return 4;
+    }
+
+    void JSONStore::Value::decode() {
+        if (!pending)
+            return;
+        pending = false;
+        const char* end = data + length;
+        if (type == LIQUID_VARIABLE_TYPE_STRING) {
+            // Unescaping only ever shortens a string.
+            char* target = new char[length];
+            size_t size = 0;
+            for (const char* c = data; c < end; ++c) {
+                if (*c != '\\' || c + 1 >= end) {
+                    target[size++] = *c;
+                    continue;
+                }
+                switch (*++c) {
+                    case 'b': target[size++] = '\b'; break;
+                    case 'f': target[size++] = '\f'; break;
+                    case 'n': target[size++] = '\n'; break;
+                    case 'r': target[size++] = '\r'; break;
+                    case 't': target[size++] = '\t'; break;
+                    case 'u': {
+                        unsigned int codepoint, low;
+                        if (!parseCodepoint(c + 1, end, codepoint)) {
+                            target[size++] = *c;
+                            break;
+                        }
+                        c += 4;
+                        if (codepoint >= 0xD800 && codepoint <= 0xDBFF && end - c > 6 && c[1] == '\\' && c[2] == 'u' && parseCodepoint(c + 3, end, low) && low >= 0xDC00 && low <= 0xDFFF) {
+                            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                            c += 6;
+                        }
+                        size += encodeUTF8(&target[size], codepoint);
+                    } break;
+                    default:
+                        target[size++] = *c;
+                    break;
+                }
+            }
+            data = target;
+            length = size;
+            owned = true;
+        } else if (type == LIQUID_VARIABLE_TYPE_INT) {
+            auto result = std::from_chars(data, end, i);
+            if (result.ec != std::errc() || result.ptr != end) {
+                type = LIQUID_VARIABLE_TYPE_FLOAT;
+                f = strtod(string(data, length).c_str(), nullptr);
+            }
+        } else if (type == LIQUID_VARIABLE_TYPE_FLOAT) {
+            auto result = std::from_chars(data, end, f);
+            if (result.ec != std::errc())
+                f = 0.0;
+        }
+    }
+
+    bool JSONStore::Value::getTruthy() {
+        decode();
+        return !(
+            (type == LIQUID_VARIABLE_TYPE_BOOL && !b) ||
+            (type == LIQUID_VARIABLE_TYPE_INT && !i) ||
+            (type == LIQUID_VARIABLE_TYPE_FLOAT && !f) ||
+            (type == LIQUID_VARIABLE_TYPE_OTHER && !p) ||
+            (type == LIQUID_VARIABLE_TYPE_NIL)
+        );
+    }
+
+    bool JSONStore::Value::getString(string& s) {
+        decode();
+        switch (type) {
+            case LIQUID_VARIABLE_TYPE_STRING:
+                s.assign(data, length);
+                return true;
+            case LIQUID_VARIABLE_TYPE_FLOAT:
+                s = std::to_string(f);
+                return true;
+            case LIQUID_VARIABLE_TYPE_INT:
+                s = std::to_string(i);
+                return true;
+            case LIQUID_VARIABLE_TYPE_BOOL:
+                s = b ? "true" : "false";
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    JSONStore::Value* JSONStore::Value::getDictionaryVariable(std::string_view key, const size_t* hash) {
+        if (type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return nullptr;
+        if (overlay) {
+            auto it = overlay->keys.find(key);
+            if (it != overlay->keys.end())
+                return it->second;
+        }
+        if (length >= INDEX_THRESHOLD) {
+            auto& slots = index().index;
+            size_t keyHash = hash ? *hash : liquidHashKey(key.data(), key.size());
+            size_t mask = slots.size() - 1;
+            for (size_t i = keyHash & mask; slots[i].key; i = (i + 1) & mask) {
+                if (slots[i].hash == keyHash && slots[i].key->getStringView() == key)
+                    return slots[i].key + 1;
+            }
+            return nullptr;
+        }
+        Value* child = this + 1;
+        for (unsigned int i = 0; i < length; ++i) {
+            if (child->getStringView() == key)
+                return child + 1;
+            child += (child + 1)->span + 1;
+        }
+        return nullptr;
+    }
+
+    JSONStore::Overlay& JSONStore::Value::index() {
+        if (!overlay)
+            overlay = make_unique<Overlay>();
+        if (!overlay->indexed) {
+            // At most half full, so probes stay short; and always with an empty slot to end them.
+            size_t size = 1;
+            while (size < (size_t)length * 2)
+                size <<= 1;
+            overlay->index.assign(size, { 0, nullptr });
+            size_t mask = size - 1;
+            Value* child = this + 1;
+            for (unsigned int i = 0; i < length; ++i, child += (child + 1)->span + 1) {
+                std::string_view key = child->getStringView();
+                size_t hash = liquidHashKey(key.data(), key.size());
+                size_t j = hash & mask;
+                // Earlier keys win, as they do when scanning.
+                while (overlay->index[j].key && !(overlay->index[j].hash == hash && overlay->index[j].key->getStringView() == key))
+                    j = (j + 1) & mask;
+                if (!overlay->index[j].key)
+                    overlay->index[j] = { hash, child };
+            }
+            overlay->indexed = true;
+        }
+        return *overlay;
+    }
+
+    JSONStore::Overlay& JSONStore::Value::table() {
+        if (!overlay)
+            overlay = make_unique<Overlay>();
+        if (!overlay->tabled) {
+            overlay->elements.reserve(length);
+            Value* child = this + 1;
+            for (unsigned int i = 0; i < length; ++i, child += child->span)
+                overlay->elements.push_back(child);
+            overlay->tabled = true;
+        }
+        return *overlay;
+    }
+
+    JSONStore::Value* JSONStore::Value::getArrayVariable(long long idx) {
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return nullptr;
+        long long size = getArraySize();
+        if (idx < 0)
+            idx += size;
+        if (idx < 0 || idx >= size)
+            return nullptr;
+        if ((overlay && overlay->tabled) || length >= INDEX_THRESHOLD)
+            return table().elements[idx];
+        Value* child = this + 1;
+        for (long long i = 0; i < idx; ++i)
+            child += child->span;
+        return child;
+    }
+
+    long long JSONStore::Value::getArrayVariables(long long idx, long long count, void** targets) {
+        long long size = getArraySize();
+        if (idx < 0)
+            idx = 0;
+        long long filled = 0;
+        if ((overlay && overlay->tabled) || length >= INDEX_THRESHOLD) {
+            vector<Value*>& elements = table().elements;
+            for (long long i = idx; i < size && filled < count; ++i)
+                targets[filled++] = elements[i];
+        } else {
+            Value* child = this + 1;
+            for (long long i = 0; i < size && filled < count; ++i, child += child->span) {
+                if (i >= idx)
+                    targets[filled++] = child;
+            }
+        }
+        return filled;
+    }
+
+    JSONStore::Value* JSONStore::createString(const char* str, size_t length) {
+        Value* value = create(LIQUID_VARIABLE_TYPE_STRING);
+        char* data = new char[length];
+        memcpy(data, str, length);
+        value->data = data;
+        value->length = length;
+        value->owned = true;
+        return value;
+    }
+
+    JSONStore::Value* JSONStore::clone(Value& value) {
+        value.decode();
+        if (value.type == LIQUID_VARIABLE_TYPE_STRING)
+            return createString(value.data, value.length);
+        Value* copy = create(value.type);
+        copy->i = value.i;
+        if (value.type == LIQUID_VARIABLE_TYPE_ARRAY) {
+            Overlay& overlay = value.table();
+            copy->overlay = make_unique<Overlay>();
+            copy->overlay->tabled = true;
+            for (Value* element : overlay.elements)
+                copy->overlay->elements.push_back(clone(*element));
+        } else if (value.type == LIQUID_VARIABLE_TYPE_DICTIONARY) {
+            // Everything the original can see, assigned or not, becomes an assigned key of the copy.
+            copy->overlay = make_unique<Overlay>();
+            Value* child = &value + 1;
+            for (unsigned int i = 0; i < value.length; ++i) {
+                std::string_view key = child->getStringView();
+                if (!copy->overlay->keys.count(key) && (!value.overlay || !value.overlay->keys.count(key)))
+                    setDictionaryVariable(*copy, key, clone(*(child + 1)));
+                child += (child + 1)->span + 1;
+            }
+            if (value.overlay) {
+                for (auto& it : value.overlay->keys)
+                    setDictionaryVariable(*copy, it.first, clone(*it.second));
+            }
+        }
+        return copy;
+    }
+
+    JSONStore::Value* JSONStore::setDictionaryVariable(Value& dictionary, std::string_view key, Value* value) {
+        if (dictionary.type == LIQUID_VARIABLE_TYPE_NIL) {
+            dictionary.type = LIQUID_VARIABLE_TYPE_DICTIONARY;
+            dictionary.length = 0;
+        }
+        if (dictionary.type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return nullptr;
+        if (!dictionary.overlay)
+            dictionary.overlay = make_unique<Overlay>();
+        auto it = dictionary.overlay->keys.find(key);
+        if (it != dictionary.overlay->keys.end()) {
+            it->second = value;
+        } else {
+            dictionary.overlay->names.emplace_back(key);
+            dictionary.overlay->keys.emplace(dictionary.overlay->names.back(), value);
+        }
+        return value;
+    }
+
+    JSONStore::Value* JSONStore::setArrayVariable(Value& array, long long idx, Value* value) {
+        if (array.type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return nullptr;
+        vector<Value*>& elements = array.table().elements;
+        if (idx < 0)
+            idx += elements.size();
+        if (idx < 0)
+            return nullptr;
+        while ((long long)elements.size() <= idx)
+            elements.push_back(create(LIQUID_VARIABLE_TYPE_NIL));
+        elements[idx] = value;
+        return value;
+    }
+
+    static JSONStore& getStore(LiquidRenderer renderer) {
+        assert(static_cast<Renderer*>(renderer.renderer)->resolverCustomData);
+        return *static_cast<JSONStore*>(static_cast<Renderer*>(renderer.renderer)->resolverCustomData);
+    }
+
+    static JSONStore::Value& getValue(void* variable) { return *static_cast<JSONStore::Value*>(variable); }
+
+    LiquidVariableType JSONStoreResolver::Static::getType(void* variable) {
+        getValue(variable).decode();
+        return getValue(variable).type;
+    }
+
+    bool JSONStoreResolver::Static::getBool(void* variable, bool& target) {
+        if (getValue(variable).type != LIQUID_VARIABLE_TYPE_BOOL)
+            return false;
+        target = getValue(variable).b;
+        return true;
+    }
+
+    bool JSONStoreResolver::Static::getInteger(void* variable, long long& target) {
+        getValue(variable).decode();
+        if (getValue(variable).type != LIQUID_VARIABLE_TYPE_INT)
+            return false;
+        target = getValue(variable).i;
+        return true;
+    }
+
+    bool JSONStoreResolver::Static::getFloat(void* variable, double& target) {
+        getValue(variable).decode();
+        if (getValue(variable).type != LIQUID_VARIABLE_TYPE_FLOAT)
+            return false;
+        target = getValue(variable).f;
+        return true;
+    }
+
+    bool JSONStoreResolver::Static::getStringView(void* variable, const char*& target, size_t& length) {
+        if (getValue(variable).type != LIQUID_VARIABLE_TYPE_STRING)
+            return false;
+        std::string_view view = getValue(variable).getStringView();
+        target = view.data();
+        length = view.size();
+        return true;
+    }
+
+    bool JSONStoreResolver::Static::getDictionaryVariable(void* variable, const string& key, void*& target) {
+        JSONStore::Value* value = getValue(variable).getDictionaryVariable(key);
+        if (!value)
+            return false;
+        target = value;
+        return true;
+    }
+
+    bool JSONStoreResolver::Static::getArrayVariable(void* variable, long long idx, void*& target) {
+        JSONStore::Value* value = getValue(variable).getArrayVariable(idx);
+        if (!value)
+            return false;
+        target = value;
+        return true;
+    }
+
+    JSONStoreResolver::JSONStoreResolver() {
+        getType = +[](LiquidRenderer renderer, void* variable) { return Static::getType(variable); };
+        getBool = +[](LiquidRenderer renderer, void* variable, bool* target) { return Static::getBool(variable, *target); };
+        getTruthy = +[](LiquidRenderer renderer, void* variable) { return getValue(variable).getTruthy(); };
+        getString = +[](LiquidRenderer renderer, void* variable, char* target) {
+            JSONStore::Value& value = getValue(variable);
+            if (value.type == LIQUID_VARIABLE_TYPE_STRING) {
+                std::string_view view = value.getStringView();
+                memcpy(target, view.data(), view.size());
+                target[view.size()] = 0;
+                return true;
+            }
+            string s;
+            if (!value.getString(s))
+                return false;
+            strcpy(target, s.data());
+            return true;
+        };
+        getStringLength = +[](LiquidRenderer renderer, void* variable) {
+            JSONStore::Value& value = getValue(variable);
+            if (value.type == LIQUID_VARIABLE_TYPE_STRING)
+                return (long long)value.getStringView().size();
+            string s;
+            if (!value.getString(s))
+                return -1LL;
+            return (long long)s.size();
+        };
+        getInteger = +[](LiquidRenderer renderer, void* variable, long long* target) { return Static::getInteger(variable, *target); };
+        getFloat = +[](LiquidRenderer renderer, void* variable, double* target) { return Static::getFloat(variable, *target); };
+        getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
+            JSONStore::Value* value = getValue(variable).getDictionaryVariable(key);
+            if (!value)
+                return false;
+            *target = value;
+            return true;
+        };
+        getArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void** target) { return Static::getArrayVariable(variable, idx, *target); };
+        iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+            JSONStore::Value& value = getValue(variable);
+            if (value.type != LIQUID_VARIABLE_TYPE_ARRAY)
+                return false;
+            int size = (int)value.getArraySize();
+            if (limit < 0)
+                limit = size + limit + 1;
+            if (start < 0)
+                start = 0;
+            int endIndex = std::min(start + limit - 1, size - 1);
+            if (reverse || (value.overlay && value.overlay->tabled)) {
+                // Copied, so that the template changing the array while it's iterated over doesn't affect the iteration.
+                vector<JSONStore::Value*> elements = value.table().elements;
+                if (reverse) {
+                    for (int i = endIndex; i >= start; --i) {
+                        if (!callback(elements[i], data))
+                            break;
+                    }
+                } else {
+                    for (int i = start; i <= endIndex; ++i) {
+                        if (!callback(elements[i], data))
+                            break;
+                    }
+                }
+            } else {
+                // The document can't change, so the tape can be walked directly.
+                JSONStore::Value* child = &value + 1;
+                for (int i = 0; i <= endIndex; ++i, child += child->span) {
+                    if (i >= start && !callback(child, data))
+                        break;
+                }
+            }
+            return true;
+        };
+        getArraySize = +[](LiquidRenderer renderer, void* variable) {
+            JSONStore::Value& value = getValue(variable);
+            return value.type == LIQUID_VARIABLE_TYPE_ARRAY ? value.getArraySize() : -1LL;
+        };
+        getArrayVariables = +[](LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) {
+            JSONStore::Value& value = getValue(variable);
+            return value.type == LIQUID_VARIABLE_TYPE_ARRAY ? value.getArrayVariables(idx, count, targets) : -1LL;
+        };
+        setDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void* target) {
+            return (void*)getStore(renderer).setDictionaryVariable(getValue(variable), key, static_cast<JSONStore::Value*>(target));
+        };
+        setArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void* target) {
+            return (void*)getStore(renderer).setArrayVariable(getValue(variable), idx, static_cast<JSONStore::Value*>(target));
+        };
+
+        createHash = +[](LiquidRenderer renderer) { return (void*)getStore(renderer).create(LIQUID_VARIABLE_TYPE_DICTIONARY); };
+        createArray = +[](LiquidRenderer renderer) {
+            JSONStore::Value* value = getStore(renderer).create(LIQUID_VARIABLE_TYPE_ARRAY);
+            value->table();
+            return (void*)value;
+        };
+        createFloat = +[](LiquidRenderer renderer, double f) {
+            JSONStore::Value* value = getStore(renderer).create(LIQUID_VARIABLE_TYPE_FLOAT);
+            value->f = f;
+            return (void*)value;
+        };
+        createBool = +[](LiquidRenderer renderer, bool b) {
+            JSONStore::Value* value = getStore(renderer).create(LIQUID_VARIABLE_TYPE_BOOL);
+            value->b = b;
+            return (void*)value;
+        };
+        createInteger = +[](LiquidRenderer renderer, long long i) {
+            JSONStore::Value* value = getStore(renderer).create(LIQUID_VARIABLE_TYPE_INT);
+            value->i = i;
+            return (void*)value;
+        };
+        createString = +[](LiquidRenderer renderer, const char* str) { return (void*)getStore(renderer).createString(str, strlen(str)); };
+        createStringN = +[](LiquidRenderer renderer, const char* str, size_t length, bool owned) {
+            JSONStore::Value* value = getStore(renderer).createString(str, length);
+            if (owned)
+                free((void*)str);
+            return (void*)value;
+        };
+        createPointer = +[](LiquidRenderer renderer, void* p) {
+            JSONStore::Value* value = getStore(renderer).create(LIQUID_VARIABLE_TYPE_OTHER);
+            value->p = p;
+            return (void*)value;
+        };
+        createNil = +[](LiquidRenderer renderer) { return (void*)getStore(renderer).create(LIQUID_VARIABLE_TYPE_NIL); };
+        createClone = +[](LiquidRenderer renderer, void* variable) { return (void*)getStore(renderer).clone(getValue(variable)); };
+        // Everything belongs to the store.
+        freeVariable = +[](LiquidRenderer renderer, void* variable) { };
+
+        compare = +[](void* a, void* b) {
+            JSONStore::Value& first = getValue(a);
+            JSONStore::Value& second = getValue(b);
+            first.decode();
+            second.decode();
+            if (first.type != second.type)
+                return 0;
+            switch (first.type) {
+                case LIQUID_VARIABLE_TYPE_INT:
+                    return first.i < second.i ? -1 : 0;
+                case LIQUID_VARIABLE_TYPE_FLOAT:
+                    return first.f < second.f ? -1 : 0;
+                case LIQUID_VARIABLE_TYPE_STRING:
+                    return first.getStringView() < second.getStringView() ? -1 : 0;
+                default:
+                    return 0;
+            }
+        };
+        getStringView = +[](LiquidRenderer renderer, void* variable, const char** target, size_t* length) { return Static::getStringView(variable, *target, *length); };
+        resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+            JSONStore::Value* current = static_cast<JSONStore::Value*>(variable);
+            for (size_t i = 0; i < count && current; ++i)
+                current = segments[i].type == LIQUID_PATH_SEGMENT_TYPE_INDEX ? current->getArrayVariable(segments[i].index) : current->getDictionaryVariable(std::string_view(segments[i].key, segments[i].keyLength), &segments[i].hash);
+            if (!current)
+                return false;
+            *target = current;
+            return true;
+        };
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef LIQUIDJSONSTORE_H
+#define LIQUIDJSONSTORE_H
+
+#include "common.h"
+#include "context.h"
+
+#include <string_view>
+#include <deque>
+
+namespace Liquid {
+
+    // A variable store over a JSON document, that doesn't build a DOM. Construction only indexes the document: every value gets one entry on
+    // a tape, in document order, with a container's contents directly following it. Nothing is decoded until it's read; numbers are parsed, and
+    // strings with escapes unescaped, on first access, and strings without escapes are viewed straight out of the buffer, which isn't copied, and
+    // must outlive the store. Large dictionaries get a hash of their keys, and large arrays a table of their elements, the first time they're searched.
+    // Values assigned while rendering are kept in the store, and shadow the document's; the document itself is never changed.
+    // Throws a Liquid::Exception if the document is malformed.
+    struct JSONStore {
+        // Much deeper than any sensible payload; stops a malicious one from exhausting the stack.
+        static constexpr unsigned int MAXIMUM_DEPTH = 512;
+        // Containers with fewer entries than this are scanned, rather than hashed or tabled.
+        static constexpr unsigned int INDEX_THRESHOLD = 16;
+
+        struct Value;
+
+        struct Overlay {
+            // Keys assigned while rendering.
+            std::deque<string> names;
+            unordered_map<std::string_view, Value*> keys;
+            // The document's keys, once hashed; open addressed, by liquidHashKey, so that a compiled path's hashes can be used as they are.
+            struct Slot {
+                size_t hash;
+                // The key's entry on the tape; its value follows it.
+                Value* key;
+            };
+            vector<Slot> index;
+            bool indexed = false;
+            // An array's elements, once tabled; which they are as soon as the array is changed.
+            vector<Value*> elements;
+            bool tabled = false;
+        };
+
+        struct Value {
+            LiquidVariableType type;
+            // Numbers that haven't been parsed yet, and strings that haven't been unescaped yet.
+            bool pending = false;
+            // Whether data was allocated by the store.
+            bool owned = false;
+            // The length of a string or number token; or the number of elements, or key-value pairs, in a container.
+            unsigned int length = 0;
+            // The number of tape entries this value covers, including itself.
+            unsigned int span = 1;
+            // The contents of a string, without quotes, or the text of a number.
+            const char* data = nullptr;
+            union {
+                bool b;
+                long long i;
+                double f;
+                void* p;
+            };
+            unique_ptr<Overlay> overlay;
+
+            Value(LiquidVariableType type = LIQUID_VARIABLE_TYPE_NIL) : type(type), i(0) { }
+            Value(const Value&) = delete;
+            Value(Value&& value) : type(value.type), pending(value.pending), owned(value.owned), length(value.length), span(value.span), data(value.data), i(value.i), overlay(move(value.overlay)) {
+                value.owned = false;
+            }
+            ~Value() { if (owned) delete[] data; }
+
+            bool isContainer() const { return type == LIQUID_VARIABLE_TYPE_ARRAY || type == LIQUID_VARIABLE_TYPE_DICTIONARY; }
+            // Parses or unescapes the value, if it hasn't been already. An integer too large to be held becomes a float.
+            void decode();
+            std::string_view getStringView() { decode(); return std::string_view(data, length); }
+            bool getTruthy();
+            bool getString(string& s);
+
+            // If given, hash is the key's liquidHashKey; it's only needed for large dictionaries.
+            Value* getDictionaryVariable(std::string_view key, const size_t* hash = nullptr);
+            Value* getArrayVariable(long long idx);
+            // Fills targets with up to count elements, from idx; returns how many it filled.
+            long long getArrayVariables(long long idx, long long count, void** targets);
+            long long getArraySize() const { return overlay && overlay->tabled ? (long long)overlay->elements.size() : (long long)length; }
+            // Builds the table of an array's elements.
+            Overlay& table();
+            // Builds the hash of a dictionary's keys.
+            Overlay& index();
+        };
+
+        const char* buffer;
+        size_t size;
+        // Never resized once built, so values can be pointed to.
+        vector<Value> tape;
+        // Values created while rendering.
+        std::deque<Value> created;
+
+        JSONStore(const char* buffer, size_t size);
+        JSONStore(const JSONStore&) = delete;
+        JSONStore& operator = (const JSONStore&) = delete;
+
+        Value& root() { return tape[0]; }
+        operator Variable () { return Variable({ &tape[0] }); }
+
+        Value* create(LiquidVariableType type) {
+            created.emplace_back(type);
+            return &created.back();
+        }
+        Value* createString(const char* str, size_t length);
+        Value* clone(Value& value);
+        // Assigns a key in a dictionary, shadowing any the document had. A nil becomes an empty dictionary first.
+        Value* setDictionaryVariable(Value& dictionary, std::string_view key, Value* value);
+        // Sets an element of an array, padding it with nils if it's past the end.
+        Value* setArrayVariable(Value& array, long long idx, Value* value);
+    };
+
+    // The store must be set as the renderer's resolverCustomData.
+    struct JSONStoreResolver : LiquidVariableResolver {
+        // For StaticRenderer.
+        struct Static {
+            static LiquidVariableType getType(void* variable);
+            static bool getBool(void* variable, bool& target);
+            static bool getInteger(void* variable, long long& target);
+            static bool getFloat(void* variable, double& target);
+            static bool getStringView(void* variable, const char*& target, size_t& length);
+            static bool getDictionaryVariable(void* variable, const string& key, void*& target);
+            static bool getArrayVariable(void* variable, long long idx, void*& target);
+        };
+
+        JSONStoreResolver();
+    };
+}
+
+#endif
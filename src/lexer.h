@@ -221,19 +221,39 @@ namespace Liquid {
         }
 
         // Must be a whole file, for now. Should be null-terminated. Treats it as UTF8.
-        Error parse(const char* str, size_t size, Lexer::State initialState = State::INITIAL) {
+        // The initial line and column can be specified when lexing a fragment that starts partway through a file.
+        Error parse(const char* str, size_t size, Lexer::State initialState = State::INITIAL, size_t initialLine = 1, size_t initialColumn = 0) {
             size_t offset = 0;
             size_t lastInitial = 0;
             size_t i;
             bool ongoing = true;
-            line = 1;
+            line = initialLine;
             const char* end = str+size;
-            column = 0;
+            column = initialColumn;
             state = initialState;
             while (ongoing && offset < size) {
                 ++column;
                 switch (state) {
                     case State::INITIAL:
+                        // Most of a template is usually raw text, so skip straight to the next brace, unless we're right after one.
+                        // memchr is vectorized by every libc worth mentioning, so this is much faster than going byte by byte.
+                        if (str[offset] != '{' && (offset == 0 || str[offset-1] != '{')) {
+                            const char* target = (const char*)memchr(&str[offset], '{', size - offset);
+                            if (!target)
+                                target = end;
+                            // Each byte counts for two columns here; newlines still need to be reported one at a time.
+                            // Counted from where the current line's run starts, rather than the newline before it, which could be before the buffer.
+                            const char* lineStart = &str[offset];
+                            for (const char* newline = (const char*)memchr(lineStart, '\n', target - lineStart); newline; newline = (const char*)memchr(lineStart, '\n', target - lineStart)) {
+                                column += 2*(newline - lineStart);
+                                static_cast<T*>(this)->newline();
+                                column = 2;
+                                lineStart = newline + 1;
+                            }
+                            column += 2*(target - lineStart) - 1;
+                            offset = (size_t)(target - str);
+                            break;
+                        }
                         switch (str[offset]) {
                             case '\n': {
                                 static_cast<T*>(this)->newline();
@@ -393,7 +413,7 @@ namespace Liquid {
                                             ongoing = processControlChunk(&str[startOfWord], offset - startOfWord - (str[offset-2] == '-' ? 2 : 1), isNumber, hasPoint) && static_cast<T*>(this)->endControlBlock(str[offset-2] == '-');
                                             size_t new_offset;
                                             if (str[offset-2] == '-')
-                                                new_offset = (size_t)(nextBoundary(&str[offset+1], end) - str);
+                                                new_offset = (size_t)(nextBoundary(&str[offset+1], end, true) - str);
                                             else
                                                 new_offset = offset + 1;
                                             column += new_offset - offset;
@@ -405,7 +425,7 @@ namespace Liquid {
                                         if (str[offset-1] == '}') {
                                             ongoing = processControlChunk(&str[startOfWord], offset - startOfWord - (str[offset-2] == '-' ? 2 : 1), isNumber, hasPoint) && static_cast<T*>(this)->endOutputBlock(str[offset-2] == '-');
                                             if (str[offset-2] == '-')
-                                                new_offset = (size_t)(nextBoundary(&str[offset+1], end) - str);
+                                                new_offset = (size_t)(nextBoundary(&str[offset+1], end, true) - str);
                                             else
                                                 new_offset = offset + 1;
                                             column += new_offset - offset;
@@ -490,7 +510,7 @@ namespace Liquid {
                                         ++offset;
                                         ++column;
                                         if (hasSuppressed) {
-                                            size_t new_offset = (size_t)(nextBoundary(&str[offset], end) - str);
+                                            size_t new_offset = (size_t)(nextBoundary(&str[offset], end, true) - str);
                                             column = new_offset - offset;
                                             offset = new_offset;
                                         }
@@ -5,6 +5,10 @@
     #include "parser.h"
     #include "renderer.h"
     #include "dialect.h"
+    #include "loader.h"
+    #include "serializer.h"
     #include "cppvariable.h"
+    #include "compactvariable.h"
+    #include "jsonstore.h"
 #endif
 #include "interface.h"
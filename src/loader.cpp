@@ -0,0 +1,136 @@
+#include "loader.h"
+#include "context.h"
+#include "renderer.h"
+#include "optimizer.h"
+
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <algorithm>
+
+namespace Liquid {
+
+    string Theme::Error::english() const {
+        if (parserError)
+            return file + ": " + Parser::Error::english(parserError);
+        if (lexerError)
+            return file + ": " + Parser::Lexer::Error::english(lexerError);
+        return file + ": " + message;
+    }
+
+    const Template* Theme::getTemplate(const string& name) const {
+        auto it = templates.find(name);
+        return it != templates.end() ? &it->second : nullptr;
+    }
+
+    const Program* Theme::getProgram(const string& name) const {
+        auto it = programs.find(name);
+        return it != programs.end() ? &it->second : nullptr;
+    }
+
+    Theme ThemeLoader::loadDirectory(const string& directory, const string& extension) {
+        namespace fs = std::filesystem;
+        std::error_code code;
+        vector<pair<string, string>> files;
+        fs::recursive_directory_iterator it(directory, code), end;
+        if (code)
+            throw Liquid::Exception("Unable to read directory %s.", directory.c_str());
+        for (; it != end; it.increment(code)) {
+            if (code)
+                throw Liquid::Exception("Unable to read directory %s.", directory.c_str());
+            const string path = it->path().string();
+            if (!it->is_regular_file(code) || path.size() < extension.size() || path.compare(path.size() - extension.size(), extension.size(), extension) != 0)
+                continue;
+            string name = it->path().lexically_relative(directory).generic_string();
+            name.resize(name.size() - extension.size());
+            files.emplace_back(move(name), path);
+        }
+        // Directory order is arbitrary; sort so that errors come out in the same order every time.
+        std::sort(files.begin(), files.end());
+        vector<string> names, paths;
+        for (auto& file : files) {
+            names.push_back(move(file.first));
+            paths.push_back(move(file.second));
+        }
+        return loadFiles(paths, names);
+    }
+
+    Theme ThemeLoader::loadFiles(const vector<string>& paths) {
+        return loadFiles(paths, paths);
+    }
+
+    Theme ThemeLoader::loadFiles(const vector<string>& paths, const vector<string>& names) {
+        assert(paths.size() == names.size());
+        struct Result {
+            Template tmpl;
+            Program program;
+            bool loaded = false;
+            bool compiled = false;
+            vector<Theme::Error> errors;
+        };
+        vector<Result> results(paths.size());
+        std::atomic<size_t> next(0);
+
+        // Each thread takes the next file in line until there are none left; so one large file doesn't hold up a whole share of the rest.
+        auto work = [&]() {
+            Parser parser(context);
+            unique_ptr<Renderer> renderer;
+            unique_ptr<Optimizer> optimizer;
+            unique_ptr<Compiler> compiler;
+            if (optimize) {
+                renderer = make_unique<Renderer>(context, resolver);
+                optimizer = make_unique<Optimizer>(*renderer.get());
+            }
+            if (compile)
+                compiler = make_unique<Compiler>(context);
+            for (size_t i = next++; i < paths.size(); i = next++) {
+                Result& result = results[i];
+                try {
+                    result.tmpl = parser.parseFile(paths[i]);
+                } catch (Parser::Exception& exception) {
+                    for (auto& error : exception.parserErrors)
+                        result.errors.emplace_back(paths[i], error);
+                    if (exception.lexerError)
+                        result.errors.emplace_back(paths[i], exception.lexerError);
+                    continue;
+                } catch (std::exception& exception) {
+                    result.errors.emplace_back(paths[i], string(exception.what()));
+                    continue;
+                }
+                for (auto& error : parser.errors)
+                    result.errors.emplace_back(paths[i], error);
+                result.loaded = true;
+                try {
+                    if (optimizer)
+                        optimizer->optimize(result.tmpl.ast, store);
+                    if (compiler) {
+                        result.program = compiler->compile(result.tmpl.ast);
+                        result.compiled = true;
+                    }
+                } catch (std::exception& exception) {
+                    result.errors.emplace_back(paths[i], string(exception.what()));
+                }
+            }
+        };
+
+        size_t threadCount = threads ? threads : std::max(std::thread::hardware_concurrency(), 1U);
+        threadCount = std::min(threadCount, paths.size());
+        vector<std::thread> pool;
+        for (size_t i = 1; i < threadCount; ++i)
+            pool.emplace_back(work);
+        work();
+        for (auto& thread : pool)
+            thread.join();
+
+        Theme theme;
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].loaded)
+                theme.templates[names[i]] = move(results[i].tmpl);
+            if (results[i].compiled)
+                theme.programs[names[i]] = move(results[i].program);
+            for (auto& error : results[i].errors)
+                theme.errors.push_back(move(error));
+        }
+        return theme;
+    }
+}
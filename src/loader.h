@@ -0,0 +1,64 @@
+#ifndef LIQUIDLOADER_H
+#define LIQUIDLOADER_H
+
+#include "common.h"
+#include "parser.h"
+#include "compiler.h"
+
+namespace Liquid {
+    struct Context;
+
+    // A set of templates, keyed by name, along with everything that went wrong loading them.
+    struct Theme {
+        struct Error {
+            // The path of the file the error came from.
+            string file;
+            // At most one of these is set; if neither is, the file couldn't be read, or failed to optimize or compile, and message says why.
+            Parser::Error parserError;
+            Parser::Lexer::Error lexerError;
+            string message;
+
+            Error(const string& file, const Parser::Error& parserError) : file(file), parserError(parserError) { }
+            Error(const string& file, const Parser::Lexer::Error& lexerError) : file(file), lexerError(lexerError) { }
+            Error(const string& file, const string& message) : file(file), message(message) { }
+
+            string english() const;
+        };
+
+        unordered_map<string, Template> templates;
+        // Only populated if the loader was set to compile.
+        unordered_map<string, Program> programs;
+        // Includes non-fatal parser errors from files that did load.
+        vector<Error> errors;
+
+        const Template* getTemplate(const string& name) const;
+        const Program* getProgram(const string& name) const;
+    };
+
+    // Loads many templates at once, spread across a pool of threads, each with its own parser, and optionally optimizer and compiler.
+    // The context is shared between all threads, and so must not be modified while loading.
+    struct ThemeLoader {
+        const Context& context;
+
+        // The amount of threads to use. 0 uses one per hardware thread.
+        unsigned int threads = 0;
+        // If set, each template is optimized against the store, through the resolver. The resolver must be safe to call from many threads at once, on the same store.
+        bool optimize = false;
+        LiquidVariableResolver resolver = { };
+        Variable store;
+        // If set, each template is also compiled into a program.
+        bool compile = false;
+
+        ThemeLoader(const Context& context) : context(context) { }
+
+        // Loads every file in the directory, and all its subdirectories, ending with the extension. Throws a Liquid::Exception if the directory can't be read.
+        // Templates are named by their path relative to the directory, with the extension removed; so "snippets/header.liquid" becomes "snippets/header".
+        Theme loadDirectory(const string& directory, const string& extension = ".liquid");
+        // Loads each file, named exactly as given.
+        Theme loadFiles(const vector<string>& paths);
+        // Loads each file, under the name at the same index.
+        Theme loadFiles(const vector<string>& paths, const vector<string>& names);
+    };
+}
+
+#endif
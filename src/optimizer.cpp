@@ -1,13 +1,15 @@
 #include "optimizer.h"
 #include "renderer.h"
+#include "context.h"
 
 namespace Liquid {
 
     Optimizer::Optimizer(Renderer& renderer) : renderer(renderer) {
-        renderer.currentRenderingDepth = 0;
+        renderer.resetLimits();
     }
 
     void Optimizer::optimize(Node& ast, Variable store) {
+        Node::ResourceScope scope(renderer.memoryResource);
         bool hasAnyNonRendered = false;
         if (!ast.type || ast.type->optimization == LIQUID_OPTIMIZATION_SCHEME_SHIELD)
             return;
@@ -34,3 +36,152 @@ namespace Liquid {
         }
     }
 }
+
+namespace Liquid {
+
+    struct DeadStoreAnalysis {
+        const Context& context;
+        const NodeType* assignType;
+        const NodeType* captureType;
+        // Tags that alter control flow within a block; a store can't be considered overwritten past one of these.
+        unordered_set<const NodeType*> jumpTypes;
+        // Tags whose only access to the store is through the variables they contain.
+        unordered_set<const NodeType*> transparentTypes;
+        unordered_set<string> reads;
+        bool opaque = false;
+
+        DeadStoreAnalysis(const Context& context) : context(context) {
+            assignType = context.getTagType("assign");
+            captureType = context.getTagType("capture");
+            for (auto symbol : { "break", "continue" }) {
+                if (const NodeType* type = context.getTagType(symbol))
+                    jumpTypes.insert(type);
+            }
+            for (auto symbol : { "assign", "capture", "increment", "decrement", "comment", "raw", "if", "unless", "case", "for", "cycle", "break", "continue" }) {
+                if (const TagNodeType* type = context.getTagType(symbol)) {
+                    transparentTypes.insert(type);
+                    for (auto& it : type->intermediates)
+                        transparentTypes.insert(it.second.get());
+                }
+            }
+        }
+
+        // Returns the variable node targeted by an assign or capture, if this node is one.
+        const Node* getTarget(const Node& node) const {
+            if (!node.type || (node.type != assignType && node.type != captureType) || node.children.empty())
+                return nullptr;
+            const Node* argumentNode = node.children.front().get();
+            if (!argumentNode->type || argumentNode->children.empty())
+                return nullptr;
+            const Node* target = argumentNode->children.front().get();
+            if (node.type == assignType) {
+                if (!target->type || target->children.empty())
+                    return nullptr;
+                target = target->children.front().get();
+            }
+            return target->type && target->type->type == NodeType::Type::VARIABLE ? target : nullptr;
+        }
+
+        // If the variable node is a plain, single segment name, returns true and fills out name.
+        static bool getName(const Node& variableNode, string& name) {
+            if (variableNode.children.size() == 0 || variableNode.children.front()->type)
+                return false;
+            const Variant& variant = variableNode.children.front()->variant;
+            if (variant.type != Variant::Type::STRING && variant.type != Variant::Type::STRING_VIEW)
+                return false;
+            name = variant.getString();
+            return true;
+        }
+
+        // Returns the name of the whole variable that the node stores to, if this node is an assign or capture.
+        bool getStoreName(const Node& node, string& name) const {
+            const Node* target = getTarget(node);
+            return target && target->children.size() == 1 && getName(*target, name);
+        }
+
+        void collect(const Node& node, const Node* skip = nullptr) {
+            if (!node.type || &node == skip)
+                return;
+            if (node.type->type == NodeType::Type::TAG && !transparentTypes.count(node.type))
+                opaque = true;
+            if (node.type->type == NodeType::Type::VARIABLE) {
+                string name;
+                if (getName(node, name))
+                    reads.insert(move(name));
+                else
+                    opaque = true;
+            }
+            string name;
+            if (getStoreName(node, name))
+                skip = getTarget(node);
+            for (auto& child : node.children)
+                collect(*child.get(), skip);
+        }
+
+        // Whether or not this node could read the variable, or jump somewhere that could.
+        bool observes(const Node& node, const string& name, const Node* skip = nullptr) const {
+            if (!node.type || &node == skip)
+                return false;
+            if (jumpTypes.count(node.type))
+                return true;
+            if (node.type->type == NodeType::Type::VARIABLE) {
+                string read;
+                if (!getName(node, read) || read == name)
+                    return true;
+            }
+            for (auto& child : node.children) {
+                if (observes(*child.get(), name, skip))
+                    return true;
+            }
+            return false;
+        }
+
+        bool isDead(const Node& parent, size_t idx, const string& name) const {
+            if (!reads.count(name))
+                return true;
+            for (size_t i = idx + 1; i < parent.children.size(); ++i) {
+                const Node& sibling = *parent.children[i].get();
+                string target;
+                if (getStoreName(sibling, target) && target == name)
+                    return !observes(sibling, name, getTarget(sibling));
+                if (observes(sibling, name))
+                    return false;
+            }
+            return false;
+        }
+
+        size_t remove(Node& node) {
+            if (!node.type)
+                return 0;
+            size_t removed = 0;
+            for (auto& child : node.children)
+                removed += remove(*child.get());
+            if (node.type == context.getConcatenationNodeType()) {
+                string name;
+                for (size_t i = 0; i < node.children.size(); ++i) {
+                    if (getStoreName(*node.children[i].get(), name) && isDead(node, i, name)) {
+                        node.children.erase(node.children.begin() + i--);
+                        ++removed;
+                    }
+                }
+            }
+            return removed;
+        }
+    };
+
+    size_t Optimizer::removeDeadStores(Node& ast) {
+        size_t total = 0;
+        // Removing a store may remove the only read of another; so keep going until nothing changes.
+        while (true) {
+            DeadStoreAnalysis analysis(renderer.context);
+            analysis.collect(ast);
+            if (analysis.opaque)
+                break;
+            size_t removed = analysis.remove(ast);
+            if (removed == 0)
+                break;
+            total += removed;
+        }
+        return total;
+    }
+}
@@ -12,6 +12,14 @@ namespace Liquid {
 
         Optimizer(Renderer& renderer);
         void optimize(Node& ast, Variable store);
+
+        // Removes {% assign %} and {% capture %} tags whose values can never be observed by the template; either because the variable
+        // is never read at all, or because it's unconditionally overwritten before anything could read it. Only whole-variable targets are considered.
+        // This is conservative; if the template contains a tag outside of the standard dialect (like an {% include %}, which could read anything), or
+        // a variable whose name can't be determined at parse time, nothing is removed. As the removed stores will no longer show up in the variable store,
+        // don't use this on templates that are themselves included by others, or whose store is inspected after rendering.
+        // Returns the number of tags removed.
+        size_t removeDeadStores(Node& ast);
     };
 }
 
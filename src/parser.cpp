@@ -1,8 +1,21 @@
 #include "context.h"
 #include "parser.h"
 
+#include <cstdio>
+#include <algorithm>
+#if defined(__unix__) || defined(__APPLE__)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
 namespace Liquid {
 
+    Parser::Parser(const Context& context) : context(context), lexer(context, *this) {
+        memoryResource = context.memoryResource;
+    }
+
     bool Parser::Lexer::colon() {
         if (parser.state == Parser::State::IGNORE_UNTIL_BLOCK_END)
             return true;
@@ -33,7 +46,8 @@ namespace Liquid {
             parser.nodes.back() = move(qualifierNode);
         }
         if (parser.nodes.back()->type && parser.nodes.back()->type->type == NodeType::Type::QUALIFIER) {
-            if (static_cast<const TagNodeType::QualifierNodeType*>(parser.nodes.back()->type)->arity == TagNodeType::QualifierNodeType::Arity::NONARY) {
+            // Filters' wildcard qualifiers always take an argument, and have no arity to check.
+            if (parser.nodes.back()->type != context.getFilterWildcardQualifierNodeType() && static_cast<const TagNodeType::QualifierNodeType*>(parser.nodes.back()->type)->arity == TagNodeType::QualifierNodeType::Arity::NONARY) {
                 parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNEXPECTED_OPERAND, parser.nodes.back()->type->symbol));
                 return false;
             }
@@ -234,10 +248,7 @@ namespace Liquid {
                     switch (it->get()->type->type) {
                         case NodeType::Type::TAG:
                         case NodeType::Type::OUTPUT: {
-                            auto& filters = static_cast<const ContextualNodeType*>(it->get()->type)->filters;
-                            auto filterIt = filters.find(opName);
-                            if (filterIt != filters.end())
-                                op = static_cast<FilterNodeType*>(filterIt->second.get());
+                            op = static_cast<const FilterNodeType*>(static_cast<const ContextualNodeType*>(it->get()->type)->getFilter(opName));
                         } break;
                         default: break;
                     }
@@ -257,8 +268,7 @@ namespace Liquid {
                 switch (this->state) {
                     case SUPER::State::CONTROL: {
                         if (len > 3 && strncmp(str, "end", 3) == 0) {
-                            std::string typeName = std::string(&str[3], len - 3);
-                            const TagNodeType* type = static_cast<const TagNodeType*>(SUPER::context.getTagType(typeName));
+                            const TagNodeType* type = SUPER::context.getTagType(std::string_view(&str[3], len - 3));
 
                             if (!type || type->composition == TagNodeType::Composition::FREE) {
                                 parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_TAG, std::string(str, len)));
@@ -284,10 +294,9 @@ namespace Liquid {
                             if (!type && parser.nodes.size() > 0) {
                                 for (auto it = parser.nodes.rbegin(); it != parser.nodes.rend(); ++it) {
                                     if ((*it)->type && (*it)->type->type == NodeType::Type::TAG) {
-                                        auto& intermediates = static_cast<const TagNodeType*>((*it)->type)->intermediates;
-                                        auto it = intermediates.find(typeName);
-                                        if (it != intermediates.end()) {
-                                            type = static_cast<TagNodeType*>(it->second.get());
+                                        const NodeType* intermediate = static_cast<const TagNodeType*>((*it)->type)->getIntermediate(typeName);
+                                        if (intermediate) {
+                                            type = static_cast<const TagNodeType*>(intermediate);
                                             // Pop off the concatenation node, and apply this as the next arugment in the parent node.
                                             parser.popNode();
                                             parser.blockType = Parser::EBlockType::INTERMEDIATE;
@@ -311,16 +320,19 @@ namespace Liquid {
                     case SUPER::State::CONTROL_HALT:
                     case SUPER::State::INITIAL:
                         assert(parser.nodes.back()->type == SUPER::context.getConcatenationNodeType());
-                        parser.nodes.back()->children.push_back(std::make_unique<Node>(std::string(str, len)));
+                        if (parser.literalViews)
+                            parser.nodes.back()->children.push_back(std::make_unique<Node>(Variant(str, len)));
+                        else
+                            parser.nodes.back()->children.push_back(std::make_unique<Node>(std::string(str, len)));
                     break;
                 }
             } break;
             case Parser::State::LIQUID_ARGUMENT:
             case Parser::State::ARGUMENT: {
-                std::string opName = std::string(str, len);
-                const LiteralNodeType* type = SUPER::context.getLiteralType(opName);
+                const LiteralNodeType* type = SUPER::context.getLiteralType(std::string_view(str, len));
                 if (type)
                     return parser.pushNode(make_unique<Node>(type));
+                std::string opName = std::string(str, len);
                 auto& lastNode = parser.nodes.back();
                 if (lastNode->type && (lastNode->type->type == NodeType::Type::VARIABLE || lastNode->type->type == NodeType::Type::DOT_FILTER) && !lastNode->children.back().get()) {
                     // Check for dot filters.
@@ -402,15 +414,12 @@ namespace Liquid {
                                         }
                                     }
                                 }
-                                auto it = contextualType->operators.find(opName);
-                                if (it == contextualType->operators.end()) {
+                                const NodeType* contextualOperator = contextualType ? contextualType->getOperator(opName) : nullptr;
+                                if (!contextualOperator) {
                                     // If no operator found, check for a specified qualifier.
                                     const TagNodeType::QualifierNodeType* qualifier = nullptr;
-                                    if (contextualType && contextualType->type == NodeType::Type::TAG) {
-                                        auto it = static_cast<const TagNodeType*>(contextualType)->qualifiers.find(opName);
-                                        if (it != static_cast<const TagNodeType*>(contextualType)->qualifiers.end())
-                                            qualifier = static_cast<TagNodeType::QualifierNodeType*>(it->second.get());
-                                    }
+                                    if (contextualType && contextualType->type == NodeType::Type::TAG)
+                                        qualifier = static_cast<const TagNodeType::QualifierNodeType*>(static_cast<const TagNodeType*>(contextualType)->getQualifier(opName));
                                     if (!qualifier) {
                                         parser.pushError(Parser::Error(*this, contextualType && contextualType->type == NodeType::Type::TAG ? Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_OPERATOR_OR_QUALIFIER : Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_OPERATOR, opName));
                                         parser.state = Parser::State::IGNORE_UNTIL_BLOCK_END;
@@ -422,7 +431,7 @@ namespace Liquid {
                                         return false;
                                     return true;
                                 } else
-                                    op = static_cast<const OperatorNodeType*>(it->second.get());
+                                    op = static_cast<const OperatorNodeType*>(contextualOperator);
                             }
 
                             assert(op->fixness == OperatorNodeType::Fixness::INFIX);
@@ -622,9 +631,22 @@ namespace Liquid {
         return true;
     }
 
+    // Compiles the path of every variable in the tree; see CompiledPath.
+    static void compilePaths(Node& node) {
+        if (!node.type)
+            return;
+        if (node.type->type == NodeType::Type::VARIABLE)
+            node.compilePath();
+        for (auto& child : node.children) {
+            if (child)
+                compilePaths(*child.get());
+        }
+    }
+
     Node Parser::parseArgument(const char* buffer, size_t len) {
         errors.clear();
         nodes.clear();
+        Node::ResourceScope scope(memoryResource);
 
         filterState = EFilterState::UNSET;
         blockType = EBlockType::INTERMEDIATE;
@@ -639,6 +661,7 @@ namespace Liquid {
         if (!popNodeUntil(NodeType::Type::OUTPUT))
             return Node();
         assert(nodes.size() == 1);
+        compilePaths(*nodes.back().get());
         Node node = move(*nodes.back()->children[0].get());
         nodes.clear();
         return node;
@@ -656,15 +679,16 @@ namespace Liquid {
         return hasBraces ? parse(buffer, len, file) : parseArgument(buffer, len);
     }
 
-    Node Parser::parse(const char* buffer, size_t len, const string& file) {
+    Node Parser::parse(const char* buffer, size_t len, const string& file, size_t initialLine, size_t initialColumn) {
         errors.clear();
         nodes.clear();
+        Node::ResourceScope scope(memoryResource);
         filterState = EFilterState::UNSET;
         blockType = EBlockType::NONE;
         state = State::NODE;
 
         pushNode(make_unique<Node>(context.getConcatenationNodeType()), false);
-        Lexer::Error error = lexer.parse(buffer, len);
+        Lexer::Error error = lexer.parse(buffer, len, Lexer::State::INITIAL, initialLine, initialColumn);
         if (error.type != Lexer::Error::Type::LIQUID_LEXER_ERROR_TYPE_NONE)
             throw Exception(error);
         if (nodes.size() > 1) {
@@ -677,6 +701,7 @@ namespace Liquid {
             throw Exception({ Liquid::Parser::Error(lexer, LIQUID_PARSER_ERROR_TYPE_UNEXPECTED_END) });
         }
         assert(nodes.size() == 1);
+        compilePaths(*nodes.back().get());
         if (file.empty()) {
             Node node = move(*nodes.back().get());
             nodes.clear();
@@ -689,6 +714,239 @@ namespace Liquid {
         return node;
     }
 
+    void Template::release() {
+        #if defined(__unix__) || defined(__APPLE__)
+            if (source && mapped)
+                munmap(const_cast<char*>(source), size);
+        #endif
+        if (source && !mapped)
+            delete[] source;
+        source = nullptr;
+        size = 0;
+        mapped = false;
+        serialized = false;
+    }
+
+    // Parses the template's own source into its tree, with all raw text as views into that source.
+    // Nodes are allocated from an arena belonging to the template, sized from the source, as most nodes are going to be much smaller than the text they come from.
+    static void parseSource(Parser& parser, Template& tmpl, const string& file) {
+        std::pmr::memory_resource* memoryResource = parser.memoryResource;
+        tmpl.arena = make_unique<std::pmr::monotonic_buffer_resource>(std::max(tmpl.size, (size_t)1024), memoryResource ? memoryResource : std::pmr::new_delete_resource());
+        parser.literalViews = true;
+        parser.memoryResource = tmpl.arena.get();
+        try {
+            tmpl.ast = parser.parse(tmpl.source, tmpl.size, file);
+        } catch (...) {
+            // Anything left on the stack is from the arena, which is about to go.
+            parser.nodes.clear();
+            parser.literalViews = false;
+            parser.memoryResource = memoryResource;
+            throw;
+        }
+        parser.literalViews = false;
+        parser.memoryResource = memoryResource;
+    }
+
+    Template Parser::parseTemplate(const char* buffer, size_t len, const string& file) {
+        Template tmpl;
+        char* source = new char[len+1];
+        memcpy(source, buffer, len);
+        source[len] = 0;
+        tmpl.source = source;
+        tmpl.size = len;
+        parseSource(*this, tmpl, file);
+        return tmpl;
+    }
+
+    void Template::read(const string& path) {
+        release();
+        #if defined(__unix__) || defined(__APPLE__)
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1)
+                throw Liquid::Exception("Unable to open file %s.", path.c_str());
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                throw Liquid::Exception("Unable to read file %s.", path.c_str());
+            }
+            // The lexer can peek a byte past the end of its buffer, which would fault if the file ended exactly on a page boundary.
+            // In that case (or if the file is empty), we just read it normally.
+            if (info.st_size > 0 && info.st_size % sysconf(_SC_PAGESIZE) != 0) {
+                void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (mapping == MAP_FAILED)
+                    throw Liquid::Exception("Unable to map file %s.", path.c_str());
+                source = static_cast<const char*>(mapping);
+                size = info.st_size;
+                mapped = true;
+                return;
+            }
+            close(fd);
+        #endif
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            throw Liquid::Exception("Unable to open file %s.", path.c_str());
+        string contents;
+        char buffer[4096];
+        size_t bytes;
+        while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            contents.append(buffer, bytes);
+        fclose(file);
+        char* copy = new char[contents.size()+1];
+        memcpy(copy, contents.data(), contents.size());
+        copy[contents.size()] = 0;
+        source = copy;
+        size = contents.size();
+    }
+
+    Template Parser::parseFile(const string& path) {
+        Template tmpl;
+        tmpl.read(path);
+        parseSource(*this, tmpl, path);
+        return tmpl;
+    }
+
+    // Points every view in the tree at a new buffer, shifted by some amount, and shifts lines as we go.
+    static void rebase(Node& node, const char* from, const char* to, ptrdiff_t shift, ptrdiff_t lines) {
+        if (node.type) {
+            if (node.line > 0)
+                node.line += lines;
+            for (auto& child : node.children) {
+                if (child)
+                    rebase(*child.get(), from, to, shift, lines);
+            }
+        } else if (node.variant.type == Variant::Type::STRING_VIEW) {
+            node.variant.view = to + ((node.variant.view - from) + shift);
+        }
+    }
+
+    // Adds a node to a list of top-level nodes; merging it into the previous one if they're both contiguous raw text.
+    static void appendTopLevel(vector<unique_ptr<Node>>& children, unique_ptr<Node> node) {
+        if (!node->type && node->variant.type == Variant::Type::STRING_VIEW && children.size() > 0) {
+            Node& last = *children.back().get();
+            if (!last.type && last.variant.type == Variant::Type::STRING_VIEW && last.variant.view + last.variant.len == node->variant.view) {
+                last.variant.len += node->variant.len;
+                return;
+            }
+        }
+        children.push_back(move(node));
+    }
+
+    void Parser::reparse(Template& tmpl, size_t offset, size_t length, const char* replacement, size_t replacementLength) {
+        auto invalid = [](const char* reason) {
+            Parser::Error error;
+            error.type = Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_INVALID_EDIT;
+            strncpy(error.details.args[0], reason, LIQUID_ERROR_ARG_MAX_LENGTH-1);
+            error.details.args[0][LIQUID_ERROR_ARG_MAX_LENGTH-1] = 0;
+            return Parser::Exception(vector<Parser::Error>({ error }));
+        };
+        if (!tmpl.source || tmpl.serialized)
+            throw invalid("template has no source text");
+        if (offset > tmpl.size || length > tmpl.size - offset)
+            throw invalid("range is outside the source");
+        const char* oldSource = tmpl.source;
+        const char* oldEnd = oldSource + tmpl.size;
+        size_t size = tmpl.size - length + replacementLength;
+        ptrdiff_t shift = (ptrdiff_t)replacementLength - (ptrdiff_t)length;
+        unique_ptr<char[]> source(new char[size+1]);
+        if (offset > 0)
+            memcpy(source.get(), oldSource, offset);
+        if (replacementLength > 0)
+            memcpy(source.get() + offset, replacement, replacementLength);
+        if (tmpl.size > offset + length)
+            memcpy(source.get() + offset + replacementLength, oldSource + offset + length, tmpl.size - offset - length);
+        source[size] = 0;
+
+        string file;
+        Node* root = &tmpl.ast;
+        if (root->type == context.getContextBoundaryNodeType()) {
+            file = root->children[0]->getString();
+            root = root->children[1].get();
+        }
+
+        // We cut at the start of a line inside top-level raw text, where the line doesn't start with whitespace or a brace; lexing from
+        // one of these points gives exactly the same result as lexing all the way up to it, as nothing before it can be trimmed or joined.
+        auto isCut = [this, oldSource, oldEnd](const char* c) {
+            return c > oldSource && c[-1] == '\n' && c < oldEnd && *c != '{' && !lexer.isWhitespace(c, oldEnd);
+        };
+        auto isView = [oldSource, oldEnd](const Node& node) {
+            return !node.type && node.variant.type == Variant::Type::STRING_VIEW && node.variant.view >= oldSource && node.variant.view + node.variant.len <= oldEnd;
+        };
+        const char* start = oldSource, *end = oldEnd;
+        int leftIndex = -1, rightIndex = -1;
+        if (root->type == context.getConcatenationNodeType()) {
+            for (int i = (int)root->children.size() - 1; i >= 0 && leftIndex == -1; --i) {
+                const Node& child = *root->children[i].get();
+                if (isView(child) && child.variant.view < oldSource + offset) {
+                    for (const char* c = std::min(child.variant.view + child.variant.len, oldSource + offset) - 1; c > child.variant.view; --c) {
+                        if (isCut(c)) {
+                            start = c;
+                            leftIndex = i;
+                            break;
+                        }
+                    }
+                }
+            }
+            for (int i = std::max(leftIndex, 0); i < (int)root->children.size() && rightIndex == -1; ++i) {
+                const Node& child = *root->children[i].get();
+                if (isView(child) && child.variant.view + child.variant.len > oldSource + offset + length) {
+                    for (const char* c = std::max(child.variant.view + 1, oldSource + offset + length + 1); c < child.variant.view + child.variant.len; ++c) {
+                        if (isCut(c)) {
+                            end = c;
+                            rightIndex = i;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (leftIndex != -1 || rightIndex != -1) {
+            size_t initialLine = 1 + std::count(oldSource, start, '\n');
+            Node middle;
+            literalViews = true;
+            try {
+                middle = parse(source.get() + (start - oldSource), (end - oldSource) + shift - (start - oldSource), "", initialLine, start == oldSource ? 0 : 1);
+            } catch (Parser::Exception&) {
+                // Most likely an edit left a tag open; the full parse below will either sort it out, or report it properly.
+            } catch (...) {
+                literalViews = false;
+                throw;
+            }
+            literalViews = false;
+            if (middle.type && errors.size() == 0) {
+                ptrdiff_t lines = std::count(replacement, replacement + replacementLength, '\n') - std::count(oldSource + offset, oldSource + offset + length, '\n');
+                const char* rightEnd = rightIndex != -1 ? root->children[rightIndex]->variant.view + root->children[rightIndex]->variant.len : nullptr;
+                vector<unique_ptr<Node>> children;
+                for (int i = 0; i <= leftIndex; ++i) {
+                    rebase(*root->children[i].get(), oldSource, source.get(), 0, 0);
+                    children.push_back(move(root->children[i]));
+                }
+                if (leftIndex != -1)
+                    children.back()->variant.len = start - oldSource - (children.back()->variant.view - source.get());
+                for (auto& child : middle.children)
+                    appendTopLevel(children, move(child));
+                if (rightIndex != -1) {
+                    appendTopLevel(children, make_unique<Node>(Variant(source.get() + (end - oldSource) + shift, (size_t)(rightEnd - end))));
+                    for (int i = rightIndex + 1; i < (int)root->children.size(); ++i) {
+                        rebase(*root->children[i].get(), oldSource, source.get(), shift, lines);
+                        children.push_back(move(root->children[i]));
+                    }
+                }
+                root->children = move(children);
+                tmpl.release();
+                tmpl.source = source.release();
+                tmpl.size = size;
+                return;
+            }
+        }
+        Template result;
+        result.source = source.release();
+        result.size = size;
+        parseSource(*this, result, file);
+        tmpl = move(result);
+    }
+
     void Parser::unparse(const Node& node, string& target, Parser::State state) {
         if (node.type) {
             switch (node.type->type) {
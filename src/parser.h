@@ -10,6 +10,49 @@ namespace Liquid {
     struct Variable;
     struct FilterNodeType;
 
+    // A parsed template that owns the text it was parsed from. Raw text in the tree is stored as views into that text, rather than as copies.
+    // The source is either a private heap copy, or a read-only memory mapping of a file. Can be moved, but not copied.
+    // The nodes of the tree are allocated from an arena belonging to the template, which is released all at once when the template is; so
+    // no node in the tree should be moved somewhere that will outlive it.
+    struct Template {
+        // Declared before the tree, so that the tree is destroyed first.
+        unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+        Node ast;
+        const char* source = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+        // Set for templates loaded by the serializer, whose source is the serialized data, rather than the template's text.
+        bool serialized = false;
+
+        Template() { }
+        Template(const Template&) = delete;
+        Template(Template&& tmpl) : arena(move(tmpl.arena)), ast(move(tmpl.ast)), source(tmpl.source), size(tmpl.size), mapped(tmpl.mapped), serialized(tmpl.serialized) {
+            tmpl.source = nullptr;
+            tmpl.size = 0;
+        }
+        ~Template() { release(); }
+
+        Template& operator = (const Template&) = delete;
+        Template& operator = (Template&& tmpl) {
+            // The old tree has to go before the old arena does.
+            ast = move(tmpl.ast);
+            arena = move(tmpl.arena);
+            release();
+            source = tmpl.source;
+            size = tmpl.size;
+            mapped = tmpl.mapped;
+            serialized = tmpl.serialized;
+            tmpl.source = nullptr;
+            tmpl.size = 0;
+            return *this;
+        }
+
+        // Releases the source; leaves the tree and the arena alone.
+        void release();
+        // Replaces the source with the contents of a file; memory mapped where possible. Throws a Liquid::Exception if the file can't be read.
+        void read(const string& path);
+    };
+
     struct Parser {
         const Context& context;
 
@@ -83,6 +126,9 @@ namespace Liquid {
                     case Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_PARSE_DEPTH_EXCEEDED:
                         sprintf(buffer, "Parse depth exceeded on line %lu, column %lu.", error.details.line, error.details.column);
                     break;
+                    case Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_INVALID_EDIT:
+                        sprintf(buffer, "Invalid edit; %s.", error.details.args[0]);
+                    break;
                 }
                 return string(buffer);
             }
@@ -123,6 +169,10 @@ namespace Liquid {
 
         // Any more depth than this, and we throw an error.
         unsigned int maximumParseDepth = 100;
+        // If true, raw text is stored as views into the buffer being parsed, rather than copied. Set by parseTemplate and parseFile.
+        bool literalViews = false;
+        // Where nodes are allocated from; defaults to the context's. Templates allocate from their own arena, which in turn draws from this.
+        std::pmr::memory_resource* memoryResource = nullptr;
 
         void pushError(const Error& error) {
             errors.push_back(error);
@@ -179,7 +229,7 @@ namespace Liquid {
         Lexer lexer;
         string file;
 
-        Parser(const Context& context) : context(context), lexer(context, *this) { }
+        Parser(const Context& context);
 
 
         Error validate(const Node& node) const;
@@ -199,11 +249,25 @@ namespace Liquid {
         Node parseAppropriate(const char* buffer, size_t len, const std::string& file = "");
         Node parseAppropriate(const std::string& str, const std::string& file = "") { return parseAppropriate(str.data(), str.size()); }
 
-        Node parse(const char* buffer, size_t len, const std::string& file = "");
+        Node parse(const char* buffer, size_t len, const std::string& file = "", size_t initialLine = 1, size_t initialColumn = 0);
         Node parse(const string& str, const std::string& file = "") {
             return parse(str.data(), str.size(), file);
         }
 
+        // Copies the buffer into a template, and parses it such that all raw text are views into that copy.
+        Template parseTemplate(const char* buffer, size_t len, const std::string& file = "");
+        Template parseTemplate(const string& str, const std::string& file = "") {
+            return parseTemplate(str.data(), str.size(), file);
+        }
+        // As above, but memory maps the file where possible, rather than copying it. Throws a Liquid::Exception if the file can't be read.
+        Template parseFile(const std::string& path);
+        // Applies an edit to a template's source, replacing length bytes at offset with the replacement, and updates the tree to match.
+        // Only the lines around the edit are lexed and parsed again; the rest of the tree is kept, with line numbers shifted as needed.
+        // Falls back to a full reparse if the edit can't be isolated between two top-level stretches of raw text. If parsing throws, the template is left untouched.
+        // Throws a Parser::Exception if the edit lies outside the source, or the template has no source text to edit, as with serialized templates.
+        // Errors in the parser reflect only the part that was reparsed.
+        void reparse(Template& tmpl, size_t offset, size_t length, const char* replacement, size_t replacementLength);
+
         // Unparses the tree into text. Useful when used with optimization.
         void unparse(const Node& node, std::string& target, Parser::State state = Parser::State::NODE);
         std::string unparse(const Node& node) { std::string target; unparse(node, target); return target; }
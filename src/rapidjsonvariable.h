@@ -22,8 +22,9 @@ namespace Liquid {
     // }
 
     struct RapidJSONVariableResolver : LiquidVariableResolver {
-        RapidJSONVariableResolver() {
-            getType = +[](LiquidRenderer renderer, void* variable) {
+        // For StaticRenderer.
+        struct Static {
+            static LiquidVariableType getType(void* variable) {
                 if (!variable)
                     return LIQUID_VARIABLE_TYPE_NIL;
                 switch (static_cast<rapidjson::Value*>(variable)->GetType()) {
@@ -43,14 +44,59 @@ namespace Liquid {
                     default:
                         return LIQUID_VARIABLE_TYPE_OTHER;
                 }
-            };
-            getBool = +[](LiquidRenderer renderer, void* variable, bool* target) {
+            }
+            static bool getBool(void* variable, bool& target) {
                 int type = static_cast<rapidjson::Value*>(variable)->GetType();
                 if (type != 2 && type != 3)
                     return false;
-                *target = type == 2;
+                target = type == 2;
                 return true;
-            };
+            }
+            static bool getInteger(void* variable, long long& target) {
+                if (!static_cast<rapidjson::Value*>(variable)->IsNumber())
+                    return false;
+                target = static_cast<rapidjson::Value*>(variable)->GetInt64();
+                return true;
+            }
+            static bool getFloat(void* variable, double& target) {
+                if (!static_cast<rapidjson::Value*>(variable)->IsNumber())
+                    return false;
+                target = static_cast<rapidjson::Value*>(variable)->GetFloat();
+                return true;
+            }
+            static bool getStringView(void* variable, const char*& target, size_t& length) {
+                if (!static_cast<rapidjson::Value*>(variable)->IsString())
+                    return false;
+                target = static_cast<rapidjson::Value*>(variable)->GetString();
+                length = static_cast<rapidjson::Value*>(variable)->GetStringLength();
+                return true;
+            }
+            static bool getDictionaryVariable(void* variable, const string& key, void*& target) {
+                rapidjson::Value* value = static_cast<rapidjson::Value*>(variable);
+                if (!value->IsObject())
+                    return false;
+                auto it = value->FindMember(key.c_str());
+                if (it == value->MemberEnd())
+                    return false;
+                target = &it->value;
+                return true;
+            }
+            static bool getArrayVariable(void* variable, long long idx, void*& target) {
+                rapidjson::Value* value = static_cast<rapidjson::Value*>(variable);
+                if (!value->IsArray())
+                    return false;
+                if (idx < 0)
+                    idx += value->Size();
+                if (idx < 0 || idx >= value->Size())
+                    return false;
+                target = &(*value)[idx];
+                return true;
+            }
+        };
+
+        RapidJSONVariableResolver() {
+            getType = +[](LiquidRenderer renderer, void* variable) { return Static::getType(variable); };
+            getBool = +[](LiquidRenderer renderer, void* variable, bool* target) { return Static::getBool(variable, *target); };
             getTruthy = +[](LiquidRenderer renderer, void* variable) {
                 switch (static_cast<rapidjson::Value*>(variable)->GetType()) {
                     case 0:
@@ -75,18 +121,8 @@ namespace Liquid {
                     return -1LL;
                 return (long long)static_cast<rapidjson::Value*>(variable)->GetStringLength();
             };
-            getInteger = +[](LiquidRenderer renderer, void* variable, long long* target) {
-                if (!static_cast<rapidjson::Value*>(variable)->IsNumber())
-                    return false;
-                *target = static_cast<rapidjson::Value*>(variable)->GetInt64();
-                return true;
-            };
-            getFloat = +[](LiquidRenderer renderer, void* variable, double* target) {
-                if (!static_cast<rapidjson::Value*>(variable)->IsNumber())
-                    return false;
-                *target = static_cast<rapidjson::Value*>(variable)->GetFloat();
-                return true;
-            };
+            getInteger = +[](LiquidRenderer renderer, void* variable, long long* target) { return Static::getInteger(variable, *target); };
+            getFloat = +[](LiquidRenderer renderer, void* variable, double* target) { return Static::getFloat(variable, *target); };
             getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
                 if (!static_cast<rapidjson::Value*>(variable)->IsObject() || !static_cast<rapidjson::Value*>(variable)->HasMember(key))
                     return false;
@@ -111,6 +147,15 @@ namespace Liquid {
                     return -1LL;
                 return (long long)static_cast<rapidjson::Value*>(variable)->Size();
             };
+            getArrayVariables = +[](LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) {
+                rapidjson::Value& value = *static_cast<rapidjson::Value*>(variable);
+                if (!value.IsArray())
+                    return -1LL;
+                long long filled = 0;
+                for (long long i = std::max(idx, 0LL); i < (long long)value.Size() && filled < count; ++i)
+                    targets[filled++] = &value[(rapidjson::SizeType)i];
+                return filled;
+            };
 
             iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
                 rapidjson::Value& value = *static_cast<rapidjson::Value*>(variable);
@@ -119,7 +164,7 @@ namespace Liquid {
                         limit = (int)value.Size() + limit + 1;
                     if (start < 0)
                         start = 0;
-                    int endIndex = std::min(start+limit-1, (int)value.Size());
+                    int endIndex = std::min(start+limit-1, (int)value.Size()-1);
                     if (reverse) {
                         for (int i = endIndex; i >= start; --i) {
                             if (!callback(&value[i], data))
@@ -202,6 +247,15 @@ namespace Liquid {
                 jvalue->SetString(value, ((rapidjson::Document*)static_cast<Renderer*>(renderer.renderer)->resolverCustomData)->GetAllocator()); 
                 return (void*)jvalue; 
             };
+            createStringN = +[](LiquidRenderer renderer, const char* value, size_t length, bool owned) {
+                rapidjson::Document* document = static_cast<rapidjson::Document*>(static_cast<Renderer*>(renderer.renderer)->resolverCustomData);
+                assert(document);
+                rapidjson::Value* jvalue = new (document->GetAllocator().Malloc(sizeof(rapidjson::Value))) rapidjson::Value();
+                jvalue->SetString(value, length, document->GetAllocator());
+                if (owned)
+                    free((void*)value);
+                return (void*)jvalue;
+            };
             createPointer = +[](LiquidRenderer renderer, void* value) { 
                 rapidjson::Document* document = static_cast<rapidjson::Document*>(static_cast<Renderer*>(renderer.renderer)->resolverCustomData); 
                 assert(document);
@@ -233,6 +287,31 @@ namespace Liquid {
             };
 
             compare = +[](void* a, void* b) { return static_cast<rapidjson::Value*>(a)->GetInt64() < static_cast<rapidjson::Value*>(b)->GetInt64() ? -1 : 0; };
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** target, size_t* length) { return Static::getStringView(variable, *target, *length); };
+            resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+                rapidjson::Value* current = static_cast<rapidjson::Value*>(variable);
+                for (size_t i = 0; i < count; ++i) {
+                    if (segments[i].type == LIQUID_PATH_SEGMENT_TYPE_INDEX) {
+                        if (!current->IsArray())
+                            return false;
+                        long long idx = segments[i].index;
+                        if (idx < 0)
+                            idx += current->Size();
+                        if (idx < 0 || idx >= current->Size())
+                            return false;
+                        current = &(*current)[idx];
+                    } else {
+                        if (!current->IsObject())
+                            return false;
+                        auto it = current->FindMember(segments[i].key);
+                        if (it == current->MemberEnd())
+                            return false;
+                        current = &it->value;
+                    }
+                }
+                *target = current;
+                return true;
+            };
         }
     };
 
@@ -7,27 +7,28 @@ namespace Liquid {
 
     Renderer::Renderer(const Context& context) : context(context) {
         variableResolver = CPPVariableResolver();
+        memoryResource = context.memoryResource;
     }
 
     Renderer::Renderer(const Context& context, LiquidVariableResolver variableResolver) : context(context), variableResolver(variableResolver) {
-
+        memoryResource = context.memoryResource;
     }
 
     Variant Renderer::renderArgument(const Node& ast, Variable store) {
+        Node::ResourceScope resourceScope(memoryResource);
         nodeContext = nullptr;
         mode = Renderer::ExecutionMode::PARSE_TREE;
         errors.clear();
         unknownErrors.clear();
-        renderStartTime = std::chrono::system_clock::now();
-        currentMemoryUsage = 0;
-        currentRenderingDepth = 0;
+        resetLimits();
         error = Error::Type::LIQUID_RENDERER_ERROR_TYPE_NONE;
+        clearScope();
         internalRender = true;
         Node node = retrieveRenderedNode(ast, store);
         internalRender = false;
         assert(node.type == nullptr);
         if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
-            throw Error(error, Node());
+            throw Exception(Error(error, Node()));
         return node.variant;
     }
 
@@ -38,14 +39,14 @@ namespace Liquid {
             auto s = node.getString();
             callback(s.data(), s.size(), data);
         } else {
+            Node::ResourceScope resourceScope(memoryResource);
             mode = Renderer::ExecutionMode::PARSE_TREE;
             nodeContext = nullptr;
             errors.clear();
             unknownErrors.clear();
-            renderStartTime = std::chrono::system_clock::now();
-            currentMemoryUsage = 0;
-            currentRenderingDepth = 0;
+            resetLimits();
             error = Error::Type::LIQUID_RENDERER_ERROR_TYPE_NONE;
+            clearScope();
             internalRender = true;
             Node node = retrieveRenderedNode(ast, store);
             internalRender = false;
@@ -56,6 +57,29 @@ namespace Liquid {
         return error;
     }
 
+    void Renderer::resetLimits() {
+        renderStartTime = std::chrono::steady_clock::now();
+        currentMemoryUsage = 0;
+        currentRenderingDepth = 0;
+        currentRenderingSteps = 0;
+        nextLimitCheck = 0;
+    }
+
+    std::chrono::duration<unsigned int,std::milli> Renderer::getRenderedTime() const {
+        return std::chrono::duration_cast<std::chrono::duration<unsigned int,std::milli>>(std::chrono::steady_clock::now() - renderStartTime);
+    }
+
+    bool Renderer::checkLimits() {
+        if ((maximumRenderingSteps && currentRenderingSteps > maximumRenderingSteps) || (maximumRenderingTime && getRenderedTime().count() >= maximumRenderingTime)) {
+            error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME;
+            return false;
+        }
+        nextLimitCheck = currentRenderingSteps + TIME_CHECK_INTERVAL;
+        if (maximumRenderingSteps)
+            nextLimitCheck = std::min(nextLimitCheck, maximumRenderingSteps + 1);
+        return true;
+    }
+
     string Renderer::render(const Node& ast, Variable store) {
         string accumulator;
         LiquidRendererErrorType error = render(ast, store, +[](const char* chunk, size_t size, void* data){
@@ -63,7 +87,7 @@ namespace Liquid {
             accumulator->append(chunk, size);
         }, &accumulator);
         if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
-            throw Error(error, Node());
+            throw Exception(Error(error, Node()));
         return accumulator;
     }
 
@@ -77,37 +101,55 @@ namespace Liquid {
         return result.substr(start, end - start + 1);
     }
 
-    pair<void*, Renderer::DropFunction> Renderer::getInternalDrop(const string& key) {
-        auto it = internalDrops.find(key);
-        if (it == internalDrops.end())
-            return { nullptr, nullptr };
-        return it->second.back();
+    pair<void*, Renderer::DropFunction> Renderer::getInternalDrop(std::string_view name) {
+        for (auto it = internalDrops.rbegin(); it != internalDrops.rend(); ++it) {
+            if (it->name.size() == name.size() && memcmp(it->name.data(), name.data(), name.size()) == 0)
+                return { it->data, it->function };
+        }
+        return { nullptr, nullptr };
     }
 
     pair<void*, Renderer::DropFunction> Renderer::getInternalDrop(const Node& node, Variable store) {
         assert(node.type && node.children.size() > 0);
-        string key = retrieveRenderedNode(*node.children[0].get(), store).getString();
+        if (internalDrops.empty())
+            return { nullptr, nullptr };
+        const Node& link = *node.children[0].get();
+        if (!link.type) {
+            // The usual case; a plain name, which is compared where it is, rather than copied out.
+            if (link.variant.type == Variant::Type::STRING)
+                return getInternalDrop(std::string_view(link.variant.s));
+            if (link.variant.type == Variant::Type::STRING_VIEW)
+                return getInternalDrop(std::string_view(link.variant.view, link.variant.len));
+        } else if (link.type->type == NodeType::Type::DOT_FILTER) {
+            // A dot filter resolves its own operand, drops included; it's never the name of a drop itself.
+            return { nullptr, nullptr };
+        }
+        string key = retrieveRenderedNode(link, store).getString();
         return getInternalDrop(key);
     }
 
     void Renderer::pushInternalDrop(const std::string& key, std::pair<void*, DropFunction> func) {
-        internalDrops[key].push_back(func);
+        internalDrops.push_back({ key, func.first, func.second });
     }
 
     void Renderer::popInternalDrop(const std::string& key) {
-        auto it = internalDrops.find(key);
-        if (it != internalDrops.end()) {
-            it->second.pop_back();
-            if (it->second.size() == 0)
-                internalDrops.erase(it);
+        for (auto it = internalDrops.rbegin(); it != internalDrops.rend(); ++it) {
+            if (it->name == key) {
+                internalDrops.erase(std::next(it).base());
+                return;
+            }
         }
     }
 
 
     void Renderer::inject(Variable& variable, const Variant& variant) {
+        accountMemory(sizeof(Variant));
         switch (variant.type) {
             case Variant::Type::STRING:
-                variable = variableResolver.createString(*this, variant.s.data());
+                variable = createString(variant.s.data(), variant.s.size());
+            break;
+            case Variant::Type::STRING_VIEW:
+                variable = createString(variant.view, variant.len);
             break;
             case Variant::Type::INT:
                 variable = variableResolver.createInteger(*this, variant.i);
@@ -140,7 +182,17 @@ namespace Liquid {
         }
     }
 
-    Variant Renderer::parseVariant(Variable variable) {
+    Variable Renderer::createString(const char* str, size_t len) {
+        accountMemory(len);
+        if (variableResolver.createStringN)
+            return variableResolver.createStringN(*this, str, len, false);
+        // Views needn't be terminated, so the terminator's never looked for.
+        return variableResolver.createString(*this, string(str, len).c_str());
+    }
+
+    Variant Renderer::parseVariant(Variable variable, bool views) {
+        if (staticReads)
+            return staticReads->parseVariant(*this, variable, views);
         ELiquidVariableType type = variableResolver.getType(*this, variable);
         switch (type) {
             case LIQUID_VARIABLE_TYPE_OTHER:
@@ -164,13 +216,13 @@ namespace Liquid {
                     return Variant(f);
             } break;
             case LIQUID_VARIABLE_TYPE_STRING: {
+                const char* view;
+                size_t length;
+                if (views && variableResolver.getStringView && variableResolver.getStringView(*this, variable, &view, &length))
+                    return Variant(view, length);
                 string s;
-                long long size = variableResolver.getStringLength(*this, variable);
-                if (size >= 0) {
-                    s.resize(size);
-                    if (variableResolver.getString(*this, variable, const_cast<char*>(s.data())))
-                        return Variant(move(s));
-                }
+                if (resolveVariableString(s, variable))
+                    return Variant(move(s));
             } break;
             case LIQUID_VARIABLE_TYPE_NIL:
                 return Variant();
@@ -183,12 +235,8 @@ namespace Liquid {
         if (!node.type) {
             if (node.variant.type == Variant::Type::VARIABLE) {
                 string s;
-                long long size = variableResolver.getStringLength(*this, node.variant.v.pointer);
-                if (size >= 0) {
-                    s.resize(size);
-                    if (variableResolver.getString(*this, node.variant.v.pointer, const_cast<char*>(s.data())))
-                        return s;
-                }
+                if (resolveVariableString(s, node.variant.v.pointer))
+                    return s;
             } else {
                 return node.variant.getString();
             }
@@ -223,10 +271,142 @@ namespace Liquid {
         }
     }
 
+    size_t Renderer::resolvePath(const Node& node, Variable store, size_t offset, Variable& target, bool& valid) {
+        size_t compiled = node.path ? node.path->segments.size() : 0;
+        // Where the compiled path runs to the end of the path, or up to a dot filter, it's handed over as it is.
+        if (offset < compiled && (compiled == node.children.size() || (node.children[compiled]->type && node.children[compiled]->type->type == NodeType::DOT_FILTER))) {
+            if (!variableResolver.resolvePath(*this, target, &node.path->segments[offset], compiled - offset, target)) {
+                target = Variable({ nullptr });
+                valid = false;
+            }
+            return compiled;
+        }
+        LiquidPathSegment segments[MAXIMUM_PATH_SEGMENTS];
+        // Keeps any segment that had to be rendered alive until the path is resolved.
+        Node rendered[MAXIMUM_PATH_SEGMENTS];
+        size_t count = 0;
+        size_t i = offset;
+        for (; i < node.children.size() && count < MAXIMUM_PATH_SEGMENTS; ++i) {
+            if (i < compiled) {
+                segments[count++] = node.path->segments[i];
+                continue;
+            }
+            const Node& link = *node.children[i].get();
+            // Dot filters, and anything that isn't a plain key or index, are left to the segment-wise walk.
+            if (link.type && link.type->type == NodeType::DOT_FILTER)
+                break;
+            const Node* part = &link;
+            if (link.type) {
+                rendered[count] = retrieveRenderedNode(link, store);
+                part = &rendered[count];
+            }
+            if (part->variant.type == Variant::Type::INT) {
+                segments[count].type = LIQUID_PATH_SEGMENT_TYPE_INDEX;
+                segments[count].index = part->variant.i;
+            } else if (part->variant.type == Variant::Type::STRING) {
+                segments[count].type = LIQUID_PATH_SEGMENT_TYPE_KEY;
+                segments[count].key = part->variant.s.data();
+                segments[count].keyLength = part->variant.s.size();
+                segments[count].hash = liquidHashKey(segments[count].key, segments[count].keyLength);
+            } else
+                break;
+            ++count;
+        }
+        if (count > 0 && !variableResolver.resolvePath(*this, target, segments, count, target)) {
+            target = Variable({ nullptr });
+            valid = false;
+        }
+        return offset + count;
+    }
+
+    bool Renderer::iterate(Variable variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+        if (!variableResolver.getArrayVariables)
+            return variableResolver.iterate(*this, variable, callback, data, start, limit, reverse);
+        long long size = variableResolver.getArraySize(*this, variable);
+        if (size < 0)
+            return variableResolver.iterate(*this, variable, callback, data, start, limit, reverse);
+        long long count = limit < 0 ? size + limit + 1 : limit;
+        long long begin = std::max(start, 0);
+        long long end = std::min(begin + count, size);
+        void* block[ITERATION_BLOCK_SIZE];
+        bool first = true;
+        while (begin < end) {
+            long long offset = reverse ? std::max(begin, end - ITERATION_BLOCK_SIZE) : begin;
+            long long requested = std::min(end - offset, ITERATION_BLOCK_SIZE);
+            long long filled = variableResolver.getArrayVariables(*this, variable, offset, requested, block);
+            if (filled < 0 && first)
+                return variableResolver.iterate(*this, variable, callback, data, start, limit, reverse);
+            first = false;
+            if (filled <= 0)
+                break;
+            if (reverse) {
+                for (long long i = filled - 1; i >= 0; --i) {
+                    if (!callback(block[i], data))
+                        return true;
+                }
+                end = offset;
+            } else {
+                for (long long i = 0; i < filled; ++i) {
+                    if (!callback(block[i], data))
+                        return true;
+                }
+                begin = offset + filled;
+            }
+            // The array shrank underneath us.
+            if (filled < requested)
+                break;
+        }
+        return true;
+    }
+
+    size_t Renderer::resolveLayers(const Node& node, Variable store, Variable& target, bool& valid) {
+        if (node.children.size() == 0)
+            return 0;
+        const Node& link = *node.children[0].get();
+        if (link.type && link.type->type == NodeType::DOT_FILTER)
+            return 0;
+        Node rendered;
+        const Node* part = &link;
+        if (link.type) {
+            rendered = retrieveRenderedNode(link, store);
+            part = &rendered;
+        }
+        if (part->variant.type != Variant::Type::STRING)
+            return 0;
+        const char* key = part->variant.s.data();
+        valid = variableResolver.getDictionaryVariable(*this, store, key, target);
+        for (size_t i = 0; !valid && i < layers.size(); ++i)
+            valid = variableResolver.getDictionaryVariable(*this, layers[i], key, target);
+        if (!valid)
+            target = Variable({ nullptr });
+        return 1;
+    }
+
     pair<bool, Variable> Renderer::getVariable(const Node& node, Variable store, size_t offset) {
+        if (staticReads)
+            return staticReads->getVariable(*this, node, store, offset);
         Variable storePointer = store;
         bool valid = true;
-        for (size_t i = offset; valid && i < node.children.size(); ++i) {
+        size_t start = offset;
+        if (offset == 0 && !layers.empty())
+            start = resolveLayers(node, store, storePointer, valid);
+        for (size_t i = start; valid && i < node.children.size(); ++i) {
+            if (variableResolver.resolvePath) {
+                size_t next = resolvePath(node, store, i, storePointer, valid);
+                if (next > i) {
+                    i = next - 1;
+                    continue;
+                }
+            }
+            if (node.path && i < node.path->segments.size()) {
+                const LiquidPathSegment& segment = node.path->segments[i];
+                bool found = segment.type == LIQUID_PATH_SEGMENT_TYPE_INDEX ? variableResolver.getArrayVariable(*this, storePointer, segment.index, storePointer) : variableResolver.getDictionaryVariable(*this, storePointer, segment.key, storePointer);
+                if (!found) {
+                    storePointer = Variable({ nullptr });
+                    valid = false;
+                }
+                continue;
+            }
             auto& link = node.children[i];
             auto node = retrieveRenderedNode(*link.get(), store);
             if (link.get()->type && link.get()->type->type == NodeType::DOT_FILTER && !node.type) {
@@ -293,4 +473,143 @@ namespace Liquid {
         }
         return false;
     }
+
+    const Variant* Renderer::getScopedVariable(const Node& node, Variable store) {
+        if (scope.empty() || !node.type || node.children.size() == 0)
+            return nullptr;
+        const Node& link = *node.children[0].get();
+        if (!link.type) {
+            if (link.variant.type != Variant::Type::STRING)
+                return nullptr;
+            auto it = scope.find(link.variant.s);
+            return it != scope.end() ? &it->second : nullptr;
+        }
+        if (link.type->type == NodeType::DOT_FILTER)
+            return nullptr;
+        Node name = retrieveRenderedNode(link, store);
+        if (name.variant.type != Variant::Type::STRING)
+            return nullptr;
+        auto it = scope.find(name.variant.s);
+        return it != scope.end() ? &it->second : nullptr;
+    }
+
+    Node Renderer::resolveVariant(const Node& node, Variable store, const Variant& value, size_t offset, bool views) {
+        const Variant* current = &value;
+        for (size_t i = offset; node.type && i < node.children.size(); ++i) {
+            if (current->type == Variant::Type::VARIABLE) {
+                auto result = getVariable(node, current->v, i);
+                if (!result.first)
+                    return Node();
+                return Node(parseVariant(result.second, views));
+            }
+            if (current->type != Variant::Type::ARRAY)
+                return Node();
+            Node part = retrieveRenderedNode(*node.children[i].get(), store);
+            if (part.variant.type != Variant::Type::INT)
+                return Node();
+            long long idx = part.variant.i < 0 ? part.variant.i + (long long)current->a.size() : part.variant.i;
+            if (idx < 0 || idx >= (long long)current->a.size())
+                return Node();
+            current = &current->a[idx];
+        }
+        if (current->type == Variant::Type::VARIABLE)
+            return Node(parseVariant(current->v, views));
+        return Node(*current);
+    }
+
+    bool Renderer::assignVariant(const Node& node, Variable store, Variant& target, size_t offset, Variant value) {
+        Variant* current = &target;
+        for (size_t i = offset; i < node.children.size(); ++i) {
+            if (current->type == Variant::Type::VARIABLE) {
+                // Anything the scope refers to in the store is copied before it's written, so the store is never changed.
+                if (scopeCopies.find(current->v.pointer) == scopeCopies.end()) {
+                    Variable copy = variableResolver.createClone(*this, current->v.pointer);
+                    if (!copy.pointer)
+                        return false;
+                    scopeCopies.insert(copy.pointer);
+                    *current = Variant(copy);
+                }
+                Variable variable;
+                inject(variable, value);
+                return setVariable(node, current->v, variable, i);
+            }
+            if (current->type != Variant::Type::ARRAY)
+                return false;
+            Node part = retrieveRenderedNode(*node.children[i].get(), store);
+            if (part.variant.type != Variant::Type::INT)
+                return false;
+            vector<Variant>& elements = current->a.mutate();
+            long long idx = part.variant.i < 0 ? part.variant.i + (long long)elements.size() : part.variant.i;
+            if (idx < 0)
+                return false;
+            if (i == node.children.size() - 1) {
+                // Views may not outlive the render; the scope can.
+                if (value.type == Variant::Type::STRING_VIEW)
+                    value = Variant(string(value.view, value.len));
+                if (idx >= (long long)elements.size()) {
+                    size_t padding = (size_t)idx + 1 - elements.size();
+                    if (padding > SIZE_MAX / sizeof(Variant) || !accountMemory(padding * sizeof(Variant)))
+                        return false;
+                    elements.resize(idx + 1);
+                }
+                elements[idx] = move(value);
+                return true;
+            }
+            if (idx >= (long long)elements.size())
+                return false;
+            current = &elements[idx];
+        }
+        return false;
+    }
+
+    bool Renderer::assignVariable(const Node& node, Variable store, Variant value) {
+        bool assigned = false;
+        Node name;
+        if (node.children.size() > 0 && (!node.children[0]->type || node.children[0]->type->type != NodeType::DOT_FILTER))
+            name = retrieveRenderedNode(*node.children[0].get(), store);
+        if (!scopedAssigns) {
+            Variable target;
+            inject(target, value);
+            return setVariable(node, store, target);
+        }
+        if (name.variant.type == Variant::Type::STRING) {
+            if (node.children.size() == 1) {
+                // Views may not outlive the render; the scope can.
+                if (value.type == Variant::Type::STRING_VIEW)
+                    value = Variant(string(value.view, value.len));
+                scope[name.variant.s] = move(value);
+                return true;
+            }
+            // The head's looked up as it would be read: a loop's variable shadows everything else, and only lasts as long as the loop, so there's
+            // nowhere to keep what's assigned inside it; otherwise the scope, then the store and its layers, in order.
+            bool looped = getInternalDrop(name.variant.s).second != nullptr;
+            auto it = looped ? scope.end() : scope.find(name.variant.s);
+            if (!looped && it == scope.end()) {
+                Variable variable;
+                bool valid = false;
+                if (resolveLayers(node, store, variable, valid) && valid && variable.pointer)
+                    it = scope.emplace(name.variant.s, Variant(variable)).first;
+            }
+            assigned = it != scope.end() && assignVariant(node, store, it->second, 1, move(value));
+        }
+        if (!assigned)
+            errors.push_back(Error(LIQUID_RENDERER_ERROR_TYPE_INVALID_ASSIGNMENT, node, name.variant.type == Variant::Type::STRING ? name.variant.s : string()));
+        return assigned;
+    }
+
+    void Renderer::clearScope() {
+        scope.clear();
+        for (void* copy : scopeCopies)
+            variableResolver.freeVariable(*this, copy);
+        scopeCopies.clear();
+    }
+
+    void Renderer::writeBackScope(Variable store) {
+        for (auto& it : scope) {
+            Variable target;
+            inject(target, it.second);
+            if (!variableResolver.setDictionaryVariable(*this, store, it.first.data(), target))
+                variableResolver.freeVariable(*this, target);
+        }
+    }
 }
@@ -3,6 +3,8 @@
 
 #include "parser.h"
 
+#include <string_view>
+
 namespace Liquid {
     struct Context;
     struct ContextBoundaryNode;
@@ -27,9 +29,16 @@ namespace Liquid {
         Control control = Control::NONE;
         // In order to have a more genericized version of forloop drops, that are not affected by assigns.
         typedef Node (*DropFunction)(Renderer& renderer, const Node& node, Variable store, void* data);
-        std::unordered_map<std::string, std::vector<std::pair<void*, DropFunction>>> internalDrops;
+        struct InternalDrop {
+            std::string name;
+            void* data;
+            DropFunction function;
+        };
+        // Innermost last. There are only ever a few, so they're searched from the end, comparing names directly; which is quicker than hashing
+        // the name of every variable rendered, and free outside of a loop.
+        std::vector<InternalDrop> internalDrops;
         std::pair<void*, DropFunction> getInternalDrop(const Node& node, Variable store);
-        std::pair<void*, DropFunction> getInternalDrop(const std::string& str);
+        std::pair<void*, DropFunction> getInternalDrop(std::string_view name);
         void pushInternalDrop(const std::string& key, std::pair<void*, DropFunction> func);
         void popInternalDrop(const std::string& key);
 
@@ -74,6 +83,9 @@ namespace Liquid {
                     case Renderer::Error::Type::LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER:
                         sprintf(buffer, "Unknown filter '%s'.", rendererError.details.args[0]);
                     break;
+                    case Renderer::Error::Type::LIQUID_RENDERER_ERROR_TYPE_INVALID_ASSIGNMENT:
+                        sprintf(buffer, "Unable to assign to '%s'.", rendererError.details.args[0]);
+                    break;
                 }
                 return string(buffer);
             }
@@ -92,22 +104,48 @@ namespace Liquid {
         };
 
 
-        // If set, this will stop rendering with an error if the limits here, in bytes are breached for this renderer. This is checked any time
-        // the variable resolver is used.
+        // If set, this will stop rendering with an error once this many bytes, in total, have been allocated over the course of a render; for
+        // rendered strings and arrays, output, and variables created in the store. Copies count each time they're made, so this is a bound on
+        // the work a template can make the renderer do, rather than an exact measure of what it's holding at any one time.
         unsigned int maximumMemoryUsage = 0;
         // If set, this will stop rendering with an error if the limits here, in milisecnods, are breached for this renderer.
-        // This is checked between all concatenations.
+        // The clock is only read every TIME_CHECK_INTERVAL steps; see step.
         unsigned int maximumRenderingTime = 0;
+        // If set, this will stop rendering with the same error as maximumRenderingTime after this many steps; unlike the time, this is deterministic,
+        // so the same template and store will always fail at the same point.
+        unsigned long long maximumRenderingSteps = 0;
+        static constexpr unsigned int TIME_CHECK_INTERVAL = 1024;
+        // The most threads a long sort may be spread across, this one included, and never more than there are hardware threads. Each render
+        // that sorts a long array starts up to this many, less one, so when many renders run at once, size it with all of them in mind. 1, the
+        // default, keeps every sort on the rendering thread.
+        unsigned int maximumSortThreads = 1;
         // How many concatenation nodes are allowed at any given time. This roughly corresponds to the amount of nested tags. In non-malicious code
         // this will probably rarely exceed 100.
         unsigned int maximumRenderingDepth = 100;
 
-        unsigned int currentMemoryUsage;
-        std::chrono::system_clock::time_point renderStartTime;
+        size_t currentMemoryUsage = 0;
+        std::chrono::steady_clock::time_point renderStartTime;
         unsigned int currentRenderingDepth;
+        unsigned long long currentRenderingSteps = 0;
+        // The step at which the limits are next checked.
+        unsigned long long nextLimitCheck = 0;
 
         bool logUnknownFilters = false;
         bool logUnknownVariables = false;
+        // If set, assign, capture, increment and decrement keep top-level variables in the renderer's scope, rather than writing them to the store;
+        // so the store is left as it was, and can be shared between renderers. Scoped variables shadow the store's. Assigning to a path inside a
+        // variable from the store copies it into the scope first. Applies to the parse tree only; compiled programs always write to the store.
+        bool scopedAssigns = false;
+        // The variables the template has assigned, when scopedAssigns is set. Cleared at the start of every render, and kept after it, so that they
+        // can be written back. Variables that reference the store are held as references, and only cloned once something is assigned inside them.
+        unordered_map<string, Variant> scope;
+        // The clones made for the scope, which the renderer frees when the scope is cleared.
+        unordered_set<void*> scopeCopies;
+        // Stores beneath the one being rendered, consulted in order for any top-level variable it doesn't have; so that a large store that's the
+        // same for every render needn't be merged into each one. They're only ever read from, so can be shared between renderers on many threads,
+        // as long as the resolver's reads are thread safe. They must be readable by the renderer's resolver. With scopedAssigns, assigning inside
+        // a variable from a layer copies it into the scope, as with the store; without, such assignments fail.
+        vector<Variable> layers;
 
         bool internalRender = false;
 
@@ -124,9 +162,18 @@ namespace Liquid {
         void* customData = NULL;
         LiquidVariableResolver variableResolver;
         void* resolverCustomData = NULL;
+        // Where nodes created while rendering are allocated from; defaults to the context's.
+        std::pmr::memory_resource* memoryResource = nullptr;
+        // Set by a StaticRenderer, to read variables through its resolver's accessors; null for every other renderer, which pays only the check.
+        struct StaticReads {
+            Variant (*parseVariant)(Renderer& renderer, Variable variable, bool views);
+            std::pair<bool, Variable> (*getVariable)(Renderer& renderer, const Node& node, Variable store, size_t offset);
+        };
+        const StaticReads* staticReads = nullptr;
 
         Renderer(const Context& context);
         Renderer(const Context& context, LiquidVariableResolver variableResolver);
+        ~Renderer() { clearScope(); }
 
         vector<Error> errors;
         Variant renderArgument(const Node& ast, Variable store);
@@ -139,25 +186,105 @@ namespace Liquid {
             if (node.type) {
                 Node value = node.type->render(*this, node, store);
                 assert(!value.type);
+                if (maximumMemoryUsage)
+                    accountMemory(getMemoryUsage(value.variant));
                 return value;
             }
             return node;
         }
+        // Counts bytes allocated while rendering towards maximumMemoryUsage. Once they go over, flags the render as having exceeded it, and
+        // returns false; whatever was allocating should stop, and return as soon as it can.
+        bool accountMemory(size_t bytes) {
+            currentMemoryUsage += bytes;
+            if (maximumMemoryUsage && currentMemoryUsage > maximumMemoryUsage) {
+                error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY;
+                return false;
+            }
+            return true;
+        }
+        // As accountMemory, but doesn't count the bytes; for values being built that'll be counted once they're returned, to stop them before
+        // they get too large.
+        bool checkMemory(size_t bytes) {
+            return checkMemory(bytes, 1);
+        }
+        // As checkMemory, for count elements of size bytes each; without multiplying them, so that a huge count can't wrap around.
+        bool checkMemory(size_t count, size_t size) {
+            if (maximumMemoryUsage && (currentMemoryUsage > maximumMemoryUsage || count > (maximumMemoryUsage - currentMemoryUsage) / size)) {
+                error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY;
+                return false;
+            }
+            return true;
+        }
+        // The bytes a rendered value has allocated, beyond the value itself; not counting the contents of an array's elements.
+        static size_t getMemoryUsage(const Variant& variant) {
+            switch (variant.type) {
+                case Variant::Type::STRING:
+                    return variant.s.size();
+                case Variant::Type::ARRAY:
+                    return variant.a.size() * sizeof(Variant);
+                default:
+                    return 0;
+            }
+        }
         std::chrono::duration<unsigned int,std::milli> getRenderedTime() const;
+        // Counts a unit of work; a concatenated node, a loop iteration, or an interpreted instruction. Every so often, checks the rendering
+        // limits; once one's exceeded, flags the render as having run out of time, and returns false, at which point the caller should unwind.
+        bool step() { return ++currentRenderingSteps < nextLimitCheck || checkLimits(); }
+        // As step, for count units of work done at once.
+        bool step(unsigned long long count) { return (currentRenderingSteps += count) < nextLimitCheck || checkLimits(); }
+        bool checkLimits();
+        // Resets the limits' counters, for the start of a render.
+        void resetLimits();
 
         operator LiquidRenderer() { return LiquidRenderer {this}; }
 
         void inject(Variable& variable, const Variant& variant);
-        Variant parseVariant(Variable variable);
+        // Creates a string variable through createStringN if the resolver has it; otherwise through createString, copying the string if it isn't null terminated.
+        Variable createString(const char* str, size_t len);
+        // If views is true, and the resolver supports getStringView, strings come back as views into the store, rather than copies; only for callers
+        // that are done with the result before the render is.
+        Variant parseVariant(Variable variable, bool views = false);
         string getString(const Node& node);
 
 
 
+        // Uncompiled paths longer than this take more than one call to the resolver's resolvePath.
+        static constexpr size_t MAXIMUM_PATH_SEGMENTS = 16;
+        // Resolves as much of the path from offset as it can in one call to the resolver's resolvePath, handing it the node's compiled path as is
+        // where that covers the offset; returns the index of the first child it didn't.
+        size_t resolvePath(const Node& node, Variable store, size_t offset, Variable& target, bool& valid);
+        // Resolves the node's top-level variable from the store, or failing that, the first of the layers that has it; returns the index of the
+        // first child it didn't resolve, which is 0 if the path doesn't start with a name.
+        size_t resolveLayers(const Node& node, Variable store, Variable& target, bool& valid);
         std::pair<bool, Variable> getVariable(const Node& node, Variable store, size_t offset = 0);
         bool setVariable(const Node& node, Variable store, Variable value, size_t offset = 0);
+        // The scoped variable the node's path starts at, if there is one.
+        const Variant* getScopedVariable(const Node& node, Variable store);
+        // Resolves the rest of a variable's path from offset, starting at a value held by the renderer, rather than in the store.
+        Node resolveVariant(const Node& node, Variable store, const Variant& value, size_t offset, bool views = false);
+        // Sets a variable for assign and the like; in the scope if scopedAssigns is set, and in the store otherwise. Returns false if the path
+        // can't be assigned; with scopedAssigns, also pushes an LIQUID_RENDERER_ERROR_TYPE_INVALID_ASSIGNMENT error.
+        bool assignVariable(const Node& node, Variable store, Variant value);
+        // Sets the rest of a path from offset, inside a scoped value; arrays held by the renderer are changed in place, and variables cloned first.
+        bool assignVariant(const Node& node, Variable store, Variant& target, size_t offset, Variant value);
+        void clearScope();
+        // Writes every scoped variable into the top level of the store.
+        void writeBackScope(Variable store);
+
+        // Elements fetched from the resolver's getArrayVariables in one call.
+        static constexpr long long ITERATION_BLOCK_SIZE = 64;
+        // As the resolver's iterate, with the same start, limit and reverse semantics; but fetches the elements a block at a time through
+        // getArrayVariables, if the resolver has it, rather than being called back by the resolver for each of them.
+        bool iterate(Variable variable, bool (*callback)(void* variable, void* data), void* data, int start = 0, int limit = -1, bool reverse = false);
 
         const LiquidVariableResolver& getVariableResolver() const { return variableResolver; }
         bool resolveVariableString(string& target, void* variable) {
+            const char* view;
+            size_t viewLength;
+            if (variableResolver.getStringView && variableResolver.getStringView(LiquidRenderer { this }, variable, &view, &viewLength)) {
+                target.assign(view, viewLength);
+                return true;
+            }
             long long length = variableResolver.getStringLength(LiquidRenderer { this }, variable);
             if (length < 0)
                 return false;
@@ -167,6 +294,114 @@ namespace Liquid {
             return true;
         }
     };
+
+    // A renderer for C++ stores, that calls the resolver's accessors directly when reading variables, rather than through the function pointers
+    // of its LiquidVariableResolver; so that they can be inlined into the path walk, and each read is one call rather than several indirect ones.
+    // The reads are instantiated for the resolver here, and handed to the renderer as its staticReads, so the plain renderer's reads stay as
+    // they are. Paths the resolver's resolvePath can take, compiled or not, go to it in one call, as they do with the plain renderer; the
+    // accessors walk the rest. The resolver is still used, as normal, for everything else. Its type must derive from LiquidVariableResolver,
+    // and have a nested Static struct with:
+    //   static LiquidVariableType getType(void* variable);
+    //   static bool getBool(void* variable, bool& target);
+    //   static bool getInteger(void* variable, long long& target);
+    //   static bool getFloat(void* variable, double& target);
+    //   static bool getStringView(void* variable, const char*& target, size_t& length);
+    //   static bool getDictionaryVariable(void* variable, const string& key, void*& target);
+    //   static bool getArrayVariable(void* variable, long long idx, void*& target);
+    template <class Resolver>
+    struct StaticRenderer : Renderer {
+        typedef typename Resolver::Static Static;
+        static inline const StaticReads reads = { &StaticRenderer::readVariant, &StaticRenderer::readVariable };
+
+        StaticRenderer(const Context& context) : Renderer(context, Resolver()) { staticReads = &reads; }
+
+        static Variant readVariant(Renderer& renderer, Variable variable, bool views) {
+            switch (Static::getType(variable)) {
+                case LIQUID_VARIABLE_TYPE_OTHER:
+                case LIQUID_VARIABLE_TYPE_DICTIONARY:
+                case LIQUID_VARIABLE_TYPE_ARRAY:
+                    return Variant(Variable({variable}));
+                case LIQUID_VARIABLE_TYPE_BOOL: {
+                    bool b;
+                    if (Static::getBool(variable, b))
+                        return Variant(b);
+                } break;
+                case LIQUID_VARIABLE_TYPE_INT: {
+                    long long i;
+                    if (Static::getInteger(variable, i))
+                        return Variant(i);
+                } break;
+                case LIQUID_VARIABLE_TYPE_FLOAT: {
+                    double f;
+                    if (Static::getFloat(variable, f))
+                        return Variant(f);
+                } break;
+                case LIQUID_VARIABLE_TYPE_STRING: {
+                    const char* view;
+                    size_t length;
+                    if (Static::getStringView(variable, view, length))
+                        return views ? Variant(view, length) : Variant(string(view, length));
+                } break;
+                case LIQUID_VARIABLE_TYPE_NIL:
+                break;
+            }
+            return Variant();
+        }
+
+        static std::pair<bool, Variable> readVariable(Renderer& renderer, const Node& node, Variable store, size_t offset) {
+            void* storePointer = store.pointer;
+            bool valid = true;
+            size_t i = offset;
+            if (offset == 0 && !renderer.layers.empty()) {
+                Variable top = store;
+                i = renderer.resolveLayers(node, store, top, valid);
+                storePointer = top.pointer;
+            }
+            for (; valid && i < node.children.size(); ++i) {
+                if (renderer.variableResolver.resolvePath) {
+                    Variable target = { storePointer };
+                    size_t next = renderer.resolvePath(node, store, i, target, valid);
+                    if (next > i) {
+                        storePointer = target.pointer;
+                        i = next - 1;
+                        continue;
+                    }
+                }
+                const Node& link = *node.children[i].get();
+                if (!link.type) {
+                    // Literal keys and indices, by far the most common, are used in place.
+                    if (link.variant.type == Variant::Type::STRING)
+                        valid = Static::getDictionaryVariable(storePointer, link.variant.s, storePointer);
+                    else if (link.variant.type == Variant::Type::INT)
+                        valid = Static::getArrayVariable(storePointer, link.variant.i, storePointer);
+                    else
+                        valid = false;
+                    continue;
+                }
+                Node part = renderer.retrieveRenderedNode(link, store);
+                if (link.type->type == NodeType::DOT_FILTER && !part.type) {
+                    if (part.variant.type == Variant::Type::VARIABLE)
+                        storePointer = part.variant.v.pointer;
+                    else {
+                        Variable injected;
+                        renderer.inject(injected, part.variant);
+                        storePointer = injected.pointer;
+                    }
+                } else if (part.variant.type == Variant::Type::STRING)
+                    valid = Static::getDictionaryVariable(storePointer, part.variant.s, storePointer);
+                else if (part.variant.type == Variant::Type::INT)
+                    valid = Static::getArrayVariable(storePointer, part.variant.i, storePointer);
+                else
+                    valid = false;
+            }
+            if (!valid) {
+                storePointer = nullptr;
+                if (renderer.logUnknownVariables)
+                    renderer.pushUnknownVariableWarning(node, offset, store);
+            }
+            return { valid, Variable({ storePointer }) };
+        }
+    };
 }
 
 #endif
@@ -0,0 +1,398 @@
+#include "serializer.h"
+#include "context.h"
+
+#include <algorithm>
+
+namespace Liquid {
+
+    // Every file starts with this, in native byte order; it's not meant to be moved between machines, only between processes.
+    struct SerializedHeader {
+        char magic[4];
+        unsigned int version;
+        unsigned int kind;
+        unsigned int reserved;
+        unsigned long long fingerprint;
+        unsigned long long checksum;
+        unsigned long long size;
+    };
+
+    static const char SERIALIZED_MAGIC[4] = { 'L', 'Q', 'D', 'B' };
+    static constexpr unsigned int LITERAL_INDEX = 0xFFFFFFFF;
+    static constexpr unsigned int NULL_INDEX = 0xFFFFFFFE;
+    // Much deeper than the parser will ever go; stops a malicious file from exhausting the stack.
+    static constexpr unsigned int MAXIMUM_DEPTH = 1000;
+
+    static unsigned long long fnv(unsigned long long h, const char* data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)data[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+    static unsigned long long fnv(const char* data, size_t len) { return fnv(14695981039346656037ULL, data, len); }
+
+    static void addContextualType(vector<pair<string, const NodeType*>>& types, const string& name, const ContextualNodeType* type) {
+        for (auto& it : type->operators)
+            types.emplace_back(name + "/operator:" + it.first, it.second.get());
+        for (auto& it : type->filters)
+            types.emplace_back(name + "/filter:" + it.first, it.second.get());
+        if (type->type == NodeType::Type::TAG) {
+            const TagNodeType* tagType = static_cast<const TagNodeType*>(type);
+            for (auto& it : tagType->qualifiers)
+                types.emplace_back(name + "/qualifier:" + it.first, it.second.get());
+            for (auto& it : tagType->intermediates) {
+                string intermediateName = name + "/intermediate:" + it.first;
+                types.emplace_back(intermediateName, it.second.get());
+                if (it.second->type == NodeType::Type::TAG)
+                    addContextualType(types, intermediateName, static_cast<const ContextualNodeType*>(it.second.get()));
+            }
+        }
+    }
+
+    Serializer::Serializer(const Context& context) : context(context) {
+        types.emplace_back("builtin:concatenation", context.getConcatenationNodeType());
+        types.emplace_back("builtin:output", context.getOutputNodeType());
+        types.emplace_back("builtin:variable", context.getVariableNodeType());
+        types.emplace_back("builtin:group", context.getGroupNodeType());
+        types.emplace_back("builtin:groupDereference", context.getGroupDereferenceNodeType());
+        types.emplace_back("builtin:arguments", context.getArgumentsNodeType());
+        types.emplace_back("builtin:unknownFilter", context.getUnknownFilterNodeType());
+        types.emplace_back("builtin:arrayLiteral", context.getArrayLiteralNodeType());
+        types.emplace_back("builtin:contextBoundary", context.getContextBoundaryNodeType());
+        types.emplace_back("builtin:filterWildcardQualifier", context.getFilterWildcardQualifierNodeType());
+        addContextualType(types, "builtin:output", &context.outputNodeType);
+        for (auto& it : context.tagTypes) {
+            string name = "tag:" + it.first;
+            types.emplace_back(name, it.second.get());
+            addContextualType(types, name, static_cast<const ContextualNodeType*>(it.second.get()));
+        }
+        for (auto& it : context.unaryOperatorTypes)
+            types.emplace_back("unary:" + it.first, it.second.get());
+        for (auto& it : context.binaryOperatorTypes)
+            types.emplace_back("binary:" + it.first, it.second.get());
+        for (auto& it : context.filterTypes)
+            types.emplace_back("filter:" + it.first, it.second.get());
+        for (auto& it : context.dotFilterTypes)
+            types.emplace_back("dot:" + it.first, it.second.get());
+        for (auto& it : context.literalTypes)
+            types.emplace_back("literal:" + it.first, it.second.get());
+        // Sorted, so that the same dialect always gives the same indices, regardless of the order of its hash maps.
+        std::sort(types.begin(), types.end(), [](auto& a, auto& b) { return a.first < b.first; });
+        fingerprint = fnv((const char*)&VERSION, sizeof(VERSION));
+        for (size_t i = 0; i < types.size(); ++i) {
+            typeIndices[types[i].second] = i;
+            // The shape of each type goes in as well as its name, so that a type which changes how many children it takes is caught.
+            int shape[2] = { (int)types[i].second->type, types[i].second->maxChildren };
+            fingerprint = fnv(fingerprint, types[i].first.data(), types[i].first.size() + 1);
+            fingerprint = fnv(fingerprint, (const char*)shape, sizeof(shape));
+        }
+    }
+
+    struct SerializedWriter {
+        string buffer;
+
+        template <class T> void write(T value) { buffer.append((const char*)&value, sizeof(T)); }
+        void write(const char* data, size_t len) {
+            write<unsigned long long>(len);
+            buffer.append(data, len);
+        }
+    };
+
+    struct SerializedReader {
+        const char* data;
+        size_t offset;
+        size_t size;
+
+        void require(size_t len) const {
+            if (len > size - offset)
+                throw Liquid::Exception("Unable to deserialize; unexpected end of data at offset %lu.", (unsigned long)offset);
+        }
+        // Everything is copied out, as the data, if mapped, carries no alignment guarantees past the header.
+        template <class T> T read() {
+            T value;
+            require(sizeof(T));
+            memcpy(&value, &data[offset], sizeof(T));
+            offset += sizeof(T);
+            return value;
+        }
+        const char* read(size_t& len) {
+            len = read<unsigned long long>();
+            require(len);
+            const char* str = &data[offset];
+            offset += len;
+            return str;
+        }
+    };
+
+    static void serializeVariant(SerializedWriter& writer, const Variant& variant) {
+        writer.write<unsigned char>((unsigned char)variant.type);
+        switch (variant.type) {
+            case Variant::Type::NIL:
+            break;
+            case Variant::Type::BOOL:
+                writer.write<unsigned char>(variant.b);
+            break;
+            case Variant::Type::FLOAT:
+                writer.write<double>(variant.f);
+            break;
+            case Variant::Type::INT:
+                writer.write<long long>(variant.i);
+            break;
+            case Variant::Type::STRING:
+                writer.write(variant.s.data(), variant.s.size());
+            break;
+            case Variant::Type::STRING_VIEW:
+                writer.write(variant.view, variant.len);
+            break;
+            case Variant::Type::ARRAY:
+                writer.write<unsigned long long>(variant.a.size());
+                for (auto& element : variant.a)
+                    serializeVariant(writer, element);
+            break;
+            case Variant::Type::VARIABLE:
+            case Variant::Type::POINTER:
+                throw Liquid::Exception("Unable to serialize a tree that holds a reference to a variable.");
+        }
+    }
+
+    static void serializeNode(const Serializer& serializer, SerializedWriter& writer, const Node* node) {
+        if (!node) {
+            writer.write<unsigned int>(NULL_INDEX);
+            return;
+        }
+        if (node->type) {
+            auto it = serializer.typeIndices.find(node->type);
+            if (it == serializer.typeIndices.end())
+                throw Liquid::Exception("Unable to serialize node of type '%s'; it isn't part of the context.", node->type->symbol.c_str());
+            writer.write<unsigned int>(it->second);
+        } else
+            writer.write<unsigned int>(LITERAL_INDEX);
+        writer.write<unsigned int>(node->line);
+        writer.write<unsigned int>(node->column);
+        if (node->type) {
+            writer.write<unsigned int>(node->children.size());
+            for (auto& child : node->children)
+                serializeNode(serializer, writer, child.get());
+        } else
+            serializeVariant(writer, node->variant);
+    }
+
+    static string finalize(const Serializer& serializer, Serializer::Kind kind, const string& payload) {
+        SerializedHeader header;
+        memcpy(header.magic, SERIALIZED_MAGIC, sizeof(SERIALIZED_MAGIC));
+        header.version = Serializer::VERSION;
+        header.kind = (unsigned int)kind;
+        header.reserved = 0;
+        header.fingerprint = serializer.fingerprint;
+        header.checksum = fnv(payload.data(), payload.size());
+        header.size = payload.size();
+        string result;
+        result.reserve(sizeof(header) + payload.size());
+        result.append((const char*)&header, sizeof(header));
+        result.append(payload);
+        return result;
+    }
+
+    // Validates the header, and returns a reader positioned at the start of the payload.
+    static SerializedReader openPayload(const Serializer& serializer, Serializer::Kind kind, const char* data, size_t size) {
+        SerializedHeader header;
+        if (size < sizeof(header))
+            throw Liquid::Exception("Unable to deserialize; data is too short.");
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, SERIALIZED_MAGIC, sizeof(SERIALIZED_MAGIC)) != 0)
+            throw Liquid::Exception("Unable to deserialize; data is not a serialized liquid template or program.");
+        if (header.version != Serializer::VERSION)
+            throw Liquid::Exception("Unable to deserialize; data is version %u, expected version %u.", header.version, Serializer::VERSION);
+        if (header.kind != (unsigned int)kind)
+            throw Liquid::Exception("Unable to deserialize; data is a %s, not a %s.", header.kind == (unsigned int)Serializer::Kind::PROGRAM ? "program" : "template", kind == Serializer::Kind::PROGRAM ? "program" : "template");
+        if (header.fingerprint != serializer.fingerprint)
+            throw Liquid::Exception("Unable to deserialize; data was saved with a different dialect.");
+        if (header.size != size - sizeof(header))
+            throw Liquid::Exception("Unable to deserialize; data is truncated.");
+        if (header.checksum != fnv(data + sizeof(header), header.size))
+            throw Liquid::Exception("Unable to deserialize; checksum mismatch.");
+        return SerializedReader { data, sizeof(header), size };
+    }
+
+    static Variant deserializeVariant(SerializedReader& reader, unsigned int depth) {
+        if (depth > MAXIMUM_DEPTH)
+            throw Liquid::Exception("Unable to deserialize; tree is too deep.");
+        Variant::Type type = (Variant::Type)reader.read<unsigned char>();
+        switch (type) {
+            case Variant::Type::NIL:
+                return Variant();
+            case Variant::Type::BOOL:
+                return Variant(reader.read<unsigned char>() != 0);
+            case Variant::Type::FLOAT:
+                return Variant(reader.read<double>());
+            case Variant::Type::INT:
+                return Variant(reader.read<long long>());
+            case Variant::Type::STRING: {
+                size_t len;
+                const char* str = reader.read(len);
+                return Variant(string(str, len));
+            }
+            case Variant::Type::STRING_VIEW: {
+                size_t len;
+                const char* str = reader.read(len);
+                return Variant(str, len);
+            }
+            case Variant::Type::ARRAY: {
+                unsigned long long count = reader.read<unsigned long long>();
+                // Every element takes at least a byte, so this bounds the reservation.
+                reader.require(count);
+                vector<Variant> elements;
+                elements.reserve(count);
+                for (unsigned long long i = 0; i < count; ++i)
+                    elements.push_back(deserializeVariant(reader, depth + 1));
+                return Variant(move(elements));
+            }
+            default:
+                throw Liquid::Exception("Unable to deserialize; unknown variant type %d.", (int)type);
+        }
+    }
+
+    static unique_ptr<Node> deserializeNode(const Serializer& serializer, SerializedReader& reader, unsigned int depth) {
+        if (depth > MAXIMUM_DEPTH)
+            throw Liquid::Exception("Unable to deserialize; tree is too deep.");
+        unsigned int index = reader.read<unsigned int>();
+        if (index == NULL_INDEX)
+            return nullptr;
+        unique_ptr<Node> node;
+        if (index == LITERAL_INDEX) {
+            size_t line = reader.read<unsigned int>();
+            size_t column = reader.read<unsigned int>();
+            node = make_unique<Node>(deserializeVariant(reader, depth + 1));
+            node->line = line;
+            node->column = column;
+        } else {
+            if (index >= serializer.types.size())
+                throw Liquid::Exception("Unable to deserialize; unknown type index %u.", index);
+            node = make_unique<Node>(serializer.types[index].second);
+            node->line = reader.read<unsigned int>();
+            node->column = reader.read<unsigned int>();
+            unsigned int count = reader.read<unsigned int>();
+            // Every child takes at least four bytes.
+            reader.require((size_t)count * sizeof(unsigned int));
+            node->children.reserve(count);
+            for (unsigned int i = 0; i < count; ++i)
+                node->children.push_back(deserializeNode(serializer, reader, depth + 1));
+            if (node->type->type == NodeType::Type::VARIABLE)
+                node->compilePath();
+        }
+        return node;
+    }
+
+    string Serializer::serialize(const Node& node) const {
+        SerializedWriter writer;
+        serializeNode(*this, writer, &node);
+        return finalize(*this, Kind::TEMPLATE, writer.buffer);
+    }
+
+    // Walks each instruction in the code segment, calling back with the offset of the operand of every OP_CALL, which holds a NodeType pointer.
+    template <class T>
+    static void eachCallOperand(const vector<unsigned char>& code, size_t codeOffset, T callback) {
+        size_t i = codeOffset;
+        while (i < code.size()) {
+            if (code.size() - i < sizeof(unsigned int))
+                throw Liquid::Exception("Unable to deserialize; truncated instruction at offset %lu.", (unsigned long)i);
+            unsigned int instruction;
+            memcpy(&instruction, &code[i], sizeof(unsigned int));
+            i += sizeof(unsigned int);
+            OPCode opcode = (OPCode)(instruction & 0xFF);
+            if (opcode > OP_EXIT)
+                throw Liquid::Exception("Unable to deserialize; unknown opcode %u at offset %lu.", (unsigned int)opcode, (unsigned long)i);
+            if (operandSize(opcode)) {
+                if (code.size() - i < sizeof(long long))
+                    throw Liquid::Exception("Unable to deserialize; truncated instruction at offset %lu.", (unsigned long)i);
+                if (opcode == OP_CALL)
+                    callback(i);
+                i += sizeof(long long);
+            }
+        }
+    }
+
+    string Serializer::serialize(const Program& program) const {
+        SerializedWriter writer;
+        writer.write<unsigned int>(program.codeOffset);
+        writer.write((const char*)program.code.data(), program.code.size());
+        // Pointers become indices; the code is at a fixed offset from the start of the payload.
+        size_t base = writer.buffer.size() - program.code.size();
+        eachCallOperand(program.code, program.codeOffset, [&](size_t offset) {
+            long long pointer;
+            memcpy(&pointer, &program.code[offset], sizeof(long long));
+            auto it = typeIndices.find((const NodeType*)pointer);
+            if (it == typeIndices.end())
+                throw Liquid::Exception("Unable to serialize program; it calls a type that isn't part of the context.");
+            long long index = it->second;
+            memcpy(&writer.buffer[base + offset], &index, sizeof(long long));
+        });
+        return finalize(*this, Kind::PROGRAM, writer.buffer);
+    }
+
+    // Builds the tree from the template's source, which holds the serialized data; all text in the tree points back into it.
+    static void bindTemplate(const Serializer& serializer, Template& tmpl) {
+        SerializedReader reader = openPayload(serializer, Serializer::Kind::TEMPLATE, tmpl.source, tmpl.size);
+        std::pmr::memory_resource* memoryResource = serializer.context.memoryResource;
+        tmpl.arena = make_unique<std::pmr::monotonic_buffer_resource>(std::max(tmpl.size, (size_t)1024), memoryResource ? memoryResource : std::pmr::new_delete_resource());
+        Node::ResourceScope scope(tmpl.arena.get());
+        unique_ptr<Node> node = deserializeNode(serializer, reader, 0);
+        if (!node)
+            throw Liquid::Exception("Unable to deserialize; template has no root.");
+        tmpl.ast = move(*node.get());
+        tmpl.serialized = true;
+    }
+
+    Template Serializer::deserializeTemplate(const char* data, size_t size) const {
+        Template tmpl;
+        char* source = new char[size+1];
+        memcpy(source, data, size);
+        source[size] = 0;
+        tmpl.source = source;
+        tmpl.size = size;
+        bindTemplate(*this, tmpl);
+        return tmpl;
+    }
+
+    Program Serializer::deserializeProgram(const char* data, size_t size) const {
+        SerializedReader reader = openPayload(*this, Kind::PROGRAM, data, size);
+        Program program;
+        program.codeOffset = reader.read<unsigned int>();
+        size_t len;
+        const char* code = reader.read(len);
+        if (program.codeOffset > len)
+            throw Liquid::Exception("Unable to deserialize; code offset out of range.");
+        program.code.assign((const unsigned char*)code, (const unsigned char*)code + len);
+        eachCallOperand(program.code, program.codeOffset, [&](size_t offset) {
+            long long index;
+            memcpy(&index, &program.code[offset], sizeof(long long));
+            if (index < 0 || index >= (long long)types.size())
+                throw Liquid::Exception("Unable to deserialize; unknown type index %lld.", index);
+            long long pointer = (long long)types[index].second;
+            memcpy(&program.code[offset], &pointer, sizeof(long long));
+        });
+        return program;
+    }
+
+    void Serializer::saveFile(const string& path, const string& data) const {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            throw Liquid::Exception("Unable to open file %s.", path.c_str());
+        size_t written = fwrite(data.data(), 1, data.size(), file);
+        if (fclose(file) != 0 || written != data.size())
+            throw Liquid::Exception("Unable to write file %s.", path.c_str());
+    }
+
+    Template Serializer::loadTemplate(const string& path) const {
+        Template tmpl;
+        tmpl.read(path);
+        bindTemplate(*this, tmpl);
+        return tmpl;
+    }
+
+    Program Serializer::loadProgram(const string& path) const {
+        Template file;
+        file.read(path);
+        return deserializeProgram(file.source, file.size);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef LIQUIDSERIALIZER_H
+#define LIQUIDSERIALIZER_H
+
+#include "common.h"
+#include "parser.h"
+#include "compiler.h"
+
+namespace Liquid {
+    struct Context;
+
+    // Saves parsed templates and compiled programs in a binary format, and loads them back again, so that the parser doesn't need to be run at boot.
+    // Node types are saved by their position in the context (e.g. the "elsif" intermediate of the "if" tag), and bound back to the types of the
+    // context the serializer is created with when loaded. Everything saved carries a fingerprint of the context's dialect; anything saved against a
+    // context with a different set of types is rejected, as is anything whose contents don't match its checksum, or saved with a different version.
+    // All failures throw a Liquid::Exception.
+    struct Serializer {
+        static constexpr unsigned int VERSION = 1;
+
+        enum class Kind {
+            TEMPLATE = 1,
+            PROGRAM = 2
+        };
+
+        const Context& context;
+        // Every type in the context, indexed by its name, and back again.
+        vector<pair<string, const NodeType*>> types;
+        unordered_map<const NodeType*, unsigned int> typeIndices;
+        unsigned long long fingerprint;
+
+        // The context must have all its dialects implemented before this is created, and not be modified afterwards.
+        Serializer(const Context& context);
+
+        string serialize(const Node& node) const;
+        string serialize(const Template& tmpl) const { return serialize(tmpl.ast); }
+        string serialize(const Program& program) const;
+
+        // Text in the loaded tree is stored as views into the template's source, which holds the serialized data.
+        // As such, loaded templates can be rendered, optimized and compiled as normal, but not reparsed.
+        Template deserializeTemplate(const char* data, size_t size) const;
+        Template deserializeTemplate(const string& data) const { return deserializeTemplate(data.data(), data.size()); }
+        Program deserializeProgram(const char* data, size_t size) const;
+        Program deserializeProgram(const string& data) const { return deserializeProgram(data.data(), data.size()); }
+
+        void saveFile(const string& path, const string& data) const;
+        void saveTemplate(const string& path, const Template& tmpl) const { saveFile(path, serialize(tmpl)); }
+        void saveProgram(const string& path, const Program& program) const { saveFile(path, serialize(program)); }
+        // Memory maps the file where possible; the loaded tree's text points straight into the mapping.
+        Template loadTemplate(const string& path) const;
+        Program loadProgram(const string& path) const;
+    };
+}
+
+#endif
@@ -7,16 +7,87 @@
 #include <openssl/sha.h>
 #include <openssl/hmac.h>
 #include <cmath>
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
 
 namespace Liquid {
 
+    // Escape and url_encode run on nearly every output, and most of what they're given needs nothing done to it; so they scan for the first
+    // character that does, sixteen bytes at a time where SSE2 is available, copy clean runs whole, and hand back a string that needs nothing
+    // done to it as it is.
+    static bool isHTMLSpecial(unsigned char c) {
+        return c == '\'' || c == '"' || c == '<' || c == '>' || c == '&';
+    }
+
+    static bool isURLSafe(unsigned char c) {
+        return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z');
+    }
+
+    // Returns the offset of the first character from offset that escape replaces, or size if there isn't one.
+    static size_t findHTMLSpecial(const char* data, size_t offset, size_t size) {
+        #if defined(__SSE2__)
+            const __m128i apos = _mm_set1_epi8('\''), quot = _mm_set1_epi8('"'), lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), amp = _mm_set1_epi8('&');
+            for (; offset + 16 <= size; offset += 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)(data + offset));
+                __m128i hits = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, apos), _mm_cmpeq_epi8(chunk, quot)),
+                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt)), _mm_cmpeq_epi8(chunk, amp))
+                );
+                if (int mask = _mm_movemask_epi8(hits))
+                    return offset + __builtin_ctz(mask);
+            }
+        #endif
+        while (offset < size && !isHTMLSpecial(data[offset]))
+            ++offset;
+        return offset;
+    }
+
+    // Returns the offset of the first character from offset that url_encode replaces, or size if there isn't one.
+    static size_t findURLUnsafe(const char* data, size_t offset, size_t size) {
+        #if defined(__SSE2__)
+            // Comparisons are signed, so anything past ASCII falls outside every range.
+            const __m128i case_ = _mm_set1_epi8(0x20), beforeA = _mm_set1_epi8('a' - 1), afterZ = _mm_set1_epi8('z' + 1), before0 = _mm_set1_epi8('0' - 1), after9 = _mm_set1_epi8('9' + 1);
+            for (; offset + 16 <= size; offset += 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)(data + offset));
+                // Folding the case bit maps exactly A-Z onto a-z.
+                __m128i lower = _mm_or_si128(chunk, case_);
+                __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(lower, beforeA), _mm_cmpgt_epi8(afterZ, lower));
+                __m128i digits = _mm_and_si128(_mm_cmpgt_epi8(chunk, before0), _mm_cmpgt_epi8(after9, chunk));
+                if (int mask = ~_mm_movemask_epi8(_mm_or_si128(letters, digits)) & 0xFFFF)
+                    return offset + __builtin_ctz(mask);
+            }
+        #endif
+        while (offset < size && isURLSafe(data[offset]))
+            ++offset;
+        return offset;
+    }
+
+    // Points data at the contents of a rendered string, without copying it; returns false for anything else.
+    static bool getStringData(const Node& node, const char*& data, size_t& size) {
+        if (node.type)
+            return false;
+        if (node.variant.type == Variant::Type::STRING) {
+            data = node.variant.s.data();
+            size = node.variant.s.size();
+            return true;
+        }
+        if (node.variant.type == Variant::Type::STRING_VIEW) {
+            data = node.variant.view;
+            size = node.variant.len;
+            return true;
+        }
+        return false;
+    }
+
     struct EscapeFilterNode : FilterNodeType {
-        static string htmlEscape(const string& incoming) {
-            string result;
-            result.reserve(int(incoming.size()*1.10));
-            for (size_t i = 0; i < incoming.size(); ++i) {
-                char c = incoming[i];
-                switch (c) {
+        // Appends the escaped string to result; first is the offset of the first character that needs escaping.
+        static void htmlEscape(const char* data, size_t size, size_t first, string& result) {
+            result.reserve(result.size() + size + size / 8);
+            size_t start = 0;
+            for (size_t i = first; i < size; i = findHTMLSpecial(data, start, size)) {
+                result.append(&data[start], i - start);
+                switch (data[i]) {
                     case '\'':
                         result += "&apos;";
                     break;
@@ -32,41 +103,77 @@ namespace Liquid {
                     case '&':
                         result += "&amp;";
                     break;
-                    default:
-                        result += c;
                 }
+                start = i + 1;
             }
+            result.append(&data[start], size - start);
+        }
+
+        static string htmlEscape(const string& incoming) {
+            size_t first = findHTMLSpecial(incoming.data(), 0, incoming.size());
+            if (first == incoming.size())
+                return incoming;
+            string result;
+            htmlEscape(incoming.data(), incoming.size(), first, result);
             return result;
         }
 
         EscapeFilterNode() : FilterNodeType("escape", 0, 0) { }
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            return Variant(htmlEscape(renderer.retrieveRenderedNode(*node.children.front().get(), store).getString()));
+            Node operand = getOperand(renderer, node, store);
+            const char* data;
+            size_t size;
+            if (!getStringData(operand, data, size))
+                return Variant(htmlEscape(operand.getString()));
+            size_t first = findHTMLSpecial(data, 0, size);
+            if (first == size)
+                return operand;
+            string result;
+            htmlEscape(data, size, first, result);
+            return Variant(move(result));
         }
     };
 
     static const char hexDigits[] = "0123456789abcdef";
 
     struct URLEncodeFilterNode : FilterNodeType {
+        // Appends the encoded string to result; first is the offset of the first character that needs encoding.
+        static void paramEncode(const char* data, size_t size, size_t first, string& result) {
+            result.reserve(result.size() + size + size / 4);
+            size_t start = 0;
+            for (size_t i = first; i < size; i = findURLUnsafe(data, start, size)) {
+                result.append(&data[start], i - start);
+                unsigned char c = data[i];
+                result += '%';
+                result += hexDigits[c >> 4];
+                result += hexDigits[c & 0xF];
+                start = i + 1;
+            }
+            result.append(&data[start], size - start);
+        }
+
         static string paramEncode(const string& incoming) {
+            size_t first = findURLUnsafe(incoming.data(), 0, incoming.size());
+            if (first == incoming.size())
+                return incoming;
             string result;
-            result.reserve(int(incoming.size()*1.10));
-            for (size_t i = 0; i < incoming.size(); ++i) {
-                char c = incoming[i];
-                if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z'))
-                    result += c;
-                else {
-                    result += '%';
-                    result += hexDigits[c >> 4];
-                    result += hexDigits[c & 0xF];
-                }
-            }
+            paramEncode(incoming.data(), incoming.size(), first, result);
             return result;
         }
 
         URLEncodeFilterNode() : FilterNodeType("url_encode", 0, 0) { }
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            return Variant(paramEncode(renderer.retrieveRenderedNode(*node.children.front().get(), store).getString()));
+            Node operand = getOperand(renderer, node, store);
+            const char* data;
+            size_t size;
+            if (!getStringData(operand, data, size))
+                return Variant(paramEncode(operand.getString()));
+            size_t first = findURLUnsafe(data, 0, size);
+            if (first == size)
+                return operand;
+            string result;
+            paramEncode(data, size, first, result);
+            return Variant(move(result));
         }
     };
 
@@ -6,9 +6,15 @@
 #include "../src/optimizer.h"
 #include "../src/dialect.h"
 #include "../src/cppvariable.h"
+#include "../src/compactvariable.h"
+#include "../src/jsonstore.h"
+#include "../src/loader.h"
+#include "../src/serializer.h"
 
 #include <gtest/gtest.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace std;
 using namespace Liquid;
@@ -199,6 +205,625 @@ TEST(sanity, dereference) {
     ASSERT_EQ(str, "asdbfsdf 2 b");
 }
 
+static int pathLookups = 0;
+static int segmentLookups = 0;
+
+TEST(sanity, paths) {
+    CPPVariable variable, product, variant;
+    variant["price"] = 5;
+    product["variants"] = CPPVariable({ 1, 2 });
+    product["variants"][1] = std::move(variant);
+    variable["product"] = std::move(product);
+    variable["i"] = 1;
+
+    LiquidVariableResolver resolver = CPPVariableResolver();
+    static LiquidVariableResolver base = resolver;
+    resolver.resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+        ++pathLookups;
+        return base.resolvePath(renderer, variable, segments, count, target);
+    };
+    resolver.getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
+        ++segmentLookups;
+        return base.getDictionaryVariable(renderer, variable, key, target);
+    };
+    Renderer renderer(getContext(), resolver);
+    // The index is a path of its own.
+    auto ast = getParser().parse("{{ product.variants[1].price }}{{ product.variants[i].price }}{{ product.variants.size }}{{ product.missing.price }}");
+    ASSERT_EQ(renderer.render(ast, variable), "552");
+    ASSERT_EQ(pathLookups, 5);
+    ASSERT_EQ(segmentLookups, 0);
+
+    resolver.resolvePath = nullptr;
+    Renderer segmentRenderer(getContext(), resolver);
+    pathLookups = 0;
+    ASSERT_EQ(segmentRenderer.render(ast, variable), "552");
+    ASSERT_EQ(pathLookups, 0);
+    ASSERT_EQ(segmentLookups, 11);
+}
+
+static int unhashedSegments = 0;
+
+TEST(sanity, compiledPaths) {
+    CPPVariable variable, product;
+    product["variants"] = CPPVariable({ 1, 2, 3 });
+    product["title"] = "Hat";
+    variable["product"] = std::move(product);
+    variable["i"] = 2;
+
+    auto ast = getParser().parse("{{ product.title }}{{ product.variants[1] }}{{ product.variants[i] }}{{ product.variants.size }}");
+    const Node& output = *ast.children[0].get();
+    const Node& variableNode = *output.children[0]->children[0].get();
+    ASSERT_TRUE(variableNode.path);
+    ASSERT_EQ(variableNode.path->segments.size(), 2U);
+    ASSERT_EQ(variableNode.path->segments[1].hash, liquidHashKey("title", 5));
+
+    LiquidVariableResolver resolver = CPPVariableResolver();
+    static LiquidVariableResolver base = resolver;
+    resolver.resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+        for (size_t i = 0; i < count; ++i) {
+            if (segments[i].type == LIQUID_PATH_SEGMENT_TYPE_KEY && segments[i].hash != liquidHashKey(segments[i].key, segments[i].keyLength))
+                ++unhashedSegments;
+        }
+        return base.resolvePath(renderer, variable, segments, count, target);
+    };
+    Renderer renderer(getContext(), resolver);
+    ASSERT_EQ(renderer.render(ast, variable), "Hat233");
+    // Copies of the tree carry their own paths.
+    Node copy = ast;
+    ast = Node();
+    ASSERT_EQ(renderer.render(copy, variable), "Hat233");
+    ASSERT_EQ(unhashedSegments, 0);
+}
+
+static int stringCopies = 0;
+
+TEST(sanity, stringViews) {
+    CPPVariable variable;
+    variable["a"] = std::string("x\0y", 3);
+
+    LiquidVariableResolver resolver = CPPVariableResolver();
+    static LiquidVariableResolver base = resolver;
+    resolver.getString = +[](LiquidRenderer renderer, void* variable, char* target) {
+        ++stringCopies;
+        return base.getString(renderer, variable, target);
+    };
+    Renderer renderer(getContext(), resolver);
+    // Embedded nulls survive both being read from, and written back to the store.
+    auto ast = getParser().parse("{{ a }}{% capture b %}{{ a }}{% endcapture %}{{ b | size }}{{ a | upcase }}");
+    ASSERT_EQ(renderer.render(ast, variable), std::string("x\0y3X\0Y", 7));
+    ASSERT_EQ(stringCopies, 0);
+
+    resolver.getStringView = nullptr;
+    Renderer copyingRenderer(getContext(), resolver);
+    ASSERT_EQ(copyingRenderer.render(getParser().parse("{{ a | size }}"), variable), "3");
+    ASSERT_EQ(stringCopies, 1);
+
+    // Without createStringN, views are copied out to terminate them, whatever follows them; the literal here runs straight into the tag's quote.
+    resolver.createStringN = nullptr;
+    Renderer terminatingRenderer(getContext(), resolver);
+    ASSERT_EQ(terminatingRenderer.render(getParser().parse("{% assign c = 'abc' %}{% assign d = c %}{{ d }}{{ d | size }}"), variable), "abc3");
+    ASSERT_EQ(variable["c"].s, "abc");
+}
+
+static int pathResolutions = 0;
+// Counts the paths handed to resolvePath; the accessors are CPPVariableResolver's own.
+struct PathCountingResolver : CPPVariableResolver {
+    PathCountingResolver() {
+        resolvePath = +[](LiquidRenderer renderer, void* variable, const LiquidPathSegment* segments, size_t count, void** target) {
+            static const LiquidVariableResolver base = CPPVariableResolver();
+            ++pathResolutions;
+            return base.resolvePath(renderer, variable, segments, count, target);
+        };
+    }
+};
+
+TEST(sanity, staticRenderer) {
+    CPPVariable variable, product;
+    product["title"] = "Hat";
+    product["price"] = 2.5;
+    product["available"] = true;
+    product["tags"] = CPPVariable({ "a", "b", "c" });
+    variable["product"] = std::move(product);
+    variable["i"] = 2;
+
+    StaticRenderer<CPPVariableResolver> renderer(getContext());
+    auto ast = getParser().parse("{{ product.title }} {{ product.price }} {{ product.available }} {{ product.tags[i] }} {{ product.tags.size }} {{ product.tags.first }}"
+        "{% for tag in product.tags %}{{ tag }}{{ forloop.index }}{% endfor %}{% assign x = product.tags[-1] %}{{ x }}{{ product.missing.title }}{{ product[\"title\"] }}");
+    ASSERT_EQ(renderer.render(ast, variable), "Hat 2.5 true c 3 aa1b2c3cHat");
+    ASSERT_EQ(renderer.render(ast, variable), getRenderer().render(ast, variable));
+
+    // Whole paths still go to the resolver's resolvePath, compiled paths included; the accessors only walk what it can't take.
+    StaticRenderer<PathCountingResolver> countingRenderer(getContext());
+    pathResolutions = 0;
+    ast = getParser().parse("{{ product.title }} {{ product.tags[1] }} {{ product.tags.first }}");
+    ASSERT_EQ(countingRenderer.render(ast, variable), "Hat b a");
+    ASSERT_EQ(pathResolutions, 3);
+    countingRenderer.variableResolver.resolvePath = nullptr;
+    ASSERT_EQ(countingRenderer.render(ast, variable), "Hat b a");
+    ASSERT_EQ(pathResolutions, 3);
+}
+
+TEST(sanity, compactVariables) {
+    CPPVariable variable, product;
+    product["title"] = "Wide Brimmed Hat";
+    product["price"] = 2.5;
+    product["available"] = true;
+    product["tags"] = CPPVariable({ "a", "b", "c" });
+    variable["product"] = std::move(product);
+    variable["i"] = 2;
+
+    CompactStore store;
+    CompactVariable compactProduct = store.dictionary();
+    store.set(compactProduct, "title", store.string("Wide Brimmed Hat"));
+    store.set(compactProduct, "price", 2.5);
+    store.set(compactProduct, "available", true);
+    CompactVariable tags = store.array();
+    for (auto tag : { "a", "b", "c" })
+        store.push(tags, store.string(tag));
+    store.set(compactProduct, "tags", tags);
+    store.set(store.root, "product", compactProduct);
+    store.set(store.root, "i", 2);
+    ASSERT_EQ(sizeof(CompactVariable), 16);
+
+    Renderer renderer(getContext(), CompactVariableResolver());
+    renderer.resolverCustomData = &store;
+    auto ast = getParser().parse("{{ product.title }} {{ product.price }} {{ product.available }} {{ product.tags[i] }} {{ product.tags.size }} {{ product.tags.first }}"
+        "{% for tag in product.tags %}{% assign last = tag | append: forloop.index %}{% assign product.title = product.title | upcase %}{{ last }}{% endfor %}"
+        "{{ last }} {{ product.title }} {{ product.missing.title }}{{ product[\"title\"] | size }}{% assign z = product.tags | join: \",\" %}{{ z }}");
+    // The assignments persist in both stores, so each render should see the same changes.
+    ASSERT_EQ(renderer.render(ast, store), getRenderer().render(ast, variable));
+    ASSERT_EQ(renderer.render(ast, store), getRenderer().render(ast, variable));
+    StaticRenderer<CompactVariableResolver> staticRenderer(getContext());
+    staticRenderer.resolverCustomData = &store;
+    ASSERT_EQ(staticRenderer.render(ast, store), getRenderer().render(ast, variable));
+
+    // Growing an array copies its elements to a larger block; every variable holding it shares the header, so all of them see the growth.
+    for (int i = 0; i < 100; ++i)
+        store.push(tags, store.string("t" + std::to_string(i)));
+    ast = getParser().parse("{{ product.tags.size }} {{ product.tags[2] }} {{ product.tags.last }} {% for tag in product.tags offset: 101 %}{{ tag }}{% endfor %}");
+    ASSERT_EQ(renderer.render(ast, store), "103 c t99 t98t99");
+
+    // Growing a dictionary leaves its old entries behind, so pointers taken before then go stale.
+    CompactVariable counts = store.dictionary(1);
+    CompactVariable* first = store.append(counts, "a", 1);
+    store.append(counts, "b", 2);
+    CompactVariable* moved;
+    ASSERT_TRUE(counts.getDictionaryVariable("a", moved));
+    ASSERT_NE(first, moved);
+    store.set(store.root, "counts", counts);
+    ast = getParser().parse("{% assign counts.a = 3 %}{% assign counts.c = counts.a | plus: counts.b %}{{ counts.a }}{{ counts.b }}{{ counts.c }}");
+    ASSERT_EQ(renderer.render(ast, store), "325");
+    ASSERT_EQ(first->i, 1);
+}
+
+TEST(sanity, scopedAssigns) {
+    CPPVariable variable, product;
+    product["title"] = "Hat";
+    product["tags"] = CPPVariable({ "a", "b", "c" });
+    variable["product"] = std::move(product);
+    variable["n"] = 1;
+
+    Renderer renderer(getContext(), CPPVariableResolver());
+    renderer.scopedAssigns = true;
+    auto ast = getParser().parse("{% assign x = product.title | upcase %}{% assign t = product.tags %}{% capture c %}{{ x }}!{% endcapture %}{% assign n = n | plus: 1 %}{% increment n %}"
+        "{{ x }} {{ c }} {{ n }} {{ t[1] }} {{ t.size }} {% assign parts = \"a,b,c\" | split: \",\" %}{{ parts[-1] }}{{ parts.size }}{% for p in parts reversed %}{{ p }}{% endfor %}");
+    ASSERT_EQ(renderer.render(ast, variable), "HAT HAT! 3 b 3 c3cba");
+    // The store is left alone, so rendering again gives the same result.
+    ASSERT_EQ(variable.d.count("x"), 0);
+    ASSERT_EQ(variable["n"].i, 1);
+    ASSERT_EQ(renderer.render(ast, variable), "HAT HAT! 3 b 3 c3cba");
+
+    renderer.writeBackScope(variable);
+    ASSERT_EQ(variable["x"].s, "HAT");
+    ASSERT_EQ(variable["n"].i, 3);
+
+    // Paths into the store write to a copy in the scope, whether they're reached through a scoped variable or not.
+    ast = getParser().parse("{% assign t = product %}{% assign t.title = \"Cap\" %}{% assign product.tags[0] = \"z\" %}{{ t.title }} {{ product.title }} {{ product.tags[0] }}");
+    ASSERT_EQ(renderer.render(ast, variable), "Cap Hat z");
+    ASSERT_EQ(variable["product"]["title"].s, "Hat");
+    ASSERT_EQ(variable["product"]["tags"][0].s, "a");
+    ASSERT_EQ(renderer.render(ast, variable), "Cap Hat z");
+
+    // Arrays held by the scope are changed in place; paths that can't be assigned are reported.
+    ast = getParser().parse("{% assign x = \"a,b\" | split: \",\" %}{% assign y = x %}{% assign x[0] = \"z\" %}{% assign x[-1] = \"y\" %}{% assign x[3] = \"w\" %}"
+        "{{ x | join: \"-\" }} {{ y | join: \"-\" }}{% assign x.first.other = 1 %}{% assign missing.key = 1 %}");
+    ASSERT_EQ(renderer.render(ast, variable), "z-y--w a-b");
+    ASSERT_EQ(renderer.errors.size(), 2);
+    ASSERT_EQ(renderer.errors[0].type, LIQUID_RENDERER_ERROR_TYPE_INVALID_ASSIGNMENT);
+    ASSERT_EQ(std::string(renderer.errors[1].details.args[0]), "missing");
+
+    // Inside a loop, its variable shadows the store's of the same name, and isn't written through; paths into anything else resolve as they're
+    // read, through the layers, even from inside the loop.
+    CPPVariable shop;
+    shop["shop"]["currency"] = "CAD";
+    variable["p"]["title"] = "Store";
+    renderer.layers = { Variable({ &shop }) };
+    ast = getParser().parse("{% for p in product.tags %}{% for q in product.tags limit: 1 %}{% assign p.title = q %}{% assign shop.currency = p %}{% endfor %}{% endfor %}"
+        "{{ p.title }} {{ shop.currency }}");
+    ASSERT_EQ(renderer.render(ast, variable), "Store c");
+    ASSERT_EQ(renderer.errors.size(), 3);
+    ASSERT_EQ(std::string(renderer.errors[0].details.args[0]), "p");
+    ASSERT_EQ(renderer.scope.count("p"), 0);
+    ASSERT_EQ(shop["shop"]["currency"].s, "CAD");
+    ASSERT_EQ(variable["p"]["title"].s, "Store");
+    renderer.layers.clear();
+
+    // Without scopedAssigns, assignments that can't be made are silently skipped, as they always were.
+    Renderer unscoped(getContext(), CPPVariableResolver());
+    ASSERT_EQ(unscoped.render(getParser().parse("{% assign product.title.key = 1 %}{{ product.title }}"), variable), "Hat");
+    ASSERT_EQ(unscoped.errors.size(), 0);
+}
+
+TEST(sanity, layers) {
+    CPPVariable shop, settings, request;
+    settings["currency"] = "CAD";
+    shop["settings"] = std::move(settings);
+    shop["title"] = "Shop";
+    shop["n"] = 5;
+    request["title"] = "Page";
+    request["n"] = 2;
+
+    Renderer renderer(getContext(), CPPVariableResolver());
+    renderer.layers.push_back(shop);
+    auto ast = getParser().parse("{{ title }} {{ settings.currency }} {{ settings.currency.size }} {{ n | plus: 1 }} {{ missing }}{% assign settings = 1 %}{{ settings }}");
+    ASSERT_EQ(renderer.render(ast, request), "Page CAD 3 3 1");
+    // Assignments go to the top store; the layer beneath is never written.
+    ASSERT_EQ(request["settings"].i, 1);
+    ASSERT_EQ(shop["settings"].type, LIQUID_VARIABLE_TYPE_DICTIONARY);
+
+    // Assigning inside a layer's variables writes to a copy, so another renderer over the same layer never sees it.
+    renderer.scopedAssigns = true;
+    ast = getParser().parse("{% assign s = settings %}{% assign s.currency = \"XXX\" %}{% assign settings.locale = \"fr\" %}{{ s.currency }} {{ settings.currency }} {{ settings.locale }}");
+    CPPVariable page;
+    ASSERT_EQ(renderer.render(ast, page), "XXX CAD fr");
+    ASSERT_EQ(shop["settings"]["currency"].s, "CAD");
+    ASSERT_EQ(shop["settings"].d.count("locale"), 0);
+    Renderer second(getContext(), CPPVariableResolver());
+    second.layers.push_back(shop);
+    ASSERT_EQ(second.render(getParser().parse("{{ settings.currency }}{{ settings.locale }}"), page), "CAD");
+
+    CPPVariable other;
+    StaticRenderer<CPPVariableResolver> staticRenderer(getContext());
+    staticRenderer.layers.push_back(shop);
+    ASSERT_EQ(staticRenderer.render(getParser().parse("{{ title }} {{ settings.currency }}"), other), "Shop CAD");
+
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    interpreter.layers.push_back(shop);
+    ASSERT_EQ(interpreter.renderTemplate(getCompiler().compile(getParser().parse("{{ title }} {{ settings.currency }}")), other), "Shop CAD");
+}
+
+TEST(sanity, blockIteration) {
+    CPPVariable variable, numbers = CPPVariable({ });
+    for (int i = 0; i < 150; ++i)
+        numbers.a.push_back(make_unique<CPPVariable>((long long)i));
+    variable["numbers"] = std::move(numbers);
+
+    static int blocks, iterations;
+    CPPVariableResolver blockResolver, elementResolver;
+    blockResolver.getArrayVariables = +[](LiquidRenderer renderer, void* variable, long long idx, long long count, void** targets) {
+        ++blocks;
+        return static_cast<CPPVariable*>(variable)->getArrayVariables(idx, count, targets);
+    };
+    blockResolver.iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+        ++iterations;
+        return static_cast<CPPVariable*>(variable)->iterate(callback, data, start, limit, reverse);
+    };
+    elementResolver.getArrayVariables = nullptr;
+
+    Renderer blockRenderer(getContext(), blockResolver), elementRenderer(getContext(), elementResolver);
+    const char* templates[] = {
+        "{% for i in numbers %}{{ i }},{% endfor %}",
+        "{% for i in numbers reversed %}{{ i }},{% endfor %}",
+        "{% for i in numbers offset: 10 limit: 100 %}{{ i }},{% endfor %}",
+        "{% for i in numbers offset: 70 limit: 70 reversed %}{{ i }},{% endfor %}",
+        "{% for i in numbers offset: 140 limit: 100 %}{{ i }},{% endfor %}",
+        "{% for i in numbers %}{% if i == 100 %}{% break %}{% endif %}{{ i }},{% endfor %}",
+        "{{ numbers | join: '-' }}",
+        "{{ numbers | uniq | size }}"
+    };
+    for (const char* tmpl : templates) {
+        auto ast = getParser().parse(tmpl);
+        blocks = 0;
+        iterations = 0;
+        ASSERT_EQ(blockRenderer.render(ast, variable), elementRenderer.render(ast, variable));
+        ASSERT_EQ(iterations, 0);
+        ASSERT_LE(blocks, 3);
+    }
+    // Variables that aren't arrays still go through iterate.
+    ASSERT_EQ(blockRenderer.render(getParser().parse("{% for i in missing %}{{ i }}{% endfor %}"), variable), "");
+}
+
+TEST(sanity, memoryLimit) {
+    CPPVariable variable, list = CPPVariable({ });
+    for (int i = 0; i < 100; ++i)
+        list.a.push_back(make_unique<CPPVariable>((long long)i));
+    variable["list"] = std::move(list);
+    variable["csv"] = std::string(10000, ',') + "a,b";
+
+    Renderer renderer(getContext());
+    renderer.maximumMemoryUsage = 1024*1024;
+    ASSERT_EQ(renderer.render(getParser().parse("{% for i in (1..5) %}{{ i }}{% endfor %} {{ csv | split: ',' | size }}"), variable), "12345 2");
+    // Large ranges are allowed when there's a limit to stop them.
+    ASSERT_EQ(renderer.render(getParser().parse("{% for i in (1..20000) %}{% endfor %}done"), variable), "done");
+
+    renderer.maximumMemoryUsage = 4096;
+    try {
+        renderer.render(getParser().parse("{% assign a = 'x' %}{% for i in (1..30) %}{% assign a = a | append: a %}{% endfor %}{{ a }}"), variable);
+        FAIL();
+    } catch (Renderer::Exception& exception) {
+        ASSERT_EQ(exception.rendererError.type, LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY);
+    }
+    variable["csv"] = std::string(10000, 'a') + "," + std::string(10000, 'b');
+    ASSERT_THROW(renderer.render(getParser().parse("{{ csv | split: ',' | size }}"), variable), Renderer::Exception);
+    ASSERT_THROW(renderer.render(getParser().parse("{% for i in list %}{% for j in list %}{{ i }}{{ j }}{% endfor %}{% endfor %}"), variable), Renderer::Exception);
+    // Ranges whose sizes would wrap around are still refused.
+    ASSERT_THROW(renderer.render(getParser().parse("{% for i in (1..461168601842738791) %}{% endfor %}"), variable), Renderer::Exception);
+    ASSERT_THROW(renderer.render(getParser().parse("{% for i in (-9223372036854775807..9223372036854775806) %}{% endfor %}"), variable), Renderer::Exception);
+    ASSERT_EQ(renderer.render(getParser().parse("{% for i in (9223372036854775805..9223372036854775807) %}{{ i }},{% endfor %}"), variable), "9223372036854775805,9223372036854775806,9223372036854775807,");
+    renderer.maximumMemoryUsage = 0;
+    ASSERT_EQ(renderer.render(getParser().parse("{% for i in (-9223372036854775807..9223372036854775806) %}{% endfor %}done"), variable), "done");
+
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    interpreter.maximumMemoryUsage = 4096;
+    Program program = getCompiler().compile(getParser().parse("{% for i in list %}{% for j in list %}{{ i }}{{ j }}{% endfor %}{% endfor %}"));
+    ASSERT_THROW(interpreter.renderTemplate(program, variable), Renderer::Exception);
+    interpreter.maximumMemoryUsage = 0;
+    ASSERT_EQ(interpreter.renderTemplate(program, variable).size(), 38000);
+}
+
+TEST(sanity, timeLimit) {
+    CPPVariable variable, list = CPPVariable({ });
+    for (int i = 0; i < 100; ++i)
+        list.a.push_back(make_unique<CPPVariable>((long long)i));
+    variable["list"] = std::move(list);
+    auto nested = getParser().parse("{% for i in list %}{% for j in list %}{% for k in list %}{% for l in list %}{{ l }}{% endfor %}{% endfor %}{% endfor %}{% endfor %}");
+
+    Renderer renderer(getContext());
+    renderer.maximumRenderingSteps = 10000;
+    auto small = getParser().parse("{% for i in list %}{{ i }}{% endfor %}");
+    ASSERT_EQ(renderer.render(small, variable).size(), 190);
+    unsigned long long steps = renderer.currentRenderingSteps;
+    renderer.render(small, variable);
+    ASSERT_EQ(renderer.currentRenderingSteps, steps);
+    try {
+        renderer.render(nested, variable);
+        FAIL();
+    } catch (Renderer::Exception& exception) {
+        ASSERT_EQ(exception.rendererError.type, LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME);
+    }
+
+    renderer.maximumRenderingSteps = 0;
+    renderer.maximumRenderingTime = 50;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_THROW(renderer.render(nested, variable), Renderer::Exception);
+    ASSERT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(), 5000);
+
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    interpreter.maximumRenderingSteps = 10000;
+    ASSERT_THROW(interpreter.renderTemplate(getCompiler().compile(nested), variable), Renderer::Exception);
+}
+
+TEST(sanity, sharedArrays) {
+    Variant first(std::vector<Variant>{ Variant(1LL), Variant("a"), Variant(std::vector<Variant>{ Variant(2LL) }) });
+    Variant second = first;
+    // Copies share their elements until one of them is changed.
+    ASSERT_EQ(first.a.block, second.a.block);
+    ASSERT_EQ(&first.a[2].a[0], &second.a[2].a[0]);
+    second.a.push_back(Variant(3LL));
+    ASSERT_NE(first.a.block, second.a.block);
+    ASSERT_EQ(first.a.size(), 3);
+    ASSERT_EQ(second.a.size(), 4);
+    ASSERT_EQ(first.a[2].a.block, second.a[2].a.block);
+    Variant moved = std::move(second);
+    ASSERT_EQ(second.a.size(), 0);
+    ASSERT_EQ(moved.a.size(), 4);
+
+    CPPVariable variable;
+    Renderer renderer(getContext(), CPPVariableResolver());
+    renderer.scopedAssigns = true;
+    ASSERT_EQ(renderer.render(getParser().parse("{% assign x = 'c,a,b' | split: ',' %}{% assign y = x | sort %}{{ x | join: '-' }} {{ y | join: '-' }} {% for i in x %}{{ i }}{% endfor %}"), variable), "c-a-b a-b-c cab");
+    // Both for arrays of the template's own, and for ones in the store.
+    variable["list"] = CPPVariable({ 1, 2, 3 });
+    ASSERT_EQ(renderer.render(getParser().parse("{% assign x = 'c,a,b' | split: ',' %}{{ x | reverse | join: ',' }} {{ list | reverse | join: ',' }} {{ list | reverse | first }} {{ list | join: ',' }}"), variable), "b,a,c 3,2,1 3 1,2,3");
+}
+
+TEST(sanity, internalDrops) {
+    CPPVariable variable;
+    variable["list"] = CPPVariable({ "a", "b", "c" });
+    variable["item"] = "outer";
+    variable["forloop"] = "store";
+    auto ast = getParser().parse(
+        "{{ item }}{% for item in list %}{{ item }}{{ forloop.index }}{{ forloop.rindex0 }}{{ forloop.rindex }}{{ forloop.last }}"
+        "{% for item in list %}{{ item }}{{ forloop.index0 }}{% endfor %}{{ item }}{{ forloop.length }}{{ forloop.first }}{% cycle 'x', 'y' %}{% endfor %}{{ item }}{{ forloop }}"
+    );
+    Renderer renderer(getContext());
+    ASSERT_EQ(renderer.render(ast, variable), "outer"
+        "a123falsea0b1c2a3truex"
+        "b212falsea0b1c2b3falsey"
+        "c301truea0b1c2c3falsex"
+        "outerstore");
+    ASSERT_EQ(renderer.internalDrops.size(), 0);
+    // Dot filters on the loop variable apply to the element, rather than asking the drop.
+    ASSERT_EQ(renderer.render(getParser().parse("{% for item in list %}{{ item.size }}{{ item.first }}{{ item.last }}{% endfor %}"), variable), "111");
+}
+
+static std::vector<const char*> fusedBuffers;
+
+TEST(sanity, fusedFilters) {
+    struct MarkFilterNode : StringFilterNodeType {
+        MarkFilterNode() : StringFilterNodeType("mark", 0, 0) { }
+        void transform(Renderer& renderer, const Node& node, Variable store, std::string& str) const override {
+            fusedBuffers.push_back(str.data());
+            if (!str.empty())
+                str.back() = '!';
+        }
+    };
+    Context context;
+    StandardDialect::implementPermissive(context);
+    context.registerType<MarkFilterNode>();
+    Parser parser(context);
+    Renderer renderer(context, CPPVariableResolver());
+
+    CPPVariable variable;
+    variable["title"] = "  Wide Brimmed Sun Hat For The Beach ";
+    auto ast = parser.parse("{{ title | downcase | strip | replace: ' ', '-' | truncate: 20 | mark | upcase | mark }}|{{ title | rstrip | size }}|{{ '' | strip }}");
+    ASSERT_EQ(renderer.render(ast, variable), "WIDE-BRIMMED-SUN-..!|36|");
+    // Both marks were handed the same string.
+    ASSERT_EQ(fusedBuffers.size(), 2U);
+    ASSERT_EQ(fusedBuffers[0], fusedBuffers[1]);
+}
+
+static int propertyLookups = 0;
+
+// A CPPVariableResolver that counts its dictionary lookups in propertyLookups.
+static LiquidVariableResolver countingResolver() {
+    static LiquidVariableResolver base = CPPVariableResolver();
+    LiquidVariableResolver resolver = base;
+    resolver.getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
+        ++propertyLookups;
+        return base.getDictionaryVariable(renderer, variable, key, target);
+    };
+    return resolver;
+}
+
+TEST(sanity, arrayPipelines) {
+    CPPVariable variable, products = CPPVariable({ });
+    for (int i = 0; i < 1000; ++i) {
+        CPPVariable product;
+        product["title"] = "P" + std::to_string(i);
+        product["available"] = i % 2 == 1;
+        product["type"] = i % 3 == 0 ? "hat" : "shirt";
+        products.a.push_back(make_unique<CPPVariable>(std::move(product)));
+    }
+    variable["products"] = std::move(products);
+
+    Renderer renderer(getContext(), countingResolver());
+    propertyLookups = 0;
+    // Stops as soon as the first available product is found.
+    ASSERT_EQ(renderer.render(getParser().parse("{{ products | where: 'available' | map: 'title' | first }}"), variable), "P1");
+    ASSERT_LE(propertyLookups, 5);
+
+    auto ast = getParser().parse("{{ products | where: 'type', 'hat' | size }} {{ products | where: 'available' | map: 'title' | last }} "
+        "{{ products | map: 'type' | uniq | join: ',' }} {{ products | where: 'type', 'hat' | where: 'available' | map: 'title' | first }} {{ products | map: 'missing' | uniq | size }}");
+    ASSERT_EQ(renderer.render(ast, variable), "334 P999 hat,shirt P3 1");
+
+    // 0, false and nil all hash alike, as do 1 and true; uniq only drops values that are actually equal.
+    variable["mixed"] = CPPVariable({ 0, false, 1, true, CPPVariable(), 0, true, "1", "true", CPPVariable(), 1 });
+    ASSERT_EQ(renderer.render(getParser().parse("{{ mixed | uniq | size }} {{ mixed | uniq | join: ',' }} {{ mixed | map: 'x' | uniq | size }}"), variable), "7 0,false,1,true,,1,true 1");
+}
+
+TEST(sanity, sortKeys) {
+    CPPVariable variable, products = CPPVariable({ }), numbers = CPPVariable({ });
+    const char* titles[] = { "banana", "Cherry", "apple", "Date" };
+    for (int i = 0; i < 4; ++i) {
+        CPPVariable product;
+        product["title"] = titles[i];
+        product["price"] = i == 1 ? CPPVariable(2.5) : CPPVariable((long long)(10 - i * 3));
+        products.a.push_back(make_unique<CPPVariable>(std::move(product)));
+    }
+    variable["products"] = std::move(products);
+    for (long long i = 0; i < 70000; ++i)
+        numbers.a.push_back(make_unique<CPPVariable>((i * 7919) % 70000));
+    variable["numbers"] = std::move(numbers);
+    // Integers beyond a double's precision, next to an equal float, and a NaN; none of which may upset the ordering.
+    CPPVariable mixed = CPPVariable({ });
+    mixed.a.push_back(make_unique<CPPVariable>(9007199254740993LL));
+    mixed.a.push_back(make_unique<CPPVariable>(9007199254740992.0));
+    mixed.a.push_back(make_unique<CPPVariable>(9007199254740992LL));
+    mixed.a.push_back(make_unique<CPPVariable>(std::numeric_limits<double>::quiet_NaN()));
+    mixed.a.push_back(make_unique<CPPVariable>(1LL));
+    mixed.a.push_back(make_unique<CPPVariable>(1.5));
+    variable["mixed"] = std::move(mixed);
+
+    Renderer renderer(getContext(), countingResolver());
+    propertyLookups = 0;
+    // Each element's key is looked up once, not on every comparison.
+    ASSERT_EQ(renderer.render(getParser().parse("{{ products | sort: 'price' | map: 'title' | join: ',' }}"), variable), "Date,Cherry,apple,banana");
+    ASSERT_EQ(propertyLookups, 4 + 4);
+    ASSERT_EQ(renderer.render(getParser().parse("{{ products | sort: 'title' | map: 'title' | join: ',' }}"), variable), "Cherry,Date,apple,banana");
+    ASSERT_EQ(renderer.render(getParser().parse("{{ products | sort_natural: 'title' | map: 'title' | join: ',' }}"), variable), "apple,banana,Cherry,Date");
+    ASSERT_EQ(renderer.render(getParser().parse("{{ products | sort: 'missing' | map: 'title' | join: ',' }}"), variable), "banana,Cherry,apple,Date");
+    ASSERT_EQ(renderer.render(getParser().parse("{% assign x = 'b,C,a' | split: ',' %}{{ x | sort | join: '-' }} {{ x | sort_natural | join: '-' }}"), variable), "C-a-b a-b-C");
+    ASSERT_EQ(renderer.render(getParser().parse("{{ mixed | sort | join: ',' }}"), variable), "1,1.500000,9007199254740992.000000,9007199254740992,9007199254740993,nan");
+    ASSERT_EQ(renderer.render(getParser().parse("{% assign sorted = numbers | sort %}{{ sorted | first }} {{ sorted[34999] }} {{ sorted | last }} {{ sorted | size }}"), variable), "0 34999 69999 70000");
+    // Split across threads only when the renderer allows it; the order's the same either way.
+    auto sortAst = getParser().parse("{% assign sorted = numbers | sort %}{{ sorted | first }} {{ sorted[34999] }} {{ sorted | last }}");
+    renderer.maximumSortThreads = 4;
+    ASSERT_EQ(renderer.render(sortAst, variable), "0 34999 69999");
+    renderer.maximumSortThreads = 1;
+
+    // Both decorating and sorting count against the limits.
+    renderer.maximumRenderingSteps = 70000 * 16;
+    try {
+        renderer.render(sortAst, variable);
+        FAIL();
+    } catch (Renderer::Exception& exception) {
+        ASSERT_EQ(exception.rendererError.type, LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME);
+    }
+    renderer.maximumRenderingSteps = 70000 * 20;
+    ASSERT_EQ(renderer.render(sortAst, variable), "0 34999 69999");
+    renderer.maximumRenderingSteps = 0;
+    renderer.maximumMemoryUsage = 1024 * 1024;
+    ASSERT_THROW(renderer.render(sortAst, variable), Renderer::Exception);
+    renderer.maximumMemoryUsage = 16 * 1024 * 1024;
+    ASSERT_EQ(renderer.render(sortAst, variable), "0 34999 69999");
+}
+
+TEST(sanity, jsonStore) {
+    std::string json = R"({
+        "product": { "title": "Wide \"Brimmed\" Hat", "price": 2.5, "count": 3, "big": 123456789012345678901234, "available": true, "missing": null,
+            "tags": [ "a", "b", "c" ], "accent": "café 😀" },
+        "numbers": [ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20 ],
+        "keys": { "k1": 1, "k2": 2, "k3": 3, "k4": 4, "k5": 5, "k6": 6, "k7": 7, "k8": 8, "k9": 9, "k10": 10, "k11": 11, "k12": 12, "k13": 13, "k14": 14, "k15": 15, "k16": 16, "k17": 17 }
+    })";
+    JSONStore store(json.data(), json.size());
+    // Nothing's decoded up front, and plain strings are viewed right out of the document.
+    ASSERT_TRUE(store.tape[0].getDictionaryVariable("product")->getDictionaryVariable("tags")->getArrayVariable(1)->data > json.data());
+    ASSERT_TRUE(store.tape[0].getDictionaryVariable("numbers")->getArrayVariable(0)->pending);
+
+    Renderer renderer(getContext(), JSONStoreResolver());
+    renderer.resolverCustomData = &store;
+    auto ast = getParser().parse("{{ product.title }} {{ product.price }} {{ product.count | plus: 1 }} {{ product.available }}{{ product.missing }} {{ product.tags[1] }} {{ product.tags.size }} {{ product.accent }} "
+        "{% for tag in product.tags reversed %}{{ tag }}{% endfor %} {% for n in numbers limit: 3 offset: 17 %}{{ n }}{% endfor %} {{ numbers[-1] }} {{ keys.k17 }}{{ keys.k1 }}{{ keys.k18 }} "
+        "{% assign product.title = \"Cap\" %}{% assign x = numbers | size %}{{ product.title }} {{ x }} {% if product.big > 1000 %}big{% endif %}");
+    ASSERT_EQ(renderer.render(ast, store), "Wide \"Brimmed\" Hat 2.5 4 true b 3 café \U0001F600 cba 181920 20 171 Cap 20 big");
+    // The document's untouched, so the same store can be reindexed, or rendered with the static renderer.
+    StaticRenderer<JSONStoreResolver> staticRenderer(getContext());
+    staticRenderer.resolverCustomData = &store;
+    ASSERT_EQ(staticRenderer.render(getParser().parse("{{ product.title }} {{ product.tags.first }}"), store), "Cap a");
+    // Past the index threshold, assigned keys shadow the hashed ones just the same; new keys, and quoted strings, come through the store's creators.
+    ast = getParser().parse("{% assign keys.k17 = '\"x\"' %}{% assign keys.k18 = keys.k2 | times: 9 %}{% assign keys.k1 = product.accent %}{{ keys.k17 }} {{ keys.k18 }} {{ keys.k1 }} {{ keys.k16 }}");
+    ASSERT_EQ(renderer.render(ast, store), "\"x\" 18 café \U0001F600 16");
+    ASSERT_EQ(staticRenderer.render(getParser().parse("{{ keys.k17 }}{{ keys.k18 }}{{ keys.k3 }}"), store), "\"x\"183");
+
+    ASSERT_THROW(JSONStore("{ \"a\": [1, 2 }", 14), Liquid::Exception);
+    ASSERT_THROW(JSONStore("{ \"a\": 1 } x", 12), Liquid::Exception);
+    for (std::string malformed : { "[1-2]", "[1.2.3]", "[007]", "[1e]", "[1.]", "[-]", "[.5]", "[\"\\x\"]", "[\"\\u12\"]", "[\"\\u12G4\"]", "[\"\\", "[\"\xff\"]x" })
+        ASSERT_THROW(JSONStore(malformed.data(), malformed.size()), Liquid::Exception) << malformed;
+    std::string wellFormed = "[0, -0.5, 1e5, 2E-3, 10, \"\\u00e9\\/\\\"\", \"\xff\"]";
+    JSONStore numbers(wellFormed.data(), wellFormed.size());
+    ASSERT_EQ(numbers.root().length, 7);
+
+    LiquidContext context = liquidCreateContext();
+    liquidImplementStrictStandardDialect(context);
+    LiquidParser parser = liquidCreateParser(context);
+    LiquidRenderer cRenderer = liquidCreateRenderer(context);
+    ASSERT_FALSE(liquidCreateJSONStore("[1,", 3).store);
+    LiquidJSONStore cStore = liquidCreateJSONStore(json.data(), json.size());
+    ASSERT_TRUE(cStore.store);
+    liquidRendererSetJSONStore(cRenderer, cStore);
+    char buffer[] = "{{ product.tags | join: \",\" }} {{ keys.k9 | times: 2 }}";
+    LiquidTemplate tmpl = liquidParserParseTemplate(parser, buffer, strlen(buffer), nullptr, nullptr, nullptr);
+    LiquidTemplateRender result = liquidRendererRenderTemplate(cRenderer, liquidJSONStoreGetRoot(cStore), tmpl, nullptr);
+    ASSERT_STREQ(liquidTemplateRenderGetBuffer(result), "a,b,c 18");
+    liquidFreeTemplateRender(result);
+    liquidFreeTemplate(tmpl);
+    liquidFreeJSONStore(cStore);
+    liquidFreeRenderer(cRenderer);
+    liquidFreeParser(parser);
+    liquidFreeContext(context);
+}
+
 
 
 TEST(sanity, whitespace) {
@@ -868,6 +1493,36 @@ TEST(sanity, optimizer) {
     hash["a"] = nullptr;
 }
 
+TEST(sanity, deadStores) {
+    CPPVariable hash;
+    Node ast;
+    std::string str;
+
+    ast = getParser().parse("{% assign a = 1 %}{% capture b %}B{% endcapture %}{% assign c = 2 %}{{ c }}");
+    ASSERT_EQ(getOptimizer().removeDeadStores(ast), 2);
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "2");
+    ASSERT_EQ(getParser().unparse(ast), "{% assign c = 2 %}{{ c }}");
+
+    ast = getParser().parse("{% assign a = 1 %}{% assign a = 2 %}{{ a }}{% assign b = a %}");
+    ASSERT_EQ(getOptimizer().removeDeadStores(ast), 2);
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "2");
+
+    ast = getParser().parse("{% assign a = 1 %}{% assign a = a | plus: 1 %}{{ a }}");
+    ASSERT_EQ(getOptimizer().removeDeadStores(ast), 0);
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "2");
+
+    ast = getParser().parse("{% for i in (1..3) %}{% assign a = i %}{% if i == 2 %}{% break %}{% endif %}{% assign a = 0 %}{% endfor %}{{ a }}");
+    ASSERT_EQ(getOptimizer().removeDeadStores(ast), 0);
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "2");
+
+    ast = getParser().parse("{% assign a = 1 %}{% if b %}{% assign a = 2 %}{% endif %}{{ a }}");
+    ASSERT_EQ(getOptimizer().removeDeadStores(ast), 0);
+}
+
 TEST(sanity, sequence) {
     CPPVariable hash;
     Node ast;
@@ -1148,6 +1803,361 @@ TEST(sanity, clang) {
     liquidFreeContext(context);
 }
 
+TEST(sanity, templates) {
+    CPPVariable hash = { };
+    hash["a"] = "B";
+    std::string str;
+
+    Template tmpl = getParser().parseTemplate(std::string("<p>raw text</p>{% if a %}{{ a }}{% endif %}<br/>"));
+    ASSERT_NO_PARSER_ERRORS();
+    ASSERT_EQ(tmpl.ast.children.front()->variant.type, Variant::Type::STRING_VIEW);
+    ASSERT_TRUE(tmpl.ast.children.front()->variant.view >= tmpl.source && tmpl.ast.children.front()->variant.view < tmpl.source + tmpl.size);
+    Template moved = move(tmpl);
+    str = renderTemplate(moved.ast, hash);
+    ASSERT_EQ(str, "<p>raw text</p>B<br/>");
+    ASSERT_EQ(getParser().unparse(moved.ast), "<p>raw text</p>{% if a %}{{ a }}{% endif %}<br/>");
+
+    char path[] = "/tmp/liquidtemplateXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    std::string contents = "<p>{{ a }}</p>\n{% raw %}{{ a }}{% endraw %}";
+    ASSERT_EQ(write(fd, contents.data(), contents.size()), (ssize_t)contents.size());
+    close(fd);
+
+    tmpl = getParser().parseFile(path);
+    str = renderTemplate(tmpl.ast, hash);
+    ASSERT_EQ(str, "<p>B</p>\n{{ a }}");
+
+    LiquidContext context = liquidCreateContext();
+    liquidImplementStrictStandardDialect(context);
+    LiquidParser parser = liquidCreateParser(context);
+    LiquidRenderer renderer = liquidCreateRenderer(context);
+    liquidRegisterVariableResolver(renderer, CPPVariableResolver());
+    LiquidTemplate ctmpl = liquidParserParseFile(parser, path, nullptr, nullptr);
+    ASSERT_TRUE(ctmpl.ast);
+    LiquidTemplateRender result = liquidRendererRenderTemplate(renderer, &hash, ctmpl, nullptr);
+    ASSERT_STREQ(liquidTemplateRenderGetBuffer(result), "<p>B</p>\n{{ a }}");
+    liquidFreeTemplateRender(result);
+    liquidFreeTemplate(ctmpl);
+    unlink(path);
+
+    ctmpl = liquidParserParseFile(parser, path, nullptr, nullptr);
+    ASSERT_TRUE(!ctmpl.ast);
+
+    liquidFreeRenderer(renderer);
+    liquidFreeParser(parser);
+    liquidFreeContext(context);
+}
+
+struct CountingResource : std::pmr::memory_resource {
+    size_t allocations = 0;
+    size_t outstanding = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override { ++allocations; outstanding += bytes; return std::pmr::new_delete_resource()->allocate(bytes, alignment); }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override { outstanding -= bytes; std::pmr::new_delete_resource()->deallocate(p, bytes, alignment); }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+TEST(sanity, arenas) {
+    CPPVariable hash = { };
+    hash["a"] = "B";
+    std::string str;
+    CountingResource resource;
+
+    Parser parser(getContext());
+    parser.memoryResource = &resource;
+    std::string source;
+    for (int i = 0; i < 200; ++i)
+        source += "<li>{% if a %}{{ a | upcase }}{% else %}none{% endif %}</li>\n";
+    {
+        Template tmpl = parser.parseTemplate(source);
+        ASSERT_EQ(parser.errors.size(), 0);
+        // The whole tree comes out of a handful of blocks, rather than one per node.
+        ASSERT_GT(resource.allocations, 0);
+        ASSERT_LT(resource.allocations, 16);
+        str = renderTemplate(tmpl.ast, hash);
+        ASSERT_EQ(str.substr(0, 12), "<li>B</li>\n<");
+        // Variables' compiled paths come out of the arena too.
+        size_t paths = 0;
+        std::pmr::memory_resource* arena = tmpl.arena.get();
+        tmpl.ast.walk([&paths, arena](const Node& node) {
+            if (node.type && node.path && node.path->segments.get_allocator().resource() == arena)
+                ++paths;
+        });
+        ASSERT_EQ(paths, 400);
+        Template moved = move(tmpl);
+        ASSERT_GT(resource.outstanding, 0);
+    }
+    ASSERT_EQ(resource.outstanding, 0);
+
+    // Plain parses allocate each node straight from the resource.
+    size_t allocations = resource.allocations;
+    {
+        Node ast = parser.parse("{% if a %}{{ a }}{% endif %}");
+        ASSERT_GT(resource.allocations, allocations);
+        ASSERT_GT(resource.outstanding, 0);
+        str = getRenderer().render(ast, hash);
+        ASSERT_EQ(str, "B");
+    }
+    ASSERT_EQ(resource.outstanding, 0);
+    ASSERT_THROW(parser.parseTemplate(std::string("{% if a %}")), Parser::Exception);
+    ASSERT_EQ(resource.outstanding, 0);
+
+    // Only nodes from a resource carry a header; they're told apart from the heap's by where they sit, so either can be freed anywhere.
+    auto heapNode = make_unique<Node>();
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(heapNode.get()) % ResourceAllocated::BLOCK_ALIGNMENT, 0);
+    {
+        Node::ResourceScope scope(&resource);
+        auto resourceNode = make_unique<Node>();
+        ASSERT_EQ(resource.outstanding, sizeof(Node) + ResourceAllocated::RESOURCE_HEADER_SIZE);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(resourceNode.get()) % ResourceAllocated::BLOCK_ALIGNMENT, ResourceAllocated::RESOURCE_HEADER_SIZE);
+        heapNode.reset();
+    }
+    ASSERT_EQ(resource.outstanding, 0);
+}
+
+TEST(sanity, reparse) {
+    CPPVariable hash = { };
+    hash["a"] = "A";
+    hash["b"] = "B";
+    std::string str;
+
+    std::string source = "header\n{% if a %}{{ a }}{% endif %}\nmiddle\n{{ b }}\nfooter\n{% if b %}x{% endif %}";
+    Template tmpl = getParser().parseTemplate(source);
+    ASSERT_NO_PARSER_ERRORS();
+    ASSERT_EQ(tmpl.ast.children.back()->line, 6);
+
+    getParser().reparse(tmpl, source.find("middle"), 6, "changed\nlines", 13);
+    ASSERT_NO_PARSER_ERRORS();
+    ASSERT_EQ(std::string(tmpl.source, tmpl.size), "header\n{% if a %}{{ a }}{% endif %}\nchanged\nlines\n{{ b }}\nfooter\n{% if b %}x{% endif %}");
+    ASSERT_EQ(tmpl.ast.children.back()->line, 7);
+    str = renderTemplate(tmpl.ast, hash);
+    ASSERT_EQ(str, "header\nA\nchanged\nlines\nB\nfooter\nx");
+
+    Template full = getParser().parseTemplate(std::string(tmpl.source, tmpl.size));
+    ASSERT_EQ(getParser().unparse(tmpl.ast), getParser().unparse(full.ast));
+
+    // Breaking a tag across the edit falls back to a full parse.
+    size_t offset = std::string(tmpl.source, tmpl.size).find("{{ b }}");
+    getParser().reparse(tmpl, offset + 5, 2, "| upcase }}", 11);
+    str = renderTemplate(tmpl.ast, hash);
+    ASSERT_EQ(str, "header\nA\nchanged\nlines\nB\nfooter\nx");
+
+    // An edit that leaves a block open throws, and leaves the template as it was.
+    ASSERT_THROW(getParser().reparse(tmpl, 0, 6, "{% if a %}", 10), Parser::Exception);
+    ASSERT_EQ(std::string(tmpl.source, 6), "header");
+    str = renderTemplate(tmpl.ast, hash);
+    ASSERT_EQ(str, "header\nA\nchanged\nlines\nB\nfooter\nx");
+
+    // As do edits outside the source, and templates with no source text to edit.
+    ASSERT_THROW(getParser().reparse(tmpl, tmpl.size + 1, 0, "x", 1), Parser::Exception);
+    ASSERT_THROW(getParser().reparse(tmpl, 2, (size_t)-1, "x", 1), Parser::Exception);
+    ASSERT_EQ(renderTemplate(tmpl.ast, hash), str);
+    Serializer serializer(getContext());
+    Template loaded = serializer.deserializeTemplate(serializer.serialize(tmpl));
+    ASSERT_THROW(getParser().reparse(loaded, 0, 6, "title", 5), Parser::Exception);
+    ASSERT_EQ(renderTemplate(loaded.ast, hash), str);
+
+    LiquidContext context = liquidCreateContext();
+    liquidImplementStrictStandardDialect(context);
+    LiquidParser parser = liquidCreateParser(context);
+    LiquidTemplate ctmpl = liquidParserParseTemplate(parser, source.data(), source.size(), nullptr, nullptr, nullptr);
+    ASSERT_TRUE(ctmpl.ast);
+    LiquidParserError parserError;
+    ASSERT_TRUE(liquidParserReparseTemplate(parser, ctmpl, 0, 6, "title", 5, nullptr, &parserError));
+    ASSERT_FALSE(liquidParserReparseTemplate(parser, ctmpl, 0, 5, "{% if a %}", 10, nullptr, &parserError));
+    ASSERT_EQ(parserError.type, LIQUID_PARSER_ERROR_TYPE_UNEXPECTED_END);
+    ASSERT_FALSE(liquidParserReparseTemplate(parser, ctmpl, source.size() + 10, 1, "x", 1, nullptr, &parserError));
+    ASSERT_EQ(parserError.type, LIQUID_PARSER_ERROR_TYPE_INVALID_EDIT);
+    liquidFreeTemplate(ctmpl);
+    liquidFreeParser(parser);
+    liquidFreeContext(context);
+}
+
+TEST(sanity, themes) {
+    CPPVariable hash = { };
+    hash["a"] = "B";
+    std::string str;
+
+    char directory[] = "/tmp/liquidthemeXXXXXX";
+    ASSERT_TRUE(mkdtemp(directory));
+    std::string root = directory;
+    ASSERT_EQ(mkdir((root + "/snippets").c_str(), 0700), 0);
+    std::vector<std::pair<std::string, std::string>> files = {
+        { "/layout.liquid", "<html>{{ a }}</html>" },
+        { "/snippets/header.liquid", "{% if a %}<h1>{{ a }}</h1>{% endif %}" },
+        { "/snippets/broken.liquid", "{% if a %}unclosed" },
+        { "/notes.txt", "{{ a }}" }
+    };
+    for (int i = 0; i < 40; ++i)
+        files.emplace_back("/snippets/item" + std::to_string(i) + ".liquid", "{{ a }}" + std::to_string(i));
+    for (auto& file : files) {
+        FILE* handle = fopen((root + file.first).c_str(), "wb");
+        ASSERT_TRUE(handle);
+        fwrite(file.second.data(), 1, file.second.size(), handle);
+        fclose(handle);
+    }
+
+    ThemeLoader loader(getContext());
+    loader.threads = 4;
+    Theme theme = loader.loadDirectory(root);
+    ASSERT_EQ(theme.templates.size(), 42);
+    ASSERT_TRUE(theme.getTemplate("layout"));
+    ASSERT_FALSE(theme.getTemplate("notes"));
+    ASSERT_FALSE(theme.getTemplate("snippets/broken"));
+    ASSERT_FALSE(theme.getProgram("layout"));
+    str = renderTemplate(theme.getTemplate("snippets/header")->ast, hash);
+    ASSERT_EQ(str, "<h1>B</h1>");
+    str = renderTemplate(theme.getTemplate("snippets/item17")->ast, hash);
+    ASSERT_EQ(str, "B17");
+    ASSERT_EQ(theme.errors.size(), 1);
+    ASSERT_EQ(theme.errors[0].file, root + "/snippets/broken.liquid");
+    ASSERT_EQ(theme.errors[0].parserError.type, LIQUID_PARSER_ERROR_TYPE_UNEXPECTED_END);
+
+    loader.optimize = true;
+    loader.resolver = CPPVariableResolver();
+    loader.store = hash;
+    theme = loader.loadFiles({ root + "/layout.liquid", root + "/missing.liquid" }, { "layout", "missing" });
+    ASSERT_EQ(theme.templates.size(), 1);
+    str = getParser().unparse(theme.getTemplate("layout")->ast);
+    ASSERT_EQ(str, "<html>B</html>");
+    ASSERT_EQ(theme.errors.size(), 1);
+    ASSERT_EQ(theme.errors[0].file, root + "/missing.liquid");
+    ASSERT_FALSE(theme.errors[0].parserError);
+    ASSERT_FALSE(theme.errors[0].message.empty());
+
+    LiquidContext context = liquidCreateContext();
+    liquidImplementStrictStandardDialect(context);
+    LiquidThemeLoader cloader = liquidCreateThemeLoader(context, 0);
+    liquidThemeLoaderSetCompile(cloader, true);
+    LiquidTheme ctheme = liquidThemeLoaderLoadDirectory(cloader, directory, nullptr);
+    ASSERT_TRUE(ctheme.theme);
+    ASSERT_EQ(liquidGetThemeTemplateCount(ctheme), 42);
+    ASSERT_TRUE(liquidGetThemeTemplate(ctheme, "snippets/item3").ast);
+    ASSERT_TRUE(liquidGetThemeProgram(ctheme, "snippets/item3").program);
+    ASSERT_EQ(liquidGetThemeErrorCount(ctheme), 1);
+    char buffer[512];
+    liquidGetThemeErrorMessage(ctheme, 0, buffer, sizeof(buffer));
+    ASSERT_TRUE(strstr(buffer, "broken.liquid"));
+    liquidFreeTheme(ctheme);
+    ctheme = liquidThemeLoaderLoadDirectory(cloader, (root + "/missing").c_str(), nullptr);
+    ASSERT_FALSE(ctheme.theme);
+    liquidFreeThemeLoader(cloader);
+    liquidFreeContext(context);
+
+    for (auto& file : files)
+        unlink((root + file.first).c_str());
+    rmdir((root + "/snippets").c_str());
+    rmdir(directory);
+}
+
+TEST(sanity, freeze) {
+    CPPVariable hash = { };
+    hash["a"] = "B";
+    std::string str;
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    #ifdef LIQUID_INCLUDE_WEB_DIALECT
+        WebDialect::implement(context);
+    #endif
+    std::string source = "{% for i in (1..3) reversed limit: 2 %}{% if a == 'B' and i > 1 %}{{ a | downcase }}{% elsif -i %}{% else %}{% endif %}{% endfor %}{{ a.size }}{{ true }}";
+    Parser parser(context);
+    Node unfrozen = parser.parse(source);
+    ASSERT_EQ(parser.errors.size(), 0);
+
+    context.freeze();
+    ASSERT_TRUE(context.isFrozen());
+    for (auto& it : context.filterTypes)
+        ASSERT_EQ(context.getFilterType(it.first), it.second.get());
+    for (auto& it : context.tagTypes)
+        ASSERT_EQ(context.getTagType(it.first), it.second.get());
+    ASSERT_FALSE(context.getFilterType("downcas"));
+    ASSERT_FALSE(context.getFilterType(""));
+    ASSERT_FALSE(context.getTagType("endif"));
+    ASSERT_TRUE(context.getTagType("if")->getIntermediate("elsif"));
+    ASSERT_TRUE(context.getTagType("for")->getQualifier("reversed"));
+    ASSERT_FALSE(context.getTagType("for")->getQualifier("forwards"));
+
+    Node frozen = parser.parse(source);
+    ASSERT_EQ(parser.errors.size(), 0);
+    Renderer renderer(context, CPPVariableResolver());
+    str = renderer.render(frozen, hash);
+    ASSERT_EQ(str, "b1true");
+    ASSERT_EQ(renderer.render(unfrozen, hash), str);
+
+    ASSERT_THROW(context.registerType<SchemaNode>(), Liquid::Exception);
+}
+
+TEST(sanity, serialization) {
+    CPPVariable hash = { };
+    hash["a"] = "b";
+    hash["list"] = CPPVariable({ 3, 1, 2 });
+    std::string str;
+
+    const char* source = "{% assign x = 1.5 %}{% if a == \"b\" %}{{ a | upcase }}{% elsif false %}no{% else %}{{ x }}{% endif %}"
+        "{% for i in list reversed limit: 2 %}{{ i }},{% endfor %}{{ [1, \"two\", true] | join: \"-\" }}{% raw %}{{ raw }}{% endraw %}";
+    Template tmpl = getParser().parseTemplate(source);
+    Serializer serializer(getContext());
+    std::string data = serializer.serialize(tmpl);
+    Template loaded = serializer.deserializeTemplate(data);
+    str = renderTemplate(loaded.ast, hash);
+    ASSERT_EQ(str, "B1,3,1-two-true{{ raw }}");
+    ASSERT_EQ(str, renderTemplate(tmpl.ast, hash));
+    ASSERT_EQ(serializer.serialize(loaded), data);
+
+    Program program = getCompiler().compile(getParser().parse("{{ a | upcase }}"));
+    Program loadedProgram = serializer.deserializeProgram(serializer.serialize(program));
+    ASSERT_EQ(loadedProgram.codeOffset, program.codeOffset);
+    ASSERT_EQ(loadedProgram.code, program.code);
+
+    // Kinds, versions, dialects and checksums all have to match.
+    ASSERT_THROW(serializer.deserializeProgram(data), Liquid::Exception);
+    ASSERT_THROW(serializer.deserializeTemplate(data.substr(0, data.size() - 1)), Liquid::Exception);
+    std::string corrupt = data;
+    corrupt[corrupt.size() - 3] ^= 1;
+    ASSERT_THROW(serializer.deserializeTemplate(corrupt), Liquid::Exception);
+    Context context;
+    StandardDialect::implementStrict(context);
+    Serializer other(context);
+    ASSERT_NE(other.fingerprint, serializer.fingerprint);
+    ASSERT_THROW(other.deserializeTemplate(data), Liquid::Exception);
+
+    char path[] = "/tmp/liquidserializedXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+    serializer.saveTemplate(path, tmpl);
+    loaded = serializer.loadTemplate(path);
+    ASSERT_EQ(renderTemplate(loaded.ast, hash), str);
+
+    LiquidContext ccontext = liquidCreateContext();
+    liquidImplementStrictStandardDialect(ccontext);
+    LiquidParser parser = liquidCreateParser(ccontext);
+    LiquidTemplate ctmpl = liquidParserParseTemplate(parser, "{{ 1 | plus: 2 }}", 17, nullptr, nullptr, nullptr);
+    ASSERT_TRUE(ctmpl.ast);
+    LiquidSerializer cserializer = liquidCreateSerializer(ccontext);
+    size_t size = liquidSerializerSerializeTemplate(cserializer, ctmpl, nullptr, 0);
+    ASSERT_GT(size, 0);
+    std::vector<char> buffer(size);
+    ASSERT_EQ(liquidSerializerSerializeTemplate(cserializer, ctmpl, buffer.data(), buffer.size()), size);
+    LiquidTemplate ctmplLoaded = liquidSerializerDeserializeTemplate(cserializer, buffer.data(), buffer.size());
+    ASSERT_TRUE(ctmplLoaded.ast);
+    buffer[buffer.size() - 1] ^= 1;
+    ASSERT_FALSE(liquidSerializerDeserializeTemplate(cserializer, buffer.data(), buffer.size()).ast);
+    ASSERT_TRUE(liquidSerializerSaveTemplate(cserializer, ctmplLoaded, path));
+    LiquidTemplate ctmplFile = liquidSerializerLoadTemplate(cserializer, path);
+    ASSERT_TRUE(ctmplFile.ast);
+    ASSERT_FALSE(liquidSerializerLoadProgram(cserializer, path).program);
+    liquidFreeTemplate(ctmplFile);
+    liquidFreeTemplate(ctmplLoaded);
+    liquidFreeTemplate(ctmpl);
+    liquidFreeSerializer(cserializer);
+    liquidFreeParser(parser);
+    liquidFreeContext(ccontext);
+    unlink(path);
+}
+
 TEST(sanity, vm) {
     /*CPPVariable hash = { };
     Node ast;
@@ -1257,6 +2267,12 @@ TEST(sanity, error) {
     });
     ASSERT_EQ(getParser().errors.size(), 1);
 
+    ASSERT_NO_THROW({
+        ast = getParser().parse("<html>\n  <body>\n\n    <p>text that is long enough to span a few blocks</p>\n{% endif %}</body></html>");
+    });
+    ASSERT_EQ(getParser().errors.size(), 1);
+    ASSERT_EQ(getParser().errors[0].details.line, 5);
+
     auto context = liquidCreateContext();
     liquidImplementPermissiveStandardDialect(context);
     auto parser = liquidCreateParser(context);
@@ -1372,6 +2388,16 @@ TEST(sanity, web) {
     str = renderTemplate(ast, hash);
     ASSERT_EQ(str, "&lt;html&gt;&lt;/html&gt;");
 
+    // Long enough to be scanned in blocks, with specials on either side of a block boundary, and at the very end.
+    ast = getParser().parse("{{ 'a plain string, long enough to need no escape' | escape }}|{{ 'fifteen chars.&\"sixteen chars..<' | escape }}|{{ b | escape }}");
+    hash["b"] = "it's > 'that' & \"this\"";
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "a plain string, long enough to need no escape|fifteen chars.&amp;&quot;sixteen chars..&lt;|it&apos;s &gt; &apos;that&apos; &amp; &quot;this&quot;");
+
+    ast = getParser().parse("{{ 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789' | url_encode }}|{{ 'a b/c?d=é@[`{' | url_encode }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789|a%20b%2fc%3fd%3d%c3%a9%40%5b%60%7b");
+
     ast = getParser().parse("{{ 1608524371 | date: \"%B %d, %Y\" }}");
     str = renderTemplate(ast, hash);
     ASSERT_EQ(str, "December 20, 2020");